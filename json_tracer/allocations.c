@@ -0,0 +1,534 @@
+#include "dr_api.h"
+#include "drwrap.h"
+
+#include "allocations.h"
+
+typedef enum {
+    allocMalloc,
+    allocCalloc,
+    allocRealloc,
+    allocFree
+} alloc_kind_t;
+
+typedef struct {
+    const char *name;
+    alloc_kind_t kind;
+} allocator_t;
+
+typedef struct {
+    uint64_t size, site;
+    void *oldPtr;
+} pending_alloc_t;
+
+static const allocator_t allocators[] = {
+    {"malloc", allocMalloc},
+    {"calloc", allocCalloc},
+    {"realloc", allocRealloc},
+    {"free", allocFree},
+    {"_Znwm", allocMalloc},
+    {"_Znam", allocMalloc},
+    {"_ZnwmRKSt9nothrow_t", allocMalloc},
+    {"_ZnamRKSt9nothrow_t", allocMalloc},
+    {"_ZdlPv", allocFree},
+    {"_ZdaPv", allocFree},
+    {"_ZdlPvm", allocFree},
+    {"_ZdaPvm", allocFree}
+};
+
+#define NUM_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+/*
+ * An allocation in a treap ordered by start address then generation, with
+ * the furthest end of its subtree kept to find the allocations containing an
+ * address, and freed allocations also kept in the order they were freed
+ */
+typedef struct alloc_node {
+    allocation_t alloc;
+    uint64_t allocGen, freeGen;
+    uint64_t maxEnd;
+    uint32_t priority;
+    struct alloc_node *left, *right;
+    struct alloc_node *nextFreed;
+} alloc_node_t;
+
+/*
+ * Allocations made since each thread's buffer began, including those freed
+ * since, with the generation counting the blocks freed so far, and a freed
+ * allocation's free generation being the generation it was freed at
+ */
+static alloc_node_t *root;
+static alloc_node_t *firstFreed, *lastFreed;
+static uint64_t generation;
+static uint32_t nextPriority;
+static allocation_window_t *windows;
+static void *allocsLock;
+
+static flush_entries_t flushEntries;
+
+/*
+ * Saves the size and call site of an allocation
+ */
+static void preMalloc(void *wrapcxt, void **userData);
+
+/*
+ * Saves the size and call site of a zeroed allocation
+ */
+static void preCalloc(void *wrapcxt, void **userData);
+
+/*
+ * Saves the old block, new size and call site of a reallocation
+ */
+static void preRealloc(void *wrapcxt, void **userData);
+
+/*
+ * Adds an allocation which has been made to the index
+ */
+static void postAlloc(void *wrapcxt, void *userData);
+
+/*
+ * Removes a block which is about to be freed from the index
+ */
+static void preFree(void *wrapcxt, void **userData);
+
+/*
+ * Allocates the details of an allocation kept between its pre and post
+ * callbacks
+ */
+static pending_alloc_t *createPending(void *wrapcxt, uint64_t size);
+
+/*
+ * Finds the allocation containing an address which was live at or after a
+ * generation in a subtree, keeping the earliest freed in a given best match
+ */
+static void searchNode(alloc_node_t *node, uint64_t addr, uint64_t since,
+                       alloc_node_t **best);
+
+/*
+ * Finds the live allocation starting at an address, or NULL if there is none,
+ * while holding the lock
+ */
+static alloc_node_t *findLive(uint64_t start);
+
+/*
+ * Inserts a node into a subtree, returning its new root
+ */
+static alloc_node_t *insertNode(alloc_node_t *subtree, alloc_node_t *node);
+
+/*
+ * Removes a node from a subtree, returning its new root
+ */
+static alloc_node_t *removeNode(alloc_node_t *subtree, alloc_node_t *node);
+
+/*
+ * Joins two subtrees, where every node of the first is before every node of
+ * the second, returning the new root
+ */
+static alloc_node_t *joinNodes(alloc_node_t *first, alloc_node_t *second);
+
+/*
+ * Rotates the left child of a node above it, returning the new root
+ */
+static alloc_node_t *rotateRight(alloc_node_t *node);
+
+/*
+ * Rotates the right child of a node above it, returning the new root
+ */
+static alloc_node_t *rotateLeft(alloc_node_t *node);
+
+/*
+ * Recomputes the furthest end of a node's subtree from its children
+ */
+static void updateNode(alloc_node_t *node);
+
+/*
+ * Returns whether a node comes before another in the treap
+ */
+static int nodeBefore(alloc_node_t *node, alloc_node_t *other);
+
+/*
+ * Frees a subtree
+ */
+static void freeNodes(alloc_node_t *node);
+
+/*
+ * Adds an allocation to the index, replacing any live one starting at the
+ * same address
+ */
+static void insertAllocation(allocation_t alloc);
+
+/*
+ * Marks the live allocation starting at an address as freed, if any
+ */
+static void removeAllocation(uint64_t start);
+
+/*
+ * Drops the freed allocations which no thread's buffered entries can access,
+ * while holding the lock
+ */
+static void pruneFreed();
+
+void allocationsInit(flush_entries_t flush) {
+    flushEntries = flush;
+    drwrap_init();
+    allocsLock = dr_rwlock_create();
+    generation = 0;
+    nextPriority = 2463534242;
+}
+
+void allocationsExit() {
+    dr_rwlock_destroy(allocsLock);
+    freeNodes(root);
+
+    root = NULL;
+    firstFreed = NULL;
+    lastFreed = NULL;
+    windows = NULL;
+    drwrap_exit();
+}
+
+void openAllocationWindow(allocation_window_t *window, void **cursor,
+                          void *empty) {
+
+    window->cursor = cursor;
+    window->empty = empty;
+
+    dr_rwlock_write_lock(allocsLock);
+    window->since = generation;
+    window->prev = NULL;
+    window->next = windows;
+    if (windows != NULL) {
+        windows->prev = window;
+    }
+    windows = window;
+    dr_rwlock_write_unlock(allocsLock);
+}
+
+void moveAllocationWindow(allocation_window_t *window) {
+    // Pruning reads the window under the write lock
+    dr_rwlock_read_lock(allocsLock);
+    window->since = generation;
+    dr_rwlock_read_unlock(allocsLock);
+}
+
+void closeAllocationWindow(allocation_window_t *window) {
+    dr_rwlock_write_lock(allocsLock);
+    if (window->prev != NULL) {
+        window->prev->next = window->next;
+    } else {
+        windows = window->next;
+    }
+    if (window->next != NULL) {
+        window->next->prev = window->prev;
+    }
+    dr_rwlock_write_unlock(allocsLock);
+}
+
+void wrapAllocators(const module_data_t *module) {
+    for (int i = 0; i < NUM_ALLOCATORS; i++) {
+        app_pc func = (app_pc)dr_get_proc_address(module->handle,
+                                                  allocators[i].name);
+        if (func == NULL) {
+            continue;
+        }
+
+        switch (allocators[i].kind) {
+            case allocMalloc:
+                drwrap_wrap(func, preMalloc, postAlloc);
+                break;
+
+            case allocCalloc:
+                drwrap_wrap(func, preCalloc, postAlloc);
+                break;
+
+            case allocRealloc:
+                drwrap_wrap(func, preRealloc, postAlloc);
+                break;
+
+            case allocFree:
+                drwrap_wrap(func, preFree, NULL);
+                break;
+        }
+    }
+}
+
+int findAllocation(uint64_t addr, uint64_t since, allocation_t *alloc) {
+    dr_rwlock_read_lock(allocsLock);
+
+    alloc_node_t *best = NULL;
+    searchNode(root, addr, since, &best);
+    if (best != NULL) {
+        *alloc = best->alloc;
+    }
+
+    dr_rwlock_read_unlock(allocsLock);
+    return best != NULL;
+}
+
+static void preMalloc(void *wrapcxt, void **userData) {
+    uint64_t size = (uint64_t)drwrap_get_arg(wrapcxt, 0);
+    *userData = createPending(wrapcxt, size);
+}
+
+static void preCalloc(void *wrapcxt, void **userData) {
+    uint64_t size = (uint64_t)drwrap_get_arg(wrapcxt, 0) *
+                    (uint64_t)drwrap_get_arg(wrapcxt, 1);
+    *userData = createPending(wrapcxt, size);
+}
+
+static void preRealloc(void *wrapcxt, void **userData) {
+    uint64_t size = (uint64_t)drwrap_get_arg(wrapcxt, 1);
+    pending_alloc_t *pending = createPending(wrapcxt, size);
+    pending->oldPtr = drwrap_get_arg(wrapcxt, 0);
+    *userData = pending;
+
+    // The old block may be freed and handed out again by the call
+    if (pending->oldPtr != NULL) {
+        flushEntries(drwrap_get_drcontext(wrapcxt));
+    }
+}
+
+static void postAlloc(void *wrapcxt, void *userData) {
+    pending_alloc_t *pending = userData;
+    void *ptr = drwrap_get_retval(wrapcxt);
+
+    // A failed reallocation leaves the old block live
+    if (pending->oldPtr != NULL && (ptr != NULL || pending->size == 0)) {
+        removeAllocation((uint64_t)pending->oldPtr);
+    }
+
+    if (ptr != NULL) {
+        allocation_t alloc;
+        alloc.start = (uint64_t)ptr;
+        alloc.size = pending->size != 0 ? pending->size : 1;
+        alloc.site = pending->site;
+        insertAllocation(alloc);
+    }
+
+    dr_thread_free(drwrap_get_drcontext(wrapcxt), pending,
+                   sizeof(pending_alloc_t));
+}
+
+static void preFree(void *wrapcxt, void **userData) {
+    void *ptr = drwrap_get_arg(wrapcxt, 0);
+    if (ptr != NULL) {
+        // Malloc often hands a freed block straight back, so buffered
+        // accesses to it would otherwise be given the next allocation
+        flushEntries(drwrap_get_drcontext(wrapcxt));
+        removeAllocation((uint64_t)ptr);
+    }
+}
+
+static pending_alloc_t *createPending(void *wrapcxt, uint64_t size) {
+    pending_alloc_t *pending = dr_thread_alloc(drwrap_get_drcontext(wrapcxt),
+                                               sizeof(pending_alloc_t));
+    pending->size = size;
+    pending->site = (uint64_t)drwrap_get_retaddr(wrapcxt);
+    pending->oldPtr = NULL;
+    return pending;
+}
+
+static void searchNode(alloc_node_t *node, uint64_t addr, uint64_t since,
+                       alloc_node_t **best) {
+
+    // No allocation in a subtree ending at or before the address contains it
+    if (node == NULL || node->maxEnd <= addr) {
+        return;
+    }
+
+    searchNode(node->left, addr, since, best);
+
+    if (node->alloc.start > addr) {
+        return;
+    }
+
+    // A live allocation has a free generation of 0, so is taken as freed last
+    if (addr - node->alloc.start < node->alloc.size &&
+        (node->freeGen == 0 || node->freeGen > since) &&
+        (*best == NULL || node->freeGen - 1 < (*best)->freeGen - 1)) {
+
+        *best = node;
+    }
+
+    searchNode(node->right, addr, since, best);
+}
+
+static alloc_node_t *findLive(uint64_t start) {
+    alloc_node_t *node = NULL;
+    searchNode(root, start, UINT64_MAX, &node);
+    return node != NULL && node->alloc.start == start ? node : NULL;
+}
+
+static alloc_node_t *insertNode(alloc_node_t *subtree, alloc_node_t *node) {
+    if (subtree == NULL) {
+        return node;
+    }
+
+    if (nodeBefore(node, subtree)) {
+        subtree->left = insertNode(subtree->left, node);
+        if (subtree->left->priority > subtree->priority) {
+            subtree = rotateRight(subtree);
+        }
+    } else {
+        subtree->right = insertNode(subtree->right, node);
+        if (subtree->right->priority > subtree->priority) {
+            subtree = rotateLeft(subtree);
+        }
+    }
+
+    updateNode(subtree);
+    return subtree;
+}
+
+static alloc_node_t *removeNode(alloc_node_t *subtree, alloc_node_t *node) {
+    if (subtree == node) {
+        return joinNodes(node->left, node->right);
+    }
+
+    if (nodeBefore(node, subtree)) {
+        subtree->left = removeNode(subtree->left, node);
+    } else {
+        subtree->right = removeNode(subtree->right, node);
+    }
+
+    updateNode(subtree);
+    return subtree;
+}
+
+static alloc_node_t *joinNodes(alloc_node_t *first, alloc_node_t *second) {
+    if (first == NULL) {
+        return second;
+    } else if (second == NULL) {
+        return first;
+    }
+
+    if (first->priority > second->priority) {
+        first->right = joinNodes(first->right, second);
+        updateNode(first);
+        return first;
+    }
+
+    second->left = joinNodes(first, second->left);
+    updateNode(second);
+    return second;
+}
+
+static alloc_node_t *rotateRight(alloc_node_t *node) {
+    alloc_node_t *left = node->left;
+    node->left = left->right;
+    left->right = node;
+
+    updateNode(node);
+    updateNode(left);
+    return left;
+}
+
+static alloc_node_t *rotateLeft(alloc_node_t *node) {
+    alloc_node_t *right = node->right;
+    node->right = right->left;
+    right->left = node;
+
+    updateNode(node);
+    updateNode(right);
+    return right;
+}
+
+static void updateNode(alloc_node_t *node) {
+    node->maxEnd = node->alloc.start + node->alloc.size;
+    if (node->left != NULL && node->left->maxEnd > node->maxEnd) {
+        node->maxEnd = node->left->maxEnd;
+    }
+    if (node->right != NULL && node->right->maxEnd > node->maxEnd) {
+        node->maxEnd = node->right->maxEnd;
+    }
+}
+
+static int nodeBefore(alloc_node_t *node, alloc_node_t *other) {
+    if (node->alloc.start != other->alloc.start) {
+        return node->alloc.start < other->alloc.start;
+    }
+
+    return node->allocGen < other->allocGen;
+}
+
+static void freeNodes(alloc_node_t *node) {
+    if (node == NULL) {
+        return;
+    }
+
+    freeNodes(node->left);
+    freeNodes(node->right);
+    dr_global_free(node, sizeof(alloc_node_t));
+}
+
+static void insertAllocation(allocation_t alloc) {
+    dr_rwlock_write_lock(allocsLock);
+
+    // Operator new calling malloc gives the same block twice, and the outer
+    // call, finishing last, gives the more useful site
+    alloc_node_t *node = findLive(alloc.start);
+    if (node != NULL) {
+        root = removeNode(root, node);
+    } else {
+        node = dr_global_alloc(sizeof(alloc_node_t));
+        node->allocGen = generation;
+        node->freeGen = 0;
+    }
+
+    // Priorities come from a xorshift generator, so the treap stays balanced
+    // whatever order blocks are handed out in
+    nextPriority ^= nextPriority << 13;
+    nextPriority ^= nextPriority >> 17;
+    nextPriority ^= nextPriority << 5;
+
+    node->alloc = alloc;
+    node->priority = nextPriority;
+    node->left = NULL;
+    node->right = NULL;
+    node->nextFreed = NULL;
+    updateNode(node);
+    root = insertNode(root, node);
+
+    dr_rwlock_write_unlock(allocsLock);
+}
+
+static void removeAllocation(uint64_t start) {
+    dr_rwlock_write_lock(allocsLock);
+
+    // Freed allocations stay in the treap for entries buffered before the free
+    alloc_node_t *node = findLive(start);
+    if (node != NULL) {
+        node->freeGen = ++generation;
+        if (lastFreed != NULL) {
+            lastFreed->nextFreed = node;
+        } else {
+            firstFreed = node;
+        }
+        lastFreed = node;
+    }
+
+    pruneFreed();
+    dr_rwlock_write_unlock(allocsLock);
+}
+
+static void pruneFreed() {
+    // Threads with empty buffers have no entries left to look up
+    uint64_t oldest = UINT64_MAX;
+    for (allocation_window_t *window = windows; window != NULL;
+         window = window->next) {
+
+        if (*window->cursor != window->empty && window->since < oldest) {
+            oldest = window->since;
+        }
+    }
+
+    while (firstFreed != NULL && firstFreed->freeGen <= oldest) {
+        alloc_node_t *node = firstFreed;
+        firstFreed = node->nextFreed;
+        if (firstFreed == NULL) {
+            lastFreed = NULL;
+        }
+
+        root = removeNode(root, node);
+        dr_global_free(node, sizeof(alloc_node_t));
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include <inttypes.h>
+
+#include "dr_api.h"
+
+typedef struct {
+    uint64_t start, size;
+    uint64_t site;
+} allocation_t;
+
+/*
+ * The generation at which a thread's buffer of entries was last emptied, with
+ * the thread's buffer cursor, which is at its empty position when the thread
+ * has nothing buffered
+ */
+typedef struct allocation_window {
+    uint64_t since;
+    void **cursor;
+    void *empty;
+    struct allocation_window *prev, *next;
+} allocation_window_t;
+
+/*
+ * Callback writing out the entries buffered by a thread
+ */
+typedef void (*flush_entries_t)(void *drcontext);
+
+/*
+ * Starts tracking heap allocations, flushing a thread's buffered entries
+ * before it frees or reallocates a block so that they are looked up before the
+ * block can be handed out again
+ */
+void allocationsInit(flush_entries_t flush);
+
+/*
+ * Stops tracking heap allocations, freeing the index of them
+ */
+void allocationsExit();
+
+/*
+ * Wraps the allocation and deallocation functions exported by a module
+ */
+void wrapAllocators(const module_data_t *module);
+
+/*
+ * Starts keeping the allocations freed while a thread's buffer holds entries,
+ * given where its buffer cursor is kept and its value for an empty buffer
+ */
+void openAllocationWindow(allocation_window_t *window, void **cursor,
+                          void *empty);
+
+/*
+ * Moves a thread's window to the current generation once its buffer is
+ * written out
+ */
+void moveAllocationWindow(allocation_window_t *window);
+
+/*
+ * Stops keeping allocations for a thread
+ */
+void closeAllocationWindow(allocation_window_t *window);
+
+/*
+ * Finds the allocation containing an address which was live at or after the
+ * given generation, preferring the one freed first, with UINT64_MAX finding
+ * only live allocations, returning whether there is one
+ */
+int findAllocation(uint64_t addr, uint64_t since, allocation_t *alloc);
+
+#endif
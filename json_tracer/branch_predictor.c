@@ -0,0 +1,388 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dr_api.h"
+#include "drsyms.h"
+#include "drx.h"
+
+#include "branch_predictor.h"
+#include "options.h"
+
+#define TAG_BITS 8
+#define COUNTER_MAX 3
+#define COUNTER_MIN -4
+#define USEFUL_MAX 3
+
+static const int historyLengths[NUM_TAGGED_TABLES] = {5, 11, 22, 44};
+
+static void *predictorsMutex;
+static branch_stats_t *totalStats;
+static int sizeTotal, capacityTotal;
+
+/*
+ * Returns the predicted direction of a branch, updating the predictor with
+ * its actual direction
+ */
+static int predictAndUpdate(branch_predictor_t *pred, uint64_t pc, int taken);
+
+/*
+ * Predicts and updates a table of 2-bit counters at a given index
+ */
+static int predictCounter(uint8_t *counter, int taken);
+
+/*
+ * Predicts and updates the TAGE-like predictor, where the tagged table with
+ * the longest matching history provides the prediction
+ */
+static int predictTage(branch_predictor_t *pred, uint64_t pc, int taken);
+
+/*
+ * Returns the index of a branch into a table with a given history length
+ */
+static uint64_t tableIndex(uint64_t pc, uint64_t history, int length);
+
+/*
+ * Returns the tag of a branch for a table with a given history length
+ */
+static uint16_t tableTag(uint64_t pc, uint64_t history, int length);
+
+/*
+ * Folds the most recent given number of bits of history down to a width
+ */
+static uint64_t foldHistory(uint64_t history, int length, int width);
+
+/*
+ * Returns the counts for a branch in an open-addressed table, adding them if
+ * not present
+ */
+static branch_stats_t *findStats(branch_stats_t **stats, int *size,
+                                 int *capacity, uint64_t pc);
+
+/*
+ * Writes the counts of a branch as a JSON object
+ */
+static void writeBranch(file_t file, branch_stats_t *stats);
+
+/*
+ * Orders branches by most mispredictions first
+ */
+static int compareMispredicted(const void *a, const void *b);
+
+void predictorsInit() {
+    predictorsMutex = dr_mutex_create();
+}
+
+void predictorsExit() {
+    char path[MAXIMUM_PATH];
+    file_t file = drx_open_unique_file("./", "branches", "json", 0, path,
+                                       MAXIMUM_PATH);
+
+    dr_mutex_lock(predictorsMutex);
+
+    // Compact the table so it can be sorted
+    int numBranches = 0;
+    branch_stats_t total = {0, 0, 0, 0};
+    for (int i = 0; i < capacityTotal; i++) {
+        if (totalStats[i].pc != 0) {
+            total.executed += totalStats[i].executed;
+            total.taken += totalStats[i].taken;
+            total.mispredicted += totalStats[i].mispredicted;
+            totalStats[numBranches++] = totalStats[i];
+        }
+    }
+    qsort(totalStats, numBranches, sizeof(branch_stats_t),
+          compareMispredicted);
+
+    if (file != INVALID_FILE) {
+        const char *names[] = {"bimodal", "gshare", "tage"};
+        dr_fprintf(file, "{\"predictor\": \"%s\", \"bits\": %d, "
+                         "\"branches\": [",
+                   names[options.predictor], options.predictorBits);
+
+        for (int i = 0; i < numBranches; i++) {
+            if (i != 0) {
+                dr_fprintf(file, ", ");
+            }
+            writeBranch(file, &totalStats[i]);
+        }
+
+        dr_fprintf(file, "], \"total\": {\"executed\": %lu, \"taken\": %lu, "
+                         "\"mispredicted\": %lu}}\n",
+                   total.executed, total.taken, total.mispredicted);
+        dr_close_file(file);
+    }
+
+    dr_mutex_unlock(predictorsMutex);
+
+    if (totalStats != NULL) {
+        dr_global_free(totalStats, capacityTotal * sizeof(branch_stats_t));
+    }
+    dr_mutex_destroy(predictorsMutex);
+}
+
+void createPredictor(branch_predictor_t *pred) {
+    size_t entries = (size_t)1 << options.predictorBits;
+
+    pred->history = 0;
+    pred->counters = dr_global_alloc(entries);
+    memset(pred->counters, 1, entries);
+
+    pred->tagged = NULL;
+    if (options.predictor == predictorTage) {
+        size_t size = NUM_TAGGED_TABLES * entries * sizeof(tagged_entry_t);
+        pred->tagged = dr_global_alloc(size);
+        memset(pred->tagged, 0, size);
+    }
+
+    pred->stats = NULL;
+    pred->sizeStats = 0;
+    pred->capacityStats = 0;
+}
+
+void destroyPredictor(branch_predictor_t *pred) {
+    size_t entries = (size_t)1 << options.predictorBits;
+
+    dr_mutex_lock(predictorsMutex);
+    for (int i = 0; i < pred->capacityStats; i++) {
+        branch_stats_t *stats = &pred->stats[i];
+        if (stats->pc == 0) {
+            continue;
+        }
+
+        branch_stats_t *total = findStats(&totalStats, &sizeTotal,
+                                          &capacityTotal, stats->pc);
+        total->executed += stats->executed;
+        total->taken += stats->taken;
+        total->mispredicted += stats->mispredicted;
+    }
+    dr_mutex_unlock(predictorsMutex);
+
+    if (pred->stats != NULL) {
+        dr_global_free(pred->stats,
+                       pred->capacityStats * sizeof(branch_stats_t));
+    }
+    if (pred->tagged != NULL) {
+        dr_global_free(pred->tagged,
+                       NUM_TAGGED_TABLES * entries * sizeof(tagged_entry_t));
+    }
+    dr_global_free(pred->counters, entries);
+}
+
+void predictBranch(branch_predictor_t *pred, uint64_t pc, int taken) {
+    branch_stats_t *stats = findStats(&pred->stats, &pred->sizeStats,
+                                      &pred->capacityStats, pc);
+    stats->executed++;
+    stats->taken += taken != 0;
+
+    if (predictAndUpdate(pred, pc, taken) != taken) {
+        stats->mispredicted++;
+    }
+
+    pred->history = pred->history << 1 | (taken != 0);
+}
+
+static int predictAndUpdate(branch_predictor_t *pred, uint64_t pc, int taken) {
+    uint64_t mask = ((uint64_t)1 << options.predictorBits) - 1;
+
+    switch (options.predictor) {
+        case predictorBimodal:
+            return predictCounter(&pred->counters[(pc ^ pc >> 16) & mask],
+                                  taken);
+
+        case predictorGshare:
+            return predictCounter(&pred->counters[(pc ^ pred->history) & mask],
+                                  taken);
+
+        case predictorTage:
+            return predictTage(pred, pc, taken);
+    }
+
+    return 0;
+}
+
+static int predictCounter(uint8_t *counter, int taken) {
+    int prediction = *counter >= 2;
+
+    if (taken && *counter < 3) {
+        (*counter)++;
+    } else if (!taken && *counter > 0) {
+        (*counter)--;
+    }
+
+    return prediction;
+}
+
+static int predictTage(branch_predictor_t *pred, uint64_t pc, int taken) {
+    size_t entries = (size_t)1 << options.predictorBits;
+    uint64_t mask = entries - 1;
+
+    tagged_entry_t *matches[NUM_TAGGED_TABLES];
+    int provider = -1, alternate = -1;
+    for (int i = 0; i < NUM_TAGGED_TABLES; i++) {
+        uint64_t index = tableIndex(pc, pred->history, historyLengths[i]);
+        matches[i] = &pred->tagged[i * entries + (index & mask)];
+
+        if (matches[i]->tag == tableTag(pc, pred->history,
+                                        historyLengths[i])) {
+            alternate = provider;
+            provider = i;
+        }
+    }
+
+    uint8_t *base = &pred->counters[(pc ^ pc >> 16) & mask];
+    int basePrediction = *base >= 2;
+    int alternatePrediction = alternate == -1 ?
+                              basePrediction :
+                              matches[alternate]->counter >= 0;
+
+    int prediction;
+    if (provider == -1) {
+        prediction = predictCounter(base, taken);
+    } else {
+        tagged_entry_t *entry = matches[provider];
+        prediction = entry->counter >= 0;
+
+        if (taken && entry->counter < COUNTER_MAX) {
+            entry->counter++;
+        } else if (!taken && entry->counter > COUNTER_MIN) {
+            entry->counter--;
+        }
+
+        if (prediction != alternatePrediction) {
+            if (prediction == taken && entry->useful < USEFUL_MAX) {
+                entry->useful++;
+            } else if (prediction != taken && entry->useful > 0) {
+                entry->useful--;
+            }
+        }
+    }
+
+    // A misprediction claims an entry in a table with longer history, or ages
+    // the entries there if none is free
+    if (prediction != taken && provider < NUM_TAGGED_TABLES - 1) {
+        int allocated = 0;
+        for (int i = provider + 1; i < NUM_TAGGED_TABLES; i++) {
+            if (matches[i]->useful == 0) {
+                matches[i]->tag = tableTag(pc, pred->history,
+                                           historyLengths[i]);
+                matches[i]->counter = taken ? 0 : -1;
+                allocated = 1;
+                break;
+            }
+        }
+
+        if (!allocated) {
+            for (int i = provider + 1; i < NUM_TAGGED_TABLES; i++) {
+                matches[i]->useful--;
+            }
+        }
+    }
+
+    return prediction;
+}
+
+static uint64_t tableIndex(uint64_t pc, uint64_t history, int length) {
+    int bits = options.predictorBits;
+    return pc ^ pc >> bits ^ foldHistory(history, length, bits);
+}
+
+static uint16_t tableTag(uint64_t pc, uint64_t history, int length) {
+    // A tag of zero marks an unused entry
+    uint16_t tag = (pc ^ foldHistory(history, length, TAG_BITS) ^
+                    foldHistory(history, length, TAG_BITS - 1) << 1) &
+                   ((1 << TAG_BITS) - 1);
+    return tag != 0 ? tag : 1;
+}
+
+static uint64_t foldHistory(uint64_t history, int length, int width) {
+    uint64_t folded = 0;
+    history &= ((uint64_t)1 << length) - 1;
+
+    while (history != 0) {
+        folded ^= history & (((uint64_t)1 << width) - 1);
+        history >>= width;
+    }
+
+    return folded;
+}
+
+static branch_stats_t *findStats(branch_stats_t **stats, int *size,
+                                 int *capacity, uint64_t pc) {
+
+    // Grow at half full to keep probe sequences short
+    if (2 * (*size + 1) > *capacity) {
+        int newCapacity = *capacity == 0 ? 256 : 2 * *capacity;
+        branch_stats_t *newStats = dr_global_alloc(newCapacity *
+                                                   sizeof(branch_stats_t));
+        memset(newStats, 0, newCapacity * sizeof(branch_stats_t));
+
+        for (int i = 0; i < *capacity; i++) {
+            if ((*stats)[i].pc == 0) {
+                continue;
+            }
+
+            int j = (*stats)[i].pc % newCapacity;
+            while (newStats[j].pc != 0) {
+                j = (j + 1) % newCapacity;
+            }
+            newStats[j] = (*stats)[i];
+        }
+
+        if (*stats != NULL) {
+            dr_global_free(*stats, *capacity * sizeof(branch_stats_t));
+        }
+
+        *stats = newStats;
+        *capacity = newCapacity;
+    }
+
+    int i = pc % *capacity;
+    while ((*stats)[i].pc != 0 && (*stats)[i].pc != pc) {
+        i = (i + 1) % *capacity;
+    }
+
+    if ((*stats)[i].pc == 0) {
+        (*stats)[i].pc = pc;
+        (*size)++;
+    }
+
+    return &(*stats)[i];
+}
+
+static void writeBranch(file_t file, branch_stats_t *stats) {
+    dr_fprintf(file, "{\"pc\": \"0x%lx\", ", stats->pc);
+
+    module_data_t *module = dr_lookup_module((byte *)stats->pc);
+    if (module != NULL) {
+        drsym_info_t info;
+        char file_name[512];
+        info.struct_size = sizeof(info);
+        info.name = NULL;
+        info.name_size = 0;
+        info.file = file_name;
+        info.file_size = sizeof(file_name);
+
+        if (drsym_lookup_address(module->full_path,
+                                 stats->pc - (uint64_t)module->start, &info,
+                                 DRSYM_DEFAULT_FLAGS) == DRSYM_SUCCESS &&
+            file_name[0] == '/') {
+            dr_fprintf(file, "\"file\": \"%s\", \"line\": %lu, ", file_name,
+                       info.line);
+        }
+
+        dr_free_module_data(module);
+    }
+
+    dr_fprintf(file, "\"executed\": %lu, \"taken\": %lu, "
+                     "\"mispredicted\": %lu}",
+               stats->executed, stats->taken, stats->mispredicted);
+}
+
+static int compareMispredicted(const void *a, const void *b) {
+    const branch_stats_t *statsA = a, *statsB = b;
+    if (statsA->mispredicted != statsB->mispredicted) {
+        return statsA->mispredicted < statsB->mispredicted ? 1 : -1;
+    }
+
+    return statsA->pc < statsB->pc ? -1 : statsA->pc > statsB->pc;
+}
@@ -0,0 +1,58 @@
+#ifndef BRANCH_PREDICTOR_H
+#define BRANCH_PREDICTOR_H
+
+#include <inttypes.h>
+
+#include "dr_api.h"
+
+#define NUM_TAGGED_TABLES 4
+
+typedef struct {
+    uint64_t pc;
+    uint64_t executed, taken, mispredicted;
+} branch_stats_t;
+
+typedef struct {
+    uint16_t tag;
+    int8_t counter;
+    uint8_t useful;
+} tagged_entry_t;
+
+typedef struct {
+    uint64_t history;
+    uint8_t *counters;
+    tagged_entry_t *tagged;
+
+    branch_stats_t *stats;
+    int sizeStats, capacityStats;
+} branch_predictor_t;
+
+/*
+ * Starts collecting the outcomes of conditional branches of all threads
+ */
+void predictorsInit();
+
+/*
+ * Writes the per-branch outcomes and misprediction estimates of all threads
+ * to a unique file
+ */
+void predictorsExit();
+
+/*
+ * Creates the state of the simulated predictor for a thread
+ */
+void createPredictor(branch_predictor_t *pred);
+
+/*
+ * Adds the outcomes seen by a thread to those of all threads, freeing its
+ * predictor
+ */
+void destroyPredictor(branch_predictor_t *pred);
+
+/*
+ * Predicts a conditional branch, counting its outcome and whether it was
+ * mispredicted, then updates the predictor with the outcome
+ */
+void predictBranch(branch_predictor_t *pred, uint64_t pc, int taken);
+
+#endif
@@ -1,4 +1,5 @@
 #include "debug_info.h"
+#include "debug_info_cache.h"
 
 #include <dwarf.h>
 #include <libdwarf.h>
@@ -15,6 +16,11 @@ typedef struct {
     Dwarf_Debug dbg;
 } dwarf_session_t;
 
+typedef struct {
+    line_entry_t line;
+    int row;
+} indexed_line_t;
+
 typedef enum {
     func, var, type, error
 } entry_type_t;
@@ -62,6 +68,40 @@ static int addCU(dwarf_session_t ses, Dwarf_Die die, debug_info_t *info);
  */
 static char *getCUFilePath(dwarf_session_t ses, Dwarf_Die die);
 
+/*
+ * Adds the rows of the line table of a CU, returning 0 on success
+ */
+static int addLines(dwarf_session_t ses, Dwarf_Die die, debug_info_t *info);
+
+/*
+ * Returns the index of a file path in the table of files, adding it if not
+ * present, or -1 on error
+ */
+static int internFile(const char *path, debug_info_t *info);
+
+/*
+ * Appends a line table row to the stored debug information
+ */
+static int appendLineEntry(line_entry_t line, debug_info_t *info);
+
+/*
+ * Sorts the line table rows by address, keeping rows at the same address in
+ * the order they were appended, returning 0 on success
+ */
+static int sortLines(debug_info_t *info);
+
+/*
+ * Orders indexed line table rows by address, with those ending a sequence
+ * before any starting another at the same address and then by row
+ */
+static int compareLines(const void *a, const void *b);
+
+/*
+ * Orders functions by their lowest PC and then by length, so the longest of
+ * those starting at the same PC is the last
+ */
+static int compareFuncs(const void *a, const void *b);
+
 /*
  * Adds an entry from a DIE to the stored debugging information,
  * returning 0 on success
@@ -191,18 +231,33 @@ static int getOffsetCU(Dwarf_Die die, Dwarf_Off *offset);
 static int getAttributeAddr(Dwarf_Attribute attr, void **addr);
 
 debug_info_t *getDebugInfo(const char *file) {
+    // A file already parsed by an earlier run is mapped from the cache
+    debug_info_t *info = loadCachedDebugInfo(file);
+    if (info != NULL) {
+        return info;
+    }
+
     dwarf_session_t ses;
     if (createDwarfSession(file, &ses)) {
         return NULL;
     }
 
-    debug_info_t *info = dwarfToDebugInfo(ses);
+    info = dwarfToDebugInfo(ses);
 
     destroyDwarfSession(ses);
+
+    if (info != NULL) {
+        cacheDebugInfo(file, info);
+    }
     return info;
 }
 
 void destroyDebugInfo(debug_info_t *info) {
+    if (info->map != NULL) {
+        unmapDebugInfo(info);
+        return;
+    }
+
     for (int i = 0; i < info->sizeFuncs; i++) {
         free(info->funcs[i].name);
 
@@ -225,6 +280,12 @@ void destroyDebugInfo(debug_info_t *info) {
     }
     free(info->types);
 
+    for (int i = 0; i < info->sizeFiles; i++) {
+        free(info->files[i]);
+    }
+    free(info->files);
+    free(info->lines);
+
     free(info);
 }
 
@@ -277,10 +338,12 @@ static int populateDebugInfo(dwarf_session_t ses, debug_info_t *info) {
     while (1) {
         Dwarf_Die die = 0;
         if (getNextCURootDie(ses, &die)) {
-            return 0;
+            qsort(info->funcs, info->sizeFuncs, sizeof(function_info_t),
+                  compareFuncs);
+            return sortLines(info);
         }
 
-        int res = addCU(ses, die, info);
+        int res = addCU(ses, die, info) || addLines(ses, die, info);
         dwarf_dealloc_die(die);
         if (res) {
             return 1;
@@ -292,9 +355,13 @@ static int allocate(debug_info_t *info) {
     info->funcs = malloc(sizeof(function_info_t) * MIN_CAPACITY);
     info->vars = malloc(sizeof(static_variable_t) * MIN_CAPACITY);
     info->types = malloc(sizeof(type_t) * MIN_CAPACITY);
+    info->lines = malloc(sizeof(line_entry_t) * MIN_CAPACITY);
+    info->files = malloc(sizeof(char *) * MIN_CAPACITY);
 
     if (info->funcs == NULL || info->vars == NULL
-                                 || info->types == NULL) {
+                                 || info->types == NULL
+                                 || info->lines == NULL
+                                 || info->files == NULL) {
 
         return 1;
     }
@@ -302,10 +369,17 @@ static int allocate(debug_info_t *info) {
     info->sizeFuncs = 0;
     info->sizeVars = 0;
     info->sizeTypes = 0;
+    info->sizeLines = 0;
+    info->sizeFiles = 0;
 
     info->capacityFuncs = MIN_CAPACITY;
     info->capacityVars = MIN_CAPACITY;
     info->capacityTypes = MIN_CAPACITY;
+    info->capacityLines = MIN_CAPACITY;
+    info->capacityFiles = MIN_CAPACITY;
+
+    info->map = NULL;
+    info->mapSize = 0;
 
     return 0;
 }
@@ -406,6 +480,168 @@ static char *getCUFilePath(dwarf_session_t ses, Dwarf_Die die) {
     return fullPath;
 }
 
+static int addLines(dwarf_session_t ses, Dwarf_Die die, debug_info_t *info) {
+    Dwarf_Unsigned version;
+    Dwarf_Small tableCount;
+    Dwarf_Line_Context context;
+    Dwarf_Error err;
+
+    int res = dwarf_srclines_b(die, &version, &tableCount, &context, &err);
+    if (res == DW_DLV_ERROR) {
+        dwarf_dealloc_error(ses.dbg, err);
+    }
+    if (res != DW_DLV_OK) {
+        // A CU without a line table is not an error
+        return 0;
+    }
+
+    Dwarf_Line *rows;
+    Dwarf_Signed numRows;
+    if (dwarf_srclines_from_linecontext(context, &rows, &numRows,
+                                        &err) != DW_DLV_OK) {
+        dwarf_srclines_dealloc_b(context);
+        return 0;
+    }
+
+    int failed = 0;
+    for (Dwarf_Signed i = 0; i < numRows && !failed; i++) {
+        Dwarf_Addr addr;
+        Dwarf_Unsigned lineNo;
+        Dwarf_Bool endSequence;
+        if (dwarf_lineaddr(rows[i], &addr, &err) != DW_DLV_OK ||
+            dwarf_lineno(rows[i], &lineNo, &err) != DW_DLV_OK ||
+            dwarf_lineendsequence(rows[i], &endSequence, &err) != DW_DLV_OK) {
+            continue;
+        }
+
+        line_entry_t line;
+        line.addr = (void *)addr;
+        line.line = (uint32_t)lineNo;
+        line.file = LINE_FILE_NONE;
+
+        if (!endSequence) {
+            char *path;
+            if (dwarf_linesrc(rows[i], &path, &err) != DW_DLV_OK) {
+                continue;
+            }
+
+            int file = internFile(path, info);
+            dwarf_dealloc(ses.dbg, path, DW_DLA_STRING);
+            if (file < 0) {
+                failed = 1;
+                break;
+            }
+            line.file = (uint32_t)file;
+        }
+
+        failed = appendLineEntry(line, info);
+    }
+
+    dwarf_srclines_dealloc_b(context);
+    return failed;
+}
+
+static int internFile(const char *path, debug_info_t *info) {
+    // Rows of a CU mostly share one file, so search from the latest
+    for (int i = info->sizeFiles - 1; i >= 0; i--) {
+        if (strcmp(info->files[i], path) == 0) {
+            return i;
+        }
+    }
+
+    if (info->sizeFiles == info->capacityFiles) {
+        info->capacityFiles *= 2;
+        char **files = reallocarray(info->files, info->capacityFiles,
+                                    sizeof(char *));
+
+        if (files == NULL) {
+            return -1;
+        }
+
+        info->files = files;
+    }
+
+    char *copy = malloc(strlen(path) + 1);
+    if (copy == NULL) {
+        return -1;
+    }
+    strcpy(copy, path);
+
+    info->files[info->sizeFiles] = copy;
+    return info->sizeFiles++;
+}
+
+static int appendLineEntry(line_entry_t line, debug_info_t *info) {
+    if (info->sizeLines == info->capacityLines) {
+        info->capacityLines *= 2;
+        line_entry_t *lines = reallocarray(info->lines, info->capacityLines,
+                                           sizeof(line_entry_t));
+
+        if (lines == NULL) {
+            return 1;
+        }
+
+        info->lines = lines;
+    }
+
+    info->lines[info->sizeLines++] = line;
+    return 0;
+}
+
+static int sortLines(debug_info_t *info) {
+    if (info->sizeLines == 0) {
+        return 0;
+    }
+
+    // qsort is not stable, and the last row at an address is the one found
+    // for it, so rows are sorted along with where they were appended
+    indexed_line_t *rows = malloc(sizeof(indexed_line_t) * info->sizeLines);
+    if (rows == NULL) {
+        return 1;
+    }
+
+    for (int i = 0; i < info->sizeLines; i++) {
+        rows[i].line = info->lines[i];
+        rows[i].row = i;
+    }
+
+    qsort(rows, info->sizeLines, sizeof(indexed_line_t), compareLines);
+
+    for (int i = 0; i < info->sizeLines; i++) {
+        info->lines[i] = rows[i].line;
+    }
+
+    free(rows);
+    return 0;
+}
+
+static int compareLines(const void *a, const void *b) {
+    const indexed_line_t *rowA = a, *rowB = b;
+    const line_entry_t *lineA = &rowA->line, *lineB = &rowB->line;
+    if (lineA->addr != lineB->addr) {
+        return lineA->addr < lineB->addr ? -1 : 1;
+    }
+
+    if ((lineA->file == LINE_FILE_NONE) != (lineB->file == LINE_FILE_NONE)) {
+        return lineA->file == LINE_FILE_NONE ? -1 : 1;
+    }
+
+    return rowA->row < rowB->row ? -1 : rowA->row > rowB->row;
+}
+
+static int compareFuncs(const void *a, const void *b) {
+    const function_info_t *funcA = a, *funcB = b;
+    if (funcA->lowPC != funcB->lowPC) {
+        return funcA->lowPC < funcB->lowPC ? -1 : 1;
+    }
+
+    if (funcA->length != funcB->length) {
+        return funcA->length < funcB->length ? -1 : 1;
+    }
+
+    return 0;
+}
+
 static int addEntry(dwarf_session_t ses, Dwarf_Die die,
                      debug_info_t *info, char *path) {
 
@@ -514,8 +750,12 @@ static int getFuncEntry(dwarf_session_t ses, Dwarf_Die die,
     func->name = NULL;
     func->path = path;
 
-    return fillFuncNonVars(ses, die, func) ||
-           fillFuncVars(ses, die, func);
+    if (fillFuncNonVars(ses, die, func)) {
+        free(func->vars);
+        return 1;
+    }
+
+    return fillFuncVars(ses, die, func);
 }
 
 static int getVarEntry(dwarf_session_t ses, Dwarf_Die die,
@@ -792,7 +1032,8 @@ static int fillFuncNonVars(dwarf_session_t ses, Dwarf_Die die,
 
     func->name = NULL;
     func->lowPC = NULL;
-    int setLength = 0;
+    void *highAddr = NULL;
+    int setLength = 0, setHighAddr = 0;
     for (int i = 0; i < numAttrs; i++) {
         Dwarf_Half attr;
         if (dwarf_whatattr(attrs[i], &attr, &err) != DW_DLV_OK) {
@@ -811,14 +1052,13 @@ static int fillFuncNonVars(dwarf_session_t ses, Dwarf_Die die,
             if (getAttributeAddr(attrs[i], &func->lowPC)) {
                 func->lowPC = NULL;
             }
-        
+            break;
+
         case DW_AT_high_pc:
-            void *highAddr;
             if (getAttributeUnsigned(attrs[i], &func->length) == 0) {
                 setLength = 1;
             } else if (getAttributeAddr(attrs[i], &highAddr) == 0) {
-                func->length = func->lowPC - highAddr;
-                setLength = 1;
+                setHighAddr = 1;
             }
             break;
         }
@@ -828,9 +1068,17 @@ static int fillFuncNonVars(dwarf_session_t ses, Dwarf_Die die,
 
     dwarf_dealloc(ses.dbg, attrs, DW_DLA_LIST);
 
-    
-    return func->name == NULL || func->lowPC == NULL
-                              || !setLength;
+    // A high PC given as an address may come before the low PC
+    if (setHighAddr && func->lowPC != NULL && highAddr > func->lowPC) {
+        func->length = highAddr - func->lowPC;
+        setLength = 1;
+    }
+
+    // Linkers leave copies of discarded functions with a low PC of 0, or -1 or
+    // -2 from lld, which would otherwise shadow the functions kept
+    uintptr_t lowPC = (uintptr_t)func->lowPC;
+    return func->name == NULL || lowPC == 0 || lowPC >= UINTPTR_MAX - 1 ||
+           !setLength || func->length == 0;
 }
 
 static int fillFuncVars(dwarf_session_t ses, Dwarf_Die die,
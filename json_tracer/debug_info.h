@@ -1,6 +1,15 @@
 #ifndef DEBUG_INFO_H
 #define DEBUG_INFO_H
 
+#include <inttypes.h>
+
+#define VAR_ID_UNRESOLVED 0
+#define VAR_ID_NONE UINT64_MAX
+#define VAR_ID_LOCAL ((uint64_t)1 << 63)
+
+// Offset of the frame base from RBP once a function's prologue has run at -O0
+#define FRAME_BASE_OFFSET 0x10
+
 typedef struct {
     char *name, *path;
     unsigned size;
@@ -31,13 +40,32 @@ typedef struct {
     int sizeVars, capacityVars;
 } function_info_t;
 
+// File of a line table row ending a sequence of addresses
+#define LINE_FILE_NONE UINT32_MAX
+
+typedef struct {
+    void *addr;
+    uint32_t file;
+    uint32_t line;
+} line_entry_t;
+
 typedef struct {
+    // Functions are sorted by their lowest PC and then by length
     function_info_t *funcs;
     int sizeFuncs, capacityFuncs;
     static_variable_t *vars;
     int sizeVars, capacityVars;
     type_t *types;
     int sizeTypes, capacityTypes;
+    line_entry_t *lines;
+    int sizeLines, capacityLines;
+    char **files;
+    int sizeFiles, capacityFiles;
+
+    // The mapping of a cached copy holding the information, or NULL if it was
+    // parsed
+    void *map;
+    uint64_t mapSize;
 } debug_info_t;
 
 /*
@@ -53,11 +81,51 @@ void destroyDebugInfo(debug_info_t *info);
 
 /*
  * Gets the information of a variable at a certain memory address, given the
- * current PC, segment base and the stack pointer prior to the function call
+ * current PC, segment base and the stack pointer prior to the function call,
+ * and optionally the index of the function last found for the caller, which
+ * is tried first and updated
+ *
+ * Note: Do not free any of the strings passed back
+ */
+variable_info_t getVariableInfo(const debug_info_t *info, void *varAddr,
+                                void *pc, void *segmBase, void *sp,
+                                int *lastFunc);
+
+/*
+ * Gets the ID of the static variable at a certain memory address, given the
+ * segment base, returning VAR_ID_NONE if there is none
+ */
+uint64_t getStaticVariableId(const debug_info_t *info, void *varAddr,
+                             void *segmBase);
+
+/*
+ * Gets the index of the function containing the given PC, given the segment
+ * base, returning -1 if there is none
+ */
+int getFunctionIndex(const debug_info_t *info, void *pc, void *segmBase);
+
+/*
+ * Gets the ID of the local variable at a certain offset from the frame base,
+ * given the current PC and segment base, returning VAR_ID_NONE if there is none
+ */
+uint64_t getLocalVariableId(const debug_info_t *info, void *pc, void *segmBase,
+                            int frameOffset);
+
+/*
+ * Gets the source file and line of the given PC, given the segment base,
+ * returning 0 on success
+ *
+ * Note: Do not free the string passed back
+ */
+int getSourceLine(const debug_info_t *info, void *pc, void *segmBase,
+                  const char **file, unsigned *line);
+
+/*
+ * Gets the information of the variable with a given ID, which must not be
+ * VAR_ID_UNRESOLVED or VAR_ID_NONE
  *
  * Note: Do not free any of the strings passed back
  */
-variable_info_t getVariableInfo(debug_info_t *info, void *varAddr,
-                                void *pc, void *segmBase, void *sp);
+variable_info_t getVariableById(const debug_info_t *info, uint64_t id);
 
 #endif
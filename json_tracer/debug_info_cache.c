@@ -0,0 +1,574 @@
+#include "debug_info_cache.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MIN_CAPACITY 16
+#define CACHE_MAGIC "PCTDADI3"
+#define MAX_KEY_SIZE 64
+
+// Largest note segment searched for a build ID
+#define MAX_NOTES_SIZE 0x10000
+
+typedef struct {
+    char magic[8];
+
+    // Sizes of the structures written, so that a cache written by a different
+    // build is not used
+    uint64_t layout;
+
+    uint8_t key[MAX_KEY_SIZE];
+    uint64_t keySize;
+    uint64_t size;
+
+    // Pointers hold offsets from the start of the file, with 0 for NULL
+    debug_info_t info;
+} cache_header_t;
+
+typedef struct {
+    char *chars;
+    uint64_t size, capacity;
+
+    // One more than the offset of each string in the table, with 0 for an
+    // empty slot
+    uint64_t *slots;
+    uint64_t sizeSlots, capacitySlots;
+
+    uint64_t base;
+    int failed;
+} string_table_t;
+
+/*
+ * Gets the key of a file in the cache, returning 0 on success
+ */
+static int getCacheKey(const char *file, uint8_t *key, uint64_t *keySize);
+
+/*
+ * Gets the build ID of an ELF file from its note segments, returning 0 on
+ * success
+ */
+static int getBuildId(int fd, uint8_t *id, uint64_t *size);
+
+/*
+ * Gets the path of the cached copy for a key, creating the cache directory if
+ * needed, returning 0 on success
+ */
+static int getCachePath(const uint8_t *key, uint64_t keySize, char *path);
+
+/*
+ * Returns a hash of the sizes of every structure written to the cache
+ */
+static uint64_t getLayout();
+
+/*
+ * Hashes bytes of a given length
+ */
+static uint64_t hashBytes(const void *bytes, uint64_t length);
+
+/*
+ * Adds a string to a table, returning its offset in the file, or 0 for NULL
+ */
+static void *internString(string_table_t *table, const char *str);
+
+/*
+ * Copies a string into a table, returning its offset within the table
+ */
+static uint64_t appendString(string_table_t *table, const char *str);
+
+/*
+ * Gets the offset held by a pointer field written to the cache
+ */
+static void *toOffset(uint64_t offset);
+
+/*
+ * Gets the pointer to data of a given length at an offset within a mapping,
+ * or NULL for the offset 0, failing if it lies outside the mapping
+ */
+static void *toPointer(char *map, uint64_t mapSize, const void *offset,
+                       uint64_t length, int *failed);
+
+/*
+ * Gets the pointer to a string at an offset within a mapping, or NULL for the
+ * offset 0, failing if it is not terminated within the mapping
+ */
+static char *toString(char *map, uint64_t mapSize, const void *offset,
+                      int *failed);
+
+/*
+ * Turns the offsets of a mapped cache into pointers, returning 0 on success
+ */
+static int relocate(char *map, uint64_t mapSize, debug_info_t *info);
+
+debug_info_t *loadCachedDebugInfo(const char *file) {
+    uint8_t key[MAX_KEY_SIZE];
+    uint64_t keySize;
+    char path[PATH_MAX];
+    if (getCacheKey(file, key, &keySize) || getCachePath(key, keySize, path)) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(cache_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Only the pages of structures holding pointers are copied on relocation
+    char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    cache_header_t *header = (cache_header_t *)map;
+    if (memcmp(header->magic, CACHE_MAGIC, 8) != 0 ||
+        header->layout != getLayout() || header->keySize != keySize ||
+        memcmp(header->key, key, keySize) != 0 ||
+        header->size != (uint64_t)st.st_size ||
+        relocate(map, st.st_size, &header->info)) {
+
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    header->info.map = map;
+    header->info.mapSize = st.st_size;
+    return &header->info;
+}
+
+int cacheDebugInfo(const char *file, const debug_info_t *info) {
+    uint8_t key[MAX_KEY_SIZE];
+    uint64_t keySize;
+    char path[PATH_MAX], tempPath[PATH_MAX + 32];
+    if (getCacheKey(file, key, &keySize) || getCachePath(key, keySize, path)) {
+        return 1;
+    }
+
+    // Other processes only see the cache once it is complete
+    snprintf(tempPath, sizeof(tempPath), "%s.%d.tmp", path, (int)getpid());
+    FILE *out = fopen(tempPath, "wb");
+    if (out == NULL) {
+        return 1;
+    }
+
+    uint64_t numLocals = 0;
+    for (int i = 0; i < info->sizeFuncs; i++) {
+        numLocals += info->funcs[i].sizeVars;
+    }
+
+    uint64_t funcsOffset = sizeof(cache_header_t);
+    uint64_t localsOffset = funcsOffset +
+                            info->sizeFuncs * sizeof(function_info_t);
+    uint64_t varsOffset = localsOffset + numLocals * sizeof(local_variable_t);
+    uint64_t typesOffset = varsOffset +
+                           info->sizeVars * sizeof(static_variable_t);
+    uint64_t linesOffset = typesOffset + info->sizeTypes * sizeof(type_t);
+    uint64_t filesOffset = linesOffset + info->sizeLines * sizeof(line_entry_t);
+
+    string_table_t strings;
+    memset(&strings, 0, sizeof(strings));
+    strings.base = filesOffset + info->sizeFiles * sizeof(char *);
+
+    int failed = fseek(out, funcsOffset, SEEK_SET) != 0;
+
+    uint64_t nextLocal = localsOffset;
+    for (int i = 0; i < info->sizeFuncs && !failed; i++) {
+        function_info_t func = info->funcs[i];
+        func.name = internString(&strings, func.name);
+        func.path = internString(&strings, func.path);
+        func.vars = toOffset(nextLocal);
+        func.capacityVars = func.sizeVars;
+        nextLocal += func.sizeVars * sizeof(local_variable_t);
+        failed = fwrite(&func, sizeof(func), 1, out) != 1;
+    }
+
+    for (int i = 0; i < info->sizeFuncs && !failed; i++) {
+        for (int j = 0; j < info->funcs[i].sizeVars && !failed; j++) {
+            local_variable_t var = info->funcs[i].vars[j];
+            var.varInfo.varName = internString(&strings, var.varInfo.varName);
+            var.varInfo.type.name = internString(&strings,
+                                                 var.varInfo.type.name);
+            var.varInfo.type.path = internString(&strings,
+                                                 var.varInfo.type.path);
+            failed = fwrite(&var, sizeof(var), 1, out) != 1;
+        }
+    }
+
+    for (int i = 0; i < info->sizeVars && !failed; i++) {
+        static_variable_t var = info->vars[i];
+        var.varInfo.varName = internString(&strings, var.varInfo.varName);
+        var.varInfo.type.name = internString(&strings, var.varInfo.type.name);
+        var.varInfo.type.path = internString(&strings, var.varInfo.type.path);
+        var.path = internString(&strings, var.path);
+        failed = fwrite(&var, sizeof(var), 1, out) != 1;
+    }
+
+    for (int i = 0; i < info->sizeTypes && !failed; i++) {
+        type_t type = info->types[i];
+        type.name = internString(&strings, type.name);
+        type.path = internString(&strings, type.path);
+        failed = fwrite(&type, sizeof(type), 1, out) != 1;
+    }
+
+    failed = failed || fwrite(info->lines, sizeof(line_entry_t),
+                              info->sizeLines, out) != (size_t)info->sizeLines;
+
+    for (int i = 0; i < info->sizeFiles && !failed; i++) {
+        char *file = internString(&strings, info->files[i]);
+        failed = fwrite(&file, sizeof(file), 1, out) != 1;
+    }
+
+    failed = failed || strings.failed ||
+             fwrite(strings.chars, 1, strings.size, out) != strings.size;
+
+    cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.layout = getLayout();
+    memcpy(header.key, key, keySize);
+    header.keySize = keySize;
+    header.size = strings.base + strings.size;
+
+    header.info = *info;
+    header.info.funcs = toOffset(funcsOffset);
+    header.info.capacityFuncs = info->sizeFuncs;
+    header.info.vars = toOffset(varsOffset);
+    header.info.capacityVars = info->sizeVars;
+    header.info.types = toOffset(typesOffset);
+    header.info.capacityTypes = info->sizeTypes;
+    header.info.lines = toOffset(linesOffset);
+    header.info.capacityLines = info->sizeLines;
+    header.info.files = toOffset(filesOffset);
+    header.info.capacityFiles = info->sizeFiles;
+    header.info.map = NULL;
+    header.info.mapSize = 0;
+
+    failed = failed || fseek(out, 0, SEEK_SET) != 0 ||
+             fwrite(&header, sizeof(header), 1, out) != 1;
+    failed = fclose(out) != 0 || failed;
+    failed = failed || rename(tempPath, path) != 0;
+
+    if (failed) {
+        unlink(tempPath);
+    }
+
+    free(strings.chars);
+    free(strings.slots);
+    return failed;
+}
+
+void unmapDebugInfo(debug_info_t *info) {
+    munmap(info->map, info->mapSize);
+}
+
+static int getCacheKey(const char *file, uint8_t *key, uint64_t *keySize) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    // Keys are tagged by kind, so that the two kinds never match
+    if (getBuildId(fd, key + 1, keySize) == 0) {
+        key[0] = 'b';
+        *keySize += 1;
+    } else {
+        uint64_t identity[] = { st.st_dev, st.st_ino, st.st_size,
+                                st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+        key[0] = 's';
+        memcpy(key + 1, identity, sizeof(identity));
+        *keySize = 1 + sizeof(identity);
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int getBuildId(int fd, uint8_t *id, uint64_t *size) {
+    Elf64_Ehdr ehdr;
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr.e_phentsize != sizeof(Elf64_Phdr)) {
+
+        return 1;
+    }
+
+    for (int i = 0; i < ehdr.e_phnum; i++) {
+        Elf64_Phdr phdr;
+        off_t offset = ehdr.e_phoff + i * sizeof(Elf64_Phdr);
+        if (pread(fd, &phdr, sizeof(phdr), offset) != sizeof(phdr)) {
+            return 1;
+        } else if (phdr.p_type != PT_NOTE || phdr.p_filesz > MAX_NOTES_SIZE) {
+            continue;
+        }
+
+        uint8_t notes[phdr.p_filesz];
+        if (pread(fd, notes, phdr.p_filesz, phdr.p_offset) !=
+            (ssize_t)phdr.p_filesz) {
+
+            return 1;
+        }
+
+        // Names and descriptions are padded to four bytes
+        uint64_t pos = 0;
+        while (pos + sizeof(Elf64_Nhdr) <= phdr.p_filesz) {
+            Elf64_Nhdr nhdr;
+            memcpy(&nhdr, notes + pos, sizeof(nhdr));
+            uint64_t name = pos + sizeof(nhdr);
+            uint64_t desc = name + ((nhdr.n_namesz + 3) & ~3ul);
+            pos = desc + ((nhdr.n_descsz + 3) & ~3ul);
+            if (pos > phdr.p_filesz) {
+                break;
+            }
+
+            if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == 4 &&
+                memcmp(notes + name, "GNU", 4) == 0 &&
+                nhdr.n_descsz > 0 && nhdr.n_descsz < MAX_KEY_SIZE) {
+
+                memcpy(id, notes + desc, nhdr.n_descsz);
+                *size = nhdr.n_descsz;
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static int getCachePath(const uint8_t *key, uint64_t keySize, char *path) {
+    // An empty cache directory turns the cache off
+    char dir[PATH_MAX];
+    const char *env;
+    if ((env = getenv("PCTDA_CACHE_DIR")) != NULL) {
+        if (env[0] == '\0') {
+            return 1;
+        }
+        snprintf(dir, sizeof(dir), "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/pctda", env);
+    } else if ((env = getenv("HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/.cache", env);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/pctda", env);
+    } else {
+        return 1;
+    }
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        return 1;
+    }
+
+    int length = snprintf(path, PATH_MAX, "%s/%016lx.debuginfo", dir,
+                          hashBytes(key, keySize));
+    return length >= PATH_MAX;
+}
+
+static uint64_t getLayout() {
+    const uint64_t sizes[] = {
+        sizeof(cache_header_t),
+        sizeof(debug_info_t),
+        sizeof(function_info_t),
+        sizeof(local_variable_t),
+        sizeof(static_variable_t),
+        sizeof(variable_info_t),
+        sizeof(type_t),
+        sizeof(line_entry_t),
+        sizeof(char *)
+    };
+
+    return hashBytes(sizes, sizeof(sizes));
+}
+
+static uint64_t hashBytes(const void *bytes, uint64_t length) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (uint64_t i = 0; i < length; i++) {
+        hash = (hash ^ ((const uint8_t *)bytes)[i]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static void *internString(string_table_t *table, const char *str) {
+    if (str == NULL) {
+        return NULL;
+    }
+
+    if (2 * table->sizeSlots >= table->capacitySlots) {
+        uint64_t capacity = table->capacitySlots == 0 ?
+                            MIN_CAPACITY : 2 * table->capacitySlots;
+        uint64_t *slots = calloc(capacity, sizeof(uint64_t));
+        if (slots == NULL) {
+            table->failed = 1;
+            return NULL;
+        }
+
+        for (uint64_t i = 0; i < table->capacitySlots; i++) {
+            if (table->slots[i] == 0) {
+                continue;
+            }
+
+            const char *other = table->chars + table->slots[i] - 1;
+            uint64_t slot = hashBytes(other, strlen(other)) & (capacity - 1);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = table->slots[i];
+        }
+
+        free(table->slots);
+        table->slots = slots;
+        table->capacitySlots = capacity;
+    }
+
+    // Names and paths repeat across entries, so each is written once
+    uint64_t mask = table->capacitySlots - 1;
+    uint64_t slot = hashBytes(str, strlen(str)) & mask;
+    for (; table->slots[slot] != 0; slot = (slot + 1) & mask) {
+        if (strcmp(table->chars + table->slots[slot] - 1, str) == 0) {
+            return toOffset(table->base + table->slots[slot] - 1);
+        }
+    }
+
+    uint64_t offset = appendString(table, str);
+    if (table->failed) {
+        return NULL;
+    }
+
+    table->slots[slot] = offset + 1;
+    table->sizeSlots++;
+    return toOffset(table->base + offset);
+}
+
+static uint64_t appendString(string_table_t *table, const char *str) {
+    uint64_t length = strlen(str) + 1;
+    if (table->size + length > table->capacity) {
+        uint64_t capacity = table->capacity == 0 ? MIN_CAPACITY
+                                                 : table->capacity;
+        while (table->size + length > capacity) {
+            capacity *= 2;
+        }
+
+        char *chars = realloc(table->chars, capacity);
+        if (chars == NULL) {
+            table->failed = 1;
+            return 0;
+        }
+
+        table->chars = chars;
+        table->capacity = capacity;
+    }
+
+    uint64_t offset = table->size;
+    memcpy(table->chars + offset, str, length);
+    table->size += length;
+    return offset;
+}
+
+static void *toOffset(uint64_t offset) {
+    return (void *)(uintptr_t)offset;
+}
+
+static void *toPointer(char *map, uint64_t mapSize, const void *offset,
+                       uint64_t length, int *failed) {
+
+    uint64_t start = (uintptr_t)offset;
+    if (start == 0) {
+        return NULL;
+    } else if (start > mapSize || length > mapSize - start) {
+        *failed = 1;
+        return NULL;
+    }
+
+    return map + start;
+}
+
+static char *toString(char *map, uint64_t mapSize, const void *offset,
+                      int *failed) {
+
+    char *str = toPointer(map, mapSize, offset, 1, failed);
+    if (str != NULL && memchr(str, '\0', map + mapSize - str) == NULL) {
+        *failed = 1;
+        return NULL;
+    }
+
+    return str;
+}
+
+static int relocate(char *map, uint64_t mapSize, debug_info_t *info) {
+    int failed = 0;
+
+    info->funcs = toPointer(map, mapSize, info->funcs,
+                            info->sizeFuncs * sizeof(function_info_t),
+                            &failed);
+    info->vars = toPointer(map, mapSize, info->vars,
+                           info->sizeVars * sizeof(static_variable_t), &failed);
+    info->types = toPointer(map, mapSize, info->types,
+                            info->sizeTypes * sizeof(type_t), &failed);
+    info->lines = toPointer(map, mapSize, info->lines,
+                            info->sizeLines * sizeof(line_entry_t), &failed);
+    info->files = toPointer(map, mapSize, info->files,
+                            info->sizeFiles * sizeof(char *), &failed);
+    if (failed) {
+        return 1;
+    }
+
+    for (int i = 0; i < info->sizeFuncs; i++) {
+        function_info_t *func = &info->funcs[i];
+        func->name = toString(map, mapSize, func->name, &failed);
+        func->path = toString(map, mapSize, func->path, &failed);
+        func->vars = toPointer(map, mapSize, func->vars,
+                               func->sizeVars * sizeof(local_variable_t),
+                               &failed);
+
+        for (int j = 0; j < func->sizeVars && !failed; j++) {
+            variable_info_t *var = &func->vars[j].varInfo;
+            var->varName = toString(map, mapSize, var->varName, &failed);
+            var->type.name = toString(map, mapSize, var->type.name, &failed);
+            var->type.path = toString(map, mapSize, var->type.path, &failed);
+        }
+    }
+
+    for (int i = 0; i < info->sizeVars; i++) {
+        static_variable_t *var = &info->vars[i];
+        var->varInfo.varName = toString(map, mapSize, var->varInfo.varName,
+                                        &failed);
+        var->varInfo.type.name = toString(map, mapSize,
+                                          var->varInfo.type.name, &failed);
+        var->varInfo.type.path = toString(map, mapSize,
+                                          var->varInfo.type.path, &failed);
+        var->path = toString(map, mapSize, var->path, &failed);
+    }
+
+    for (int i = 0; i < info->sizeTypes; i++) {
+        info->types[i].name = toString(map, mapSize, info->types[i].name,
+                                       &failed);
+        info->types[i].path = toString(map, mapSize, info->types[i].path,
+                                       &failed);
+    }
+
+    for (int i = 0; i < info->sizeFiles; i++) {
+        info->files[i] = toString(map, mapSize, info->files[i], &failed);
+    }
+
+    return failed;
+}
@@ -0,0 +1,24 @@
+#ifndef DEBUG_INFO_CACHE_H
+#define DEBUG_INFO_CACHE_H
+
+#include "debug_info.h"
+
+/*
+ * Maps the cached debugging information of a file, keyed by its build ID or
+ * otherwise its identity, size and modification time, returning NULL if there
+ * is none
+ */
+debug_info_t *loadCachedDebugInfo(const char *file);
+
+/*
+ * Writes the debugging information of a file to the cache, returning 0 on
+ * success
+ */
+int cacheDebugInfo(const char *file, const debug_info_t *info);
+
+/*
+ * Unmaps cached debugging information
+ */
+void unmapDebugInfo(debug_info_t *info);
+
+#endif
@@ -34,42 +34,6 @@ void destroyDebugInfo(debug_info_t *info) {
     return func(info);
 }
 
-variable_info_t getVariableInfo(debug_info_t *info, void *varAddr,
-                                void *pc, void *segmBase, void *sp) {
-    pc -= (size_t)segmBase;
-    int stackOffset = varAddr - sp;
-
-    for (int i = 0; i < info->sizeFuncs; i++) {
-        if (pc < info->funcs[i].lowPC || pc >= info->funcs[i].lowPC + info->funcs[i].length) {
-            continue;
-        }
-
-        for (int j = 0; j < info->funcs[i].sizeVars; j++) {
-            if (stackOffset >= info->funcs[i].vars[j].offset &&
-                stackOffset < info->funcs[i].vars[j].offset + info->funcs[i].vars[j].varInfo.type.size) {
-
-                info->funcs[i].vars[j].varInfo.isLocal = 1;
-                return info->funcs[i].vars[j].varInfo;
-            }
-        }
-    }
-
-    void *segmOffset = varAddr - (size_t) segmBase;
-    for (int i = 0; i < info->sizeVars; i++) {
-        if (segmOffset >= info->vars[i].addr &&
-            segmOffset < info->vars[i].addr + info->vars[i].varInfo.type.size) {
-            
-            info->vars[i].varInfo.isLocal = 0;
-            return info->vars[i].varInfo;
-        }
-    }
-
-    variable_info_t err;
-    err.varName = NULL;
-    return err;
-}
-
-
 static void ensureLoaded() {
     if (!loaded) {
         lib = dr_load_aux_library(libDir, &libStart, &libEnd);
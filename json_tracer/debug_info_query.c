@@ -0,0 +1,150 @@
+#include "debug_info.h"
+
+#include <stddef.h>
+
+/*
+ * Gets the index of the function containing an offset from the segment base,
+ * trying the function last found first if given, returning -1 if there is none
+ */
+static int findFunction(const debug_info_t *info, void *offset, int *lastFunc);
+
+variable_info_t getVariableInfo(const debug_info_t *info, void *varAddr,
+                                void *pc, void *segmBase, void *sp,
+                                int *lastFunc) {
+    int stackOffset = varAddr - sp;
+
+    int i = findFunction(info, pc - (size_t)segmBase, lastFunc);
+    for (int j = 0; i >= 0 && j < info->funcs[i].sizeVars; j++) {
+        if (stackOffset >= info->funcs[i].vars[j].offset &&
+            stackOffset < info->funcs[i].vars[j].offset + (int)info->funcs[i].vars[j].varInfo.type.size) {
+
+            variable_info_t varInfo = info->funcs[i].vars[j].varInfo;
+            varInfo.isLocal = 1;
+            return varInfo;
+        }
+    }
+
+    void *segmOffset = varAddr - (size_t) segmBase;
+    for (int i = 0; i < info->sizeVars; i++) {
+        if (segmOffset >= info->vars[i].addr &&
+            segmOffset < info->vars[i].addr + info->vars[i].varInfo.type.size) {
+            
+            variable_info_t varInfo = info->vars[i].varInfo;
+            varInfo.isLocal = 0;
+            return varInfo;
+        }
+    }
+
+    variable_info_t err;
+    err.varName = NULL;
+    return err;
+}
+
+uint64_t getStaticVariableId(const debug_info_t *info, void *varAddr,
+                             void *segmBase) {
+
+    void *segmOffset = varAddr - (size_t)segmBase;
+    for (int i = 0; i < info->sizeVars; i++) {
+        if (segmOffset >= info->vars[i].addr &&
+            segmOffset < info->vars[i].addr + info->vars[i].varInfo.type.size) {
+
+            return (uint64_t)i + 1;
+        }
+    }
+
+    return VAR_ID_NONE;
+}
+
+int getFunctionIndex(const debug_info_t *info, void *pc, void *segmBase) {
+    return findFunction(info, pc - (size_t)segmBase, NULL);
+}
+
+uint64_t getLocalVariableId(const debug_info_t *info, void *pc, void *segmBase,
+                            int frameOffset) {
+
+    int i = getFunctionIndex(info, pc, segmBase);
+    if (i < 0) {
+        return VAR_ID_NONE;
+    }
+
+    for (int j = 0; j < info->funcs[i].sizeVars; j++) {
+        if (frameOffset >= info->funcs[i].vars[j].offset &&
+            frameOffset < info->funcs[i].vars[j].offset + (int)info->funcs[i].vars[j].varInfo.type.size) {
+
+            return VAR_ID_LOCAL | (uint64_t)i << 32 | (uint64_t)j;
+        }
+    }
+
+    return VAR_ID_NONE;
+}
+
+int getSourceLine(const debug_info_t *info, void *pc, void *segmBase,
+                  const char **file, unsigned *line) {
+    pc -= (size_t)segmBase;
+
+    // Find the last row starting at or before the PC
+    int low = 0, high = info->sizeLines;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (info->lines[mid].addr <= pc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == 0 || info->lines[low - 1].file == LINE_FILE_NONE) {
+        return 1;
+    }
+
+    *file = info->files[info->lines[low - 1].file];
+    *line = info->lines[low - 1].line;
+    return 0;
+}
+
+variable_info_t getVariableById(const debug_info_t *info, uint64_t id) {
+    variable_info_t varInfo;
+
+    if (id & VAR_ID_LOCAL) {
+        int func = (int)((id & ~VAR_ID_LOCAL) >> 32);
+        int var = (int)(id & 0xffffffff);
+        varInfo = info->funcs[func].vars[var].varInfo;
+        varInfo.isLocal = 1;
+    } else {
+        varInfo = info->vars[id - 1].varInfo;
+        varInfo.isLocal = 0;
+    }
+
+    return varInfo;
+}
+
+static int findFunction(const debug_info_t *info, void *offset, int *lastFunc) {
+    // Consecutive entries are nearly always in the same function
+    if (lastFunc != NULL && *lastFunc >= 0 && *lastFunc < info->sizeFuncs) {
+        const function_info_t *func = &info->funcs[*lastFunc];
+        if (offset >= func->lowPC && offset < func->lowPC + func->length) {
+            return *lastFunc;
+        }
+    }
+
+    // Find the last function starting at or before the offset
+    int low = 0, high = info->sizeFuncs;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (info->funcs[mid].lowPC <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == 0 || offset >= info->funcs[low - 1].lowPC +
+                              info->funcs[low - 1].length) {
+        return -1;
+    }
+
+    if (lastFunc != NULL) {
+        *lastFunc = low - 1;
+    }
+    return low - 1;
+}
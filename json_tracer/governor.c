@@ -0,0 +1,103 @@
+#include "dr_api.h"
+
+#include "governor.h"
+#include "options.h"
+
+#define WINDOW_TIME 100000
+#define MAX_SAMPLE_SHIFT 16
+
+/*
+ * Returns whether the flushes of the current window went over budget
+ */
+static int overBudget(governor_t *gov, uint64_t windowTime);
+
+/*
+ * Returns whether the flushes of the current window stayed well within
+ * budget
+ */
+static int underBudget(governor_t *gov, uint64_t windowTime);
+
+/*
+ * Returns the fraction of time that may be spent flushing
+ */
+static double maxFlushFraction();
+
+int governorEnabled() {
+    return options.maxSlowdown > 1 || options.maxBytesPerSec != 0;
+}
+
+void governorInit(governor_t *gov) {
+    gov->windowStart = dr_get_microseconds();
+    gov->windowFlushTime = 0;
+    gov->windowBytes = 0;
+    gov->sampleShift = 0;
+
+    gov->buffers = 0;
+    gov->droppedBuffers = 0;
+    gov->droppedEntries = 0;
+    gov->pendingBuffers = 0;
+    gov->pendingEntries = 0;
+}
+
+int governorShouldWrite(governor_t *gov) {
+    uint64_t mask = ((uint64_t)1 << gov->sampleShift) - 1;
+    return (gov->buffers++ & mask) == 0;
+}
+
+void governorDropped(governor_t *gov, uint64_t entries) {
+    gov->droppedBuffers++;
+    gov->droppedEntries += entries;
+    gov->pendingBuffers++;
+    gov->pendingEntries += entries;
+}
+
+void governorFlushed(governor_t *gov, uint64_t time, uint64_t bytes) {
+    gov->windowFlushTime += time;
+    gov->windowBytes += bytes;
+
+    uint64_t now = dr_get_microseconds();
+    uint64_t windowTime = now - gov->windowStart;
+    if (windowTime < WINDOW_TIME) {
+        return;
+    }
+
+    if (overBudget(gov, windowTime)) {
+        if (gov->sampleShift < MAX_SAMPLE_SHIFT) {
+            gov->sampleShift++;
+        }
+    } else if (underBudget(gov, windowTime) && gov->sampleShift > 0) {
+        gov->sampleShift--;
+    }
+
+    gov->windowStart = now;
+    gov->windowFlushTime = 0;
+    gov->windowBytes = 0;
+}
+
+void governorClearPending(governor_t *gov) {
+    gov->pendingBuffers = 0;
+    gov->pendingEntries = 0;
+}
+
+static int overBudget(governor_t *gov, uint64_t windowTime) {
+    double flushFraction = (double)gov->windowFlushTime / windowTime;
+    double bytesPerSec = gov->windowBytes * 1000000.0 / windowTime;
+
+    return (options.maxSlowdown > 1 && flushFraction > maxFlushFraction()) ||
+           (options.maxBytesPerSec != 0 && bytesPerSec > options.maxBytesPerSec);
+}
+
+static int underBudget(governor_t *gov, uint64_t windowTime) {
+    double flushFraction = (double)gov->windowFlushTime / windowTime;
+    double bytesPerSec = gov->windowBytes * 1000000.0 / windowTime;
+
+    // Only sample less once twice the current rate would fit in the budget
+    return (options.maxSlowdown <= 1 ||
+            2 * flushFraction <= maxFlushFraction()) &&
+           (options.maxBytesPerSec == 0 ||
+            2 * bytesPerSec <= options.maxBytesPerSec);
+}
+
+static double maxFlushFraction() {
+    return 1 - 1 / options.maxSlowdown;
+}
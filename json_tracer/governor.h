@@ -0,0 +1,45 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <inttypes.h>
+
+typedef struct {
+    uint64_t windowStart, windowFlushTime, windowBytes;
+    int sampleShift;
+
+    uint64_t buffers, droppedBuffers, droppedEntries;
+    uint64_t pendingBuffers, pendingEntries;
+} governor_t;
+
+/*
+ * Returns whether an overhead budget has been given
+ */
+int governorEnabled();
+
+/*
+ * Initialises the overhead governor of a thread
+ */
+void governorInit(governor_t *gov);
+
+/*
+ * Returns whether the next buffer should be written rather than dropped
+ */
+int governorShouldWrite(governor_t *gov);
+
+/*
+ * Records that a buffer of the given number of entries was dropped
+ */
+void governorDropped(governor_t *gov, uint64_t entries);
+
+/*
+ * Records the time taken in microseconds and bytes written by a flush,
+ * adjusting the sampling rate at the end of each window
+ */
+void governorFlushed(governor_t *gov, uint64_t time, uint64_t bytes);
+
+/*
+ * Clears the buffers dropped since the last loss marker
+ */
+void governorClearPending(governor_t *gov);
+
+#endif
@@ -2,14 +2,20 @@
 
 #include "dr_api.h"
 #include "drsyms.h"
+#include "drutil.h"
 
 #include "insert_instrumentation.h"
+#include "options.h"
+#include "watch.h"
 
 typedef struct {
     byte *segmBase;
     trace_entry_t *buf;
 } thread_data_t;
 
+static const debug_info_t *debugInfo;
+static void *mainSegmBase;
+
 typedef struct {
     void *drcontext;
     instrlist_t *instrs;
@@ -17,6 +23,12 @@ typedef struct {
     reg_id_t regDstAddr, regVal;
 } add_instr_context_t;
 
+typedef enum {
+    recordNever,
+    recordAlways,
+    recordIfWatched
+} record_mode_t;
+
 /*
  * Creates an instructionContext for adding instructions
  */
@@ -52,11 +64,6 @@ static void storePointer(add_instr_context_t cont, reg_id_t regSegmBase,
  */
 static void loadValueImm(add_instr_context_t cont, uint64_t val);
 
-/*
- * Loads a given operand into the value register
- */
-static void loadValueOpnd(add_instr_context_t cont, opnd_t opnd);
-
 /*
  * Stores the value register at an offset from the destination address register
  */
@@ -72,6 +79,83 @@ static void savePC(add_instr_context_t cont);
  */
 static void saveOpcode(add_instr_context_t cont);
 
+/*
+ * Saves the pending timestamp for the following instruction
+ */
+static void saveTimestamp(add_instr_context_t cont, reg_id_t regSegmBase,
+                          uint offset);
+
+/*
+ * Advances the destination address register past the saved entry and stores
+ * it, consuming the pending timestamp
+ */
+static void commitEntry(add_instr_context_t cont, reg_id_t regSegmBase,
+                        uint offset);
+
+/*
+ * Saves whether the following conditional branch is taken by running a copy of
+ * it before it, its entry having been marked not taken along with its opcode
+ */
+static void saveBranch(add_instr_context_t cont);
+
+/*
+ * Returns whether the outcome of a conditional branch can be found by running
+ * a copy of it, which excludes loops as they change RCX
+ */
+static int isCopyableBranch(instr_t *instr);
+
+/*
+ * Returns whether an instruction is recorded always, never, or only if it
+ * accesses a watched variable at runtime
+ */
+static record_mode_t getRecordMode(instr_t *instr);
+
+/*
+ * Returns whether an instruction always, never, or only at runtime may write
+ * to a watched variable or register
+ */
+static record_mode_t getWriteMode(instr_t *instr);
+
+/*
+ * Returns 1 if an operand accesses a watched variable, 0 if it does not, or -1
+ * if this is only known at runtime
+ */
+static int accessesWatched(instr_t *instr, opnd_t opnd);
+
+/*
+ * Inserts jumping to a label if any operand only resolved at runtime accesses
+ * a watched variable, using the addresses saved in the entry
+ */
+static void insertWatchCheck(add_instr_context_t cont, reg_id_t regTmp,
+                             instr_t *label);
+
+/*
+ * Inserts jumping to a label if an access of a given size at the address in
+ * the value register overlaps a watched variable, given the index of the
+ * function of the instruction and where to find RBP, which may change the
+ * value register
+ */
+static void insertAddressCheck(add_instr_context_t cont, reg_id_t regTmp,
+                               int func, uint64_t size, opnd_t bp,
+                               instr_t *label);
+
+/*
+ * Inserts jumping to a label if the value register is within a given length
+ * after a start
+ */
+static void insertRangeCheck(add_instr_context_t cont, reg_id_t regTmp,
+                             int64_t start, uint64_t length, instr_t *label);
+
+/*
+ * Returns the number of operands saved for an instruction
+ */
+static int numOperands(instr_t *instr);
+
+/*
+ * Returns the operand saved at a given index, with sources before destinations
+ */
+static opnd_t getOperand(instr_t *instr, int i);
+
 /*
  * Saves operand values of the following instruction
  */
@@ -112,6 +196,42 @@ static void saveMem(add_instr_context_t *cont, opnd_t opnd, int numVals);
  */
 static void saveIndir(add_instr_context_t *cont, opnd_t opnd, int numVals);
 
+/*
+ * Copies a value of a given size from the address held in the value register
+ * to a given offset from the destination address register
+ */
+static void copyValue(add_instr_context_t *cont, uint size, int offset);
+
+/*
+ * Inserts a zero-extending load of a given size from an offset from a given
+ * address register into a given register
+ */
+static void loadSized(add_instr_context_t cont, reg_id_t dst, reg_id_t addr,
+                      int offset, uint size);
+
+/*
+ * Inserts a store of the low bytes of a given size of a register at a given
+ * offset
+ */
+static void storeSized(add_instr_context_t cont, reg_id_t reg, int offset,
+                       uint size);
+
+/*
+ * Inserts a store of a whole SIMD register at a given offset
+ */
+static void storeSimdReg(add_instr_context_t cont, reg_id_t reg, int offset);
+
+/*
+ * Returns the operand size for a number of bytes
+ */
+static opnd_size_t bytesToSize(uint size);
+
+/*
+ * Returns the ID of the variable accessed by an indirect operand if it can be
+ * found ahead of time, or VAR_ID_UNRESOLVED otherwise
+ */
+static uint64_t getIndirVariableId(instr_t *instr, opnd_t opnd);
+
 /*
  * Changes the value and destination address registers to not be some given
  * register, may change the value held in the value register
@@ -144,8 +264,17 @@ static void saveIndirCall(app_pc instrAddr, app_pc targetAddr);
  */
 static void createTargetOpnd(app_pc targetAddr, call_target_t *target);
 
-void instrContextInit() {
-    drreg_options_t ops = {sizeof(ops), 3, false};
+/*
+ * Reserves a specific register
+ */
+static void reserveSpecificRegister(void *drcontext, instrlist_t *instrs,
+                                    instr_t *instr, reg_id_t reg);
+
+void instrContextInit(const debug_info_t *info, void *segmBase) {
+    debugInfo = info;
+    mainSegmBase = segmBase;
+
+    drreg_options_t ops = {sizeof(ops), 4, false};
     drreg_init(&ops);
     drsym_init(0);
 }
@@ -158,6 +287,11 @@ void instrContextDeinit() {
 void insertInstrumentation(void *drcontext, instrlist_t *instrs,
                            instr_t *instr, reg_id_t regSegmBase, uint offset) {
 
+    record_mode_t mode = getRecordMode(instr);
+    if (mode == recordNever) {
+        return;
+    }
+
     add_instr_context_t cont = createInstrContext(drcontext, instrs, instr);
 
     if (instr_is_call(instr)) {
@@ -170,14 +304,201 @@ void insertInstrumentation(void *drcontext, instrlist_t *instrs,
 
         savePC(cont);
         saveOpcode(cont);
+        saveTimestamp(cont, regSegmBase, offset);
         saveOperands(&cont);
 
-        addPointer(cont, sizeof(trace_entry_t));
-        storePointer(cont, regSegmBase, offset);
+        if (options.branches && isCopyableBranch(instr)) {
+            saveBranch(cont);
+        }
+
+        if (mode == recordAlways) {
+            commitEntry(cont, regSegmBase, offset);
+        } else {
+            // All reservations happen before branching so each path restores alike
+            reg_id_t regTmp;
+            drreg_reserve_aflags(drcontext, instrs, instr);
+            drreg_reserve_register(drcontext, instrs, instr, NULL, &regTmp);
+
+            instr_t *commitLabel = INSTR_CREATE_label(drcontext);
+            instr_t *skipLabel = INSTR_CREATE_label(drcontext);
+
+            insertWatchCheck(cont, regTmp, commitLabel);
+            instrlist_meta_preinsert(instrs, instr,
+                INSTR_CREATE_jmp(drcontext, opnd_create_instr(skipLabel)));
+
+            instrlist_meta_preinsert(instrs, instr, commitLabel);
+            commitEntry(cont, regSegmBase, offset);
+            instrlist_meta_preinsert(instrs, instr, skipLabel);
+
+            drreg_unreserve_register(drcontext, instrs, instr, regTmp);
+            drreg_unreserve_aflags(drcontext, instrs, instr);
+        }
     }
     destroyInstrContext(cont);
 }
 
+void insertChangeInstrumentation(void *drcontext, instrlist_t *instrs,
+                                 instr_t *instr, reg_id_t regSegmBase,
+                                 uint offset) {
+
+    record_mode_t mode = getWriteMode(instr);
+    if (mode == recordNever) {
+        return;
+    }
+
+    // Addresses are computed from the application's values of the registers
+    // they use, and locals are found from its RBP
+    drvector_t allowedRegs;
+    drreg_init_and_fill_vector(&allowedRegs, true);
+    drreg_set_vector_entry(&allowedRegs, DR_REG_RBP, false);
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        opnd_t opnd = instr_get_dst(instr, i);
+        for (int j = 0; j < opnd_num_regs_used(opnd); j++) {
+            reg_id_t reg = reg_to_pointer_sized(opnd_get_reg_used(opnd, j));
+            if (reg_is_pointer_sized(reg)) {
+                drreg_set_vector_entry(&allowedRegs, reg, false);
+            }
+        }
+    }
+
+    // All reservations happen before branching so each path restores alike
+    add_instr_context_t cont;
+    cont.drcontext = drcontext;
+    cont.instrs = instrs;
+    cont.nextInstr = instr;
+    cont.regDstAddr = DR_REG_NULL;
+
+    reg_id_t regTmp;
+    if (mode == recordIfWatched) {
+        drreg_reserve_aflags(drcontext, instrs, instr);
+    }
+    drreg_reserve_register(drcontext, instrs, instr, &allowedRegs,
+                           &cont.regVal);
+    drreg_reserve_register(drcontext, instrs, instr, &allowedRegs, &regTmp);
+    drvector_delete(&allowedRegs);
+
+    instr_t *pendingLabel = INSTR_CREATE_label(drcontext);
+    instr_t *skipLabel = INSTR_CREATE_label(drcontext);
+
+    if (mode == recordIfWatched) {
+        int func = getFunctionIndex(debugInfo, instr_get_app_pc(instr),
+                                    mainSegmBase);
+
+        for (int i = 0; i < instr_num_dsts(instr); i++) {
+            opnd_t opnd = instr_get_dst(instr, i);
+            if (accessesWatched(instr, opnd) != -1) {
+                continue;
+            }
+
+            drutil_insert_get_mem_addr(drcontext, instrs, instr, opnd,
+                                       cont.regVal, regTmp);
+            dr_insert_write_raw_tls(drcontext, instrs, instr, regSegmBase,
+                                    offset + PENDING_ADDR_SLOT, cont.regVal);
+            insertAddressCheck(cont, regTmp, func,
+                               opnd_size_in_bytes(opnd_get_size(opnd)),
+                               opnd_create_reg(DR_REG_RBP), pendingLabel);
+        }
+
+        instrlist_meta_preinsert(instrs, instr,
+            INSTR_CREATE_jmp(drcontext, opnd_create_instr(skipLabel)));
+    } else {
+        // The address is taken before the instruction may change its
+        // registers, and left as 0 if only registers are watched
+        loadValueImm(cont, 0);
+        for (int i = 0; i < instr_num_dsts(instr); i++) {
+            opnd_t opnd = instr_get_dst(instr, i);
+            if (!instr_is_call(instr) && accessesWatched(instr, opnd) == 1) {
+                drutil_insert_get_mem_addr(drcontext, instrs, instr, opnd,
+                                           cont.regVal, regTmp);
+                break;
+            }
+        }
+        dr_insert_write_raw_tls(drcontext, instrs, instr, regSegmBase,
+                                offset + PENDING_ADDR_SLOT, cont.regVal);
+    }
+
+    // Leave the PC for the values to be compared after the instruction
+    instrlist_meta_preinsert(instrs, instr, pendingLabel);
+    loadValueImm(cont, (uint64_t)instr_get_app_pc(instr));
+    dr_insert_write_raw_tls(drcontext, instrs, instr, regSegmBase,
+                            offset + PENDING_WRITE_SLOT, cont.regVal);
+    instrlist_meta_preinsert(instrs, instr, skipLabel);
+
+    drreg_unreserve_register(drcontext, instrs, instr, regTmp);
+    drreg_unreserve_register(drcontext, instrs, instr, cont.regVal);
+    if (mode == recordIfWatched) {
+        drreg_unreserve_aflags(drcontext, instrs, instr);
+    }
+}
+
+int mayChangeWatched(instr_t *instr) {
+    return getWriteMode(instr) != recordNever;
+}
+
+void insertPendingCall(void *drcontext, instrlist_t *instrs, instr_t *instr,
+                       reg_id_t regSegmBase, uint offset, void *callee) {
+
+    drreg_reserve_aflags(drcontext, instrs, instr);
+
+    opnd_t pending = opnd_create_far_base_disp(regSegmBase, DR_REG_NULL,
+                                               DR_REG_NULL, 0,
+                                               offset + PENDING_WRITE_SLOT,
+                                               OPSZ_8);
+    instr_t *skipLabel = INSTR_CREATE_label(drcontext);
+
+    instrlist_meta_preinsert(instrs, instr,
+        INSTR_CREATE_cmp(drcontext, pending, OPND_CREATE_INT32(0)));
+    instrlist_meta_preinsert(instrs, instr,
+        INSTR_CREATE_jcc(drcontext, OP_jz, opnd_create_instr(skipLabel)));
+    dr_insert_clean_call(drcontext, instrs, instr, callee, false, 0);
+    instrlist_meta_preinsert(instrs, instr, skipLabel);
+
+    drreg_unreserve_aflags(drcontext, instrs, instr);
+}
+
+void insertTimestamp(void *drcontext, instrlist_t *instrs, instr_t *instr,
+                     reg_id_t regSegmBase, uint offset, uint64_t interval) {
+
+    // All reservations happen before branching so each path restores alike
+    drreg_reserve_aflags(drcontext, instrs, instr);
+    reserveSpecificRegister(drcontext, instrs, instr, DR_REG_RAX);
+    reserveSpecificRegister(drcontext, instrs, instr, DR_REG_RDX);
+
+    instr_t *skipLabel = INSTR_CREATE_label(drcontext);
+    if (interval > 1) {
+        opnd_t counter = opnd_create_far_base_disp(regSegmBase, DR_REG_NULL,
+                                                   DR_REG_NULL, 0,
+                                                   offset + COUNTER_SLOT,
+                                                   OPSZ_8);
+
+        instrlist_meta_preinsert(instrs, instr,
+            INSTR_CREATE_sub(drcontext, counter, OPND_CREATE_INT8(1)));
+        instrlist_meta_preinsert(instrs, instr,
+            INSTR_CREATE_jcc(drcontext, OP_jnz, opnd_create_instr(skipLabel)));
+        instrlist_meta_preinsert(instrs, instr,
+            INSTR_CREATE_mov_st(drcontext, counter,
+                                OPND_CREATE_INT32((int)interval)));
+    }
+
+    // Combine EDX:EAX into RAX
+    instrlist_meta_preinsert(instrs, instr, INSTR_CREATE_rdtsc(drcontext));
+    instrlist_meta_preinsert(instrs, instr,
+        INSTR_CREATE_shl(drcontext, opnd_create_reg(DR_REG_RDX),
+                         OPND_CREATE_INT8(32)));
+    instrlist_meta_preinsert(instrs, instr,
+        INSTR_CREATE_or(drcontext, opnd_create_reg(DR_REG_RAX),
+                        opnd_create_reg(DR_REG_RDX)));
+
+    dr_insert_write_raw_tls(drcontext, instrs, instr, regSegmBase,
+                            offset + TIMESTAMP_SLOT, DR_REG_RAX);
+
+    instrlist_meta_preinsert(instrs, instr, skipLabel);
+
+    drreg_unreserve_register(drcontext, instrs, instr, DR_REG_RDX);
+    drreg_unreserve_register(drcontext, instrs, instr, DR_REG_RAX);
+    drreg_unreserve_aflags(drcontext, instrs, instr);
+}
+
 static add_instr_context_t createInstrContext(void *drcontext,
                                               instrlist_t *instrs,
                                               instr_t *nextInstr) {
@@ -209,9 +530,10 @@ static void loadPointer(add_instr_context_t cont, reg_id_t regSegmBase,
 }
 
 static void addPointer(add_instr_context_t cont, int amount) {
+    // LEA leaves the application's flags untouched
     instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
-        XINST_CREATE_add(cont.drcontext, opnd_create_reg(cont.regDstAddr),
-        OPND_CREATE_INT16(amount)));
+        INSTR_CREATE_lea(cont.drcontext, opnd_create_reg(cont.regDstAddr),
+        OPND_CREATE_MEM_lea(cont.regDstAddr, DR_REG_NULL, 0, amount)));
 }
 
 static void storePointer(add_instr_context_t cont, reg_id_t regSegmBase,
@@ -227,11 +549,6 @@ static void loadValueImm(add_instr_context_t cont, uint64_t val) {
                                      cont.instrs, cont.nextInstr, NULL, NULL);
 }
 
-static void loadValueOpnd(add_instr_context_t cont, opnd_t opnd) {
-    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
-        XINST_CREATE_load(cont.drcontext, opnd_create_reg(cont.regVal), opnd));
-}
-
 static void storeValue(add_instr_context_t cont, int offset) {
     storeReg(cont, cont.regVal, offset);
 }
@@ -243,11 +560,259 @@ static void savePC(add_instr_context_t cont) {
 }
 
 static void saveOpcode(add_instr_context_t cont) {
+    // Copied branches start as not taken, and the outcome of any other
+    // instruction is left as none
+    uint64_t branch = branchNone;
+    if (options.branches && isCopyableBranch(cont.nextInstr)) {
+        branch = branchNotTaken;
+    }
+
     int opcode = instr_get_opcode(cont.nextInstr);
-    loadValueImm(cont, (uint64_t)opcode);
+    loadValueImm(cont, (uint64_t)(uint32_t)opcode | branch << 32);
     storeValue(cont, offsetof(trace_entry_t, opcode));
 }
 
+static void saveTimestamp(add_instr_context_t cont, reg_id_t regSegmBase,
+                          uint offset) {
+
+    if (options.timestampInterval != 0) {
+        dr_insert_read_raw_tls(cont.drcontext, cont.instrs, cont.nextInstr,
+                               regSegmBase, offset + TIMESTAMP_SLOT,
+                               cont.regVal);
+        storeValue(cont, offsetof(trace_entry_t, tsc));
+    }
+}
+
+static void commitEntry(add_instr_context_t cont, reg_id_t regSegmBase,
+                        uint offset) {
+
+    if (options.timestampInterval != 0) {
+        opnd_t pending = opnd_create_far_base_disp(regSegmBase, DR_REG_NULL,
+                                                   DR_REG_NULL, 0,
+                                                   offset + TIMESTAMP_SLOT,
+                                                   OPSZ_8);
+        instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+            INSTR_CREATE_mov_st(cont.drcontext, pending, OPND_CREATE_INT32(0)));
+    }
+
+    addPointer(cont, sizeof(trace_entry_t));
+    storePointer(cont, regSegmBase, offset);
+}
+
+static void saveBranch(add_instr_context_t cont) {
+    opnd_t branch = OPND_CREATE_MEM32(cont.regDstAddr,
+                                      offsetof(trace_entry_t, branch));
+
+    // The copy tests the flags the application branch will see
+    drreg_restore_app_aflags(cont.drcontext, cont.instrs, cont.nextInstr);
+
+    // Short forms are widened so the copy always reaches its label
+    int opcode = instr_get_opcode(cont.nextInstr);
+    if (opcode >= OP_jo_short && opcode <= OP_jnle_short) {
+        opcode = opcode - OP_jo_short + OP_jo;
+    }
+
+    instr_t *takenLabel = INSTR_CREATE_label(cont.drcontext);
+    instr_t *doneLabel = INSTR_CREATE_label(cont.drcontext);
+
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        INSTR_CREATE_jcc(cont.drcontext, opcode,
+                         opnd_create_instr(takenLabel)));
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        INSTR_CREATE_jmp(cont.drcontext, opnd_create_instr(doneLabel)));
+
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr, takenLabel);
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        INSTR_CREATE_mov_st(cont.drcontext, branch,
+                            OPND_CREATE_INT32(branchTaken)));
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr, doneLabel);
+}
+
+static int isCopyableBranch(instr_t *instr) {
+    if (!instr_is_cbr(instr)) {
+        return 0;
+    }
+
+    switch (instr_get_opcode(instr)) {
+        case OP_loop:
+        case OP_loope:
+        case OP_loopne:
+        case OP_jecxz:
+            return 0;
+
+        default:
+            return 1;
+    }
+}
+
+static record_mode_t getRecordMode(instr_t *instr) {
+    if (!watchListEnabled()) {
+        return recordAlways;
+    }
+
+    // The predictor is given every branch, not only those near watched values
+    if (options.branches && isCopyableBranch(instr)) {
+        return recordAlways;
+    }
+
+    if (instr_is_call(instr)) {
+        return recordNever;
+    } else if (usesWatchedRegister(instr, 0)) {
+        return recordAlways;
+    }
+
+    // Address computations do not access variables
+    if (!instr_reads_memory(instr) && !instr_writes_memory(instr)) {
+        return recordNever;
+    }
+
+    record_mode_t mode = recordNever;
+    for (int i = 0; i < numOperands(instr); i++) {
+        int accesses = accessesWatched(instr, getOperand(instr, i));
+        if (accesses == 1) {
+            return recordAlways;
+        } else if (accesses == -1) {
+            mode = recordIfWatched;
+        }
+    }
+
+    return mode;
+}
+
+static record_mode_t getWriteMode(instr_t *instr) {
+    if (!watchListEnabled()) {
+        return recordNever;
+    } else if (usesWatchedRegister(instr, 1)) {
+        return recordAlways;
+    }
+
+    // Only the return address is written by calls
+    if (instr_is_call(instr) || !instr_writes_memory(instr)) {
+        return recordNever;
+    }
+
+    record_mode_t mode = recordNever;
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        int accesses = accessesWatched(instr, instr_get_dst(instr, i));
+        if (accesses == 1) {
+            return recordAlways;
+        } else if (accesses == -1) {
+            mode = recordIfWatched;
+        }
+    }
+
+    return mode;
+}
+
+static int accessesWatched(instr_t *instr, opnd_t opnd) {
+    uint64_t varId;
+
+    switch (getType(opnd)) {
+        case mem:
+            if (opnd_is_far_abs_addr(opnd)) {
+                return 0;
+            }
+            varId = getStaticVariableId(debugInfo, opnd_get_addr(opnd),
+                                        mainSegmBase);
+            return isWatchedVariable(varId);
+
+        case indir:
+            if (opnd_is_far_base_disp(opnd)) {
+                return 0;
+            }
+            varId = getIndirVariableId(instr, opnd);
+            return varId == VAR_ID_UNRESOLVED ? -1 : isWatchedVariable(varId);
+
+        default:
+            return 0;
+    }
+}
+
+static void insertWatchCheck(add_instr_context_t cont, reg_id_t regTmp,
+                             instr_t *label) {
+
+    instr_t *instr = cont.nextInstr;
+    int func = getFunctionIndex(debugInfo, instr_get_app_pc(instr),
+                                mainSegmBase);
+
+    for (int i = 0; i < numOperands(instr); i++) {
+        opnd_t opnd = getOperand(instr, i);
+        if (accessesWatched(instr, opnd) != -1) {
+            continue;
+        }
+
+        loadSized(cont, cont.regVal, cont.regDstAddr,
+                  offsetof(trace_entry_t, vals[i].val.indir.addr), 8);
+        insertAddressCheck(cont, regTmp, func,
+                           opnd_size_in_bytes(opnd_get_size(opnd)),
+                           OPND_CREATE_MEMPTR(cont.regDstAddr,
+                                              offsetof(trace_entry_t, bp)),
+                           label);
+    }
+}
+
+static void insertAddressCheck(add_instr_context_t cont, reg_id_t regTmp,
+                               int func, uint64_t size, opnd_t bp,
+                               instr_t *label) {
+
+    // Widen each range so accesses overlapping its start also match
+    uint64_t widen = size != 0 ? size - 1 : 0;
+
+    bool hasLocals = false;
+    for (int j = 0; j < watchList.sizeRanges; j++) {
+        watch_range_t *range = &watchList.ranges[j];
+        if (!range->isLocal) {
+            insertRangeCheck(cont, regTmp, range->start - widen,
+                             range->size + widen, label);
+        } else if (range->func == func) {
+            hasLocals = true;
+        }
+    }
+
+    // Locals are only watched within the frame of their own function
+    if (!hasLocals) {
+        return;
+    }
+
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        INSTR_CREATE_sub(cont.drcontext, opnd_create_reg(cont.regVal), bp));
+    for (int j = 0; j < watchList.sizeRanges; j++) {
+        watch_range_t *range = &watchList.ranges[j];
+        if (range->isLocal && range->func == func) {
+            insertRangeCheck(cont, regTmp, range->start - widen,
+                             range->size + widen, label);
+        }
+    }
+}
+
+static void insertRangeCheck(add_instr_context_t cont, reg_id_t regTmp,
+                             int64_t start, uint64_t length, instr_t *label) {
+
+    // A single unsigned comparison of the offset from the start checks both
+    // bounds
+    instrlist_insert_mov_immed_ptrsz(cont.drcontext, (ptr_int_t)-start,
+                                     opnd_create_reg(regTmp), cont.instrs,
+                                     cont.nextInstr, NULL, NULL);
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        INSTR_CREATE_add(cont.drcontext, opnd_create_reg(regTmp),
+                         opnd_create_reg(cont.regVal)));
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        INSTR_CREATE_cmp(cont.drcontext, opnd_create_reg(regTmp),
+                         OPND_CREATE_INT32((int)length)));
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        INSTR_CREATE_jcc(cont.drcontext, OP_jb, opnd_create_instr(label)));
+}
+
+static int numOperands(instr_t *instr) {
+    int num = instr_num_srcs(instr) + instr_num_dsts(instr);
+    return num < MAX_OPERANDS ? num : MAX_OPERANDS;
+}
+
+static opnd_t getOperand(instr_t *instr, int i) {
+    int srcs = instr_num_srcs(instr);
+    return i < srcs ? instr_get_src(instr, i) : instr_get_dst(instr, i - srcs);
+}
+
 static void saveOperands(add_instr_context_t *cont) {
     int numVals = 0;
 
@@ -283,6 +848,10 @@ static value_type_t getType(opnd_t opnd) {
 }
 
 static void saveOpnd(add_instr_context_t *cont, opnd_t opnd, int *numVals, int isSrc) {
+    if (*numVals >= MAX_OPERANDS) {
+        return;
+    }
+
     // Write if source
     loadValueImm(*cont, (uint64_t)isSrc);
     storeValue(*cont, offsetof(trace_entry_t, vals[*numVals].isSrc));
@@ -321,16 +890,40 @@ static void saveReg(add_instr_context_t *cont, opnd_t opnd, int numVals) {
     const char *regName = get_register_name(opndReg);
     loadValueImm(*cont, (uint64_t)regName);
     storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.reg.name));
-    
+
+    // Save register size
+    uint size = opnd_size_in_bytes(reg_get_size(opndReg));
+    loadValueImm(*cont, size);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.reg.size));
+
+    // Save shift of the register within the whole register for AH to BH
+    uint64_t shift = opndReg >= DR_REG_AH && opndReg <= DR_REG_BH ? 8 : 0;
+    loadValueImm(*cont, shift);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.reg.shift));
+
     // Save register value
     reg_id_t reg = reg_to_pointer_sized(opndReg);
-    if (reg_is_pointer_sized(reg)) {
+    bool isSimd = reg_is_strictly_xmm(opndReg) || reg_is_strictly_ymm(opndReg) ||
+                  reg_is_strictly_zmm(opndReg);
+    bool valNull = !isSimd && !(reg_is_gpr(opndReg) && reg_is_pointer_sized(reg));
+
+    loadValueImm(*cont, valNull);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.reg.valNull));
+
+    if (isSimd) {
+        storeSimdReg(*cont, opndReg,
+                     offsetof(trace_entry_t, vals[numVals].val.reg.bytes));
+    } else if (!valNull) {
         ensureNotUsing(cont, reg, reg);
         storeReg(*cont, reg, offsetof(trace_entry_t, vals[numVals].val.reg.val));
     }
 }
 
 static void saveImm(add_instr_context_t *cont, opnd_t opnd, int numVals) {
+    uint size = opnd_size_in_bytes(opnd_get_size(opnd));
+    loadValueImm(*cont, size);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.imm.size));
+
     opnd_set_size(&opnd, OPSZ_8);
     loadValueImm(*cont, opnd_get_immed_int(opnd));
     storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.imm.val));
@@ -341,16 +934,32 @@ static void saveMem(add_instr_context_t *cont, opnd_t opnd, int numVals) {
     uint64_t isFar = opnd_is_far_abs_addr(opnd);
     loadValueImm(*cont, isFar);
     storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.mem.isFar));
- 
-    // Save address
+
+    // Save variable, known ahead of time as the address is fixed
     uint64_t *addr = opnd_get_addr(opnd);
+    uint64_t varId = VAR_ID_UNRESOLVED;
+    if (debugInfo != NULL) {
+        varId = getStaticVariableId(debugInfo, addr, mainSegmBase);
+    }
+    loadValueImm(*cont, varId);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.mem.varId));
+
+    // Save size
+    uint size = opnd_size_in_bytes(opnd_get_size(opnd));
+    loadValueImm(*cont, size);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.mem.size));
+
+    bool valNull = isFar || size == 0 || size > MAX_VALUE_SIZE;
+    loadValueImm(*cont, valNull);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.mem.valNull));
+
+    // Save address
     loadValueImm(*cont, (uint64_t)addr);
     storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.mem.addr));
- 
-    // Save value 
-    if (!opnd_is_rel_addr(opnd)) {
-        loadValueOpnd(*cont, opnd);
-        storeReg(*cont, cont->regVal, offsetof(trace_entry_t, vals[numVals].val.mem.val));
+
+    // Save value through the address, reachable whether absolute or relative
+    if (!valNull) {
+        copyValue(cont, size, offsetof(trace_entry_t, vals[numVals].val.mem.bytes));
     }
 }
 
@@ -365,6 +974,15 @@ static void saveIndir(add_instr_context_t *cont, opnd_t opnd, int numVals) {
     loadValueImm(*cont, (uint64_t)disp);
     storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.indir.disp));
 
+    // Save variable if known ahead of time
+    loadValueImm(*cont, getIndirVariableId(cont->nextInstr, opnd));
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.indir.varId));
+
+    // Save size
+    uint size = opnd_size_in_bytes(opnd_get_size(opnd));
+    loadValueImm(*cont, size);
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.indir.size));
+
     // Save base name
     reg_id_t base = opnd_get_base(opnd);
     const char *baseName = get_register_name(base);
@@ -373,31 +991,152 @@ static void saveIndir(add_instr_context_t *cont, opnd_t opnd, int numVals) {
     base = reg_to_pointer_sized(base);
 
     // Save base value
+    reg_id_t index = reg_to_pointer_sized(opnd_get_index(opnd));
     bool baseNull = !reg_is_pointer_sized(base);
     loadValueImm(*cont, baseNull);
     storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.indir.baseNull));
-    if (!baseNull) { 
+
+    ensureNotUsing(cont, base, index);
+    if (!baseNull) {
         storeReg(*cont, base,
                  offsetof(trace_entry_t, vals[numVals].val.indir.baseVal));
     }
 
     // Save value
-    reg_id_t index = reg_to_pointer_sized(opnd_get_index(opnd));
-    ensureNotUsing(cont, base, index);
-    bool validOpcode = instr_reads_memory(cont->nextInstr) && !isFar;
-    
+    bool validOpcode = instr_reads_memory(cont->nextInstr) && !isFar &&
+                       size != 0 && size <= MAX_VALUE_SIZE;
+
     loadValueImm(*cont, !validOpcode);
     storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.indir.valNull));
 
+    // Save address, including any index
+    if (isFar) {
+        return;
+    }
+
+    opnd = opnd_create_base_disp(base, index, opnd_get_scale(opnd), disp,
+                                 OPSZ_lea);
+    instrlist_meta_preinsert(cont->instrs, cont->nextInstr,
+        INSTR_CREATE_lea(cont->drcontext, opnd_create_reg(cont->regVal), opnd));
+    storeValue(*cont, offsetof(trace_entry_t, vals[numVals].val.indir.addr));
+
     if (validOpcode) {
-        opnd = opnd_create_base_disp(base, index, opnd_get_scale(opnd), disp, OPSZ_8);
-        loadValueOpnd(*cont, opnd);
-        storeReg(*cont, cont->regVal, 
-                 offsetof(trace_entry_t, vals[numVals].val.indir.val));
+        copyValue(cont, size,
+                  offsetof(trace_entry_t, vals[numVals].val.indir.bytes));
+    }
+}
+
+static void copyValue(add_instr_context_t *cont, uint size, int offset) {
+    if (size == 1 || size == 2 || size == 4 || size == 8) {
+        loadSized(*cont, cont->regVal, cont->regVal, 0, size);
+        storeValue(*cont, offset);
+        return;
+    }
+
+    reg_id_t regTmp;
+    drreg_reserve_register(cont->drcontext, cont->instrs, cont->nextInstr,
+                           NULL, &regTmp);
+
+    // Copy in the largest pieces that fit, without reading past the value
+    uint copied = 0;
+    while (copied < size) {
+        uint piece = 8;
+        while (piece > size - copied) {
+            piece /= 2;
+        }
+
+        loadSized(*cont, regTmp, cont->regVal, copied, piece);
+        storeSized(*cont, regTmp, offset + copied, piece);
+        copied += piece;
+    }
+
+    drreg_unreserve_register(cont->drcontext, cont->instrs, cont->nextInstr,
+                             regTmp);
+}
+
+static void loadSized(add_instr_context_t cont, reg_id_t dst, reg_id_t addr,
+                      int offset, uint size) {
+
+    opnd_t src = opnd_create_base_disp(addr, DR_REG_NULL, 0, offset,
+                                       bytesToSize(size));
+    instr_t *load;
+
+    // Loads into 32-bit registers zero the upper half
+    if (size == 8) {
+        load = XINST_CREATE_load(cont.drcontext, opnd_create_reg(dst), src);
+    } else if (size == 4) {
+        load = XINST_CREATE_load(cont.drcontext,
+            opnd_create_reg(reg_resize_to_opsz(dst, OPSZ_4)), src);
+    } else {
+        load = INSTR_CREATE_movzx(cont.drcontext,
+            opnd_create_reg(reg_resize_to_opsz(dst, OPSZ_4)), src);
+    }
+
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr, load);
+}
+
+static void storeSized(add_instr_context_t cont, reg_id_t reg, int offset,
+                       uint size) {
+
+    opnd_size_t opndSize = bytesToSize(size);
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr,
+        XINST_CREATE_store(cont.drcontext,
+            opnd_create_base_disp(cont.regDstAddr, DR_REG_NULL, 0, offset,
+                                  opndSize),
+            opnd_create_reg(reg_resize_to_opsz(reg, opndSize))));
+}
+
+static void storeSimdReg(add_instr_context_t cont, reg_id_t reg, int offset) {
+    instr_t *store;
+
+    if (reg_is_strictly_zmm(reg)) {
+        store = INSTR_CREATE_vmovdqu64(cont.drcontext,
+            opnd_create_base_disp(cont.regDstAddr, DR_REG_NULL, 0, offset,
+                                  OPSZ_64),
+            opnd_create_reg(DR_REG_K0), opnd_create_reg(reg));
+    } else if (reg_is_strictly_ymm(reg)) {
+        store = INSTR_CREATE_vmovdqu(cont.drcontext,
+            opnd_create_base_disp(cont.regDstAddr, DR_REG_NULL, 0, offset,
+                                  OPSZ_32),
+            opnd_create_reg(reg));
     } else {
+        store = INSTR_CREATE_movdqu(cont.drcontext,
+            opnd_create_base_disp(cont.regDstAddr, DR_REG_NULL, 0, offset,
+                                  OPSZ_16),
+            opnd_create_reg(reg));
+    }
+
+    instrlist_meta_preinsert(cont.instrs, cont.nextInstr, store);
+}
+
+static opnd_size_t bytesToSize(uint size) {
+    switch (size) {
+        case 1: return OPSZ_1;
+        case 2: return OPSZ_2;
+        case 4: return OPSZ_4;
+        default: return OPSZ_8;
     }
 }
 
+static uint64_t getIndirVariableId(instr_t *instr, opnd_t opnd) {
+    if (debugInfo == NULL || opnd_is_far_base_disp(opnd) ||
+        opnd_get_base(opnd) != DR_REG_RBP ||
+        opnd_get_index(opnd) != DR_REG_NULL) {
+
+        return VAR_ID_UNRESOLVED;
+    }
+
+    // RBP is only known to hold the frame base in functions of the main module
+    app_pc pc = instr_get_app_pc(instr);
+    if (getFunctionIndex(debugInfo, pc, mainSegmBase) < 0) {
+        return VAR_ID_UNRESOLVED;
+    }
+
+    // Locals are at a fixed offset from the frame base, a fixed offset from RBP
+    int frameOffset = opnd_get_disp(opnd) - FRAME_BASE_OFFSET;
+    return getLocalVariableId(debugInfo, pc, mainSegmBase, frameOffset);
+}
+
 static void ensureNotUsing(add_instr_context_t *cont, reg_id_t reg1,
                            reg_id_t reg2) {
 
@@ -406,7 +1145,7 @@ static void ensureNotUsing(add_instr_context_t *cont, reg_id_t reg1,
 
     // Only register non-null arguments
     if (reg_is_pointer_sized(reg1)) {
-        drreg_set_vector_entry(&allowedRegs, reg, false);
+        drreg_set_vector_entry(&allowedRegs, reg1, false);
     }
     if (reg_is_pointer_sized(reg2)) {
         drreg_set_vector_entry(&allowedRegs, reg2, false);
@@ -429,6 +1168,8 @@ static void ensureNotUsing(add_instr_context_t *cont, reg_id_t reg1,
         drreg_reserve_register(cont->drcontext, cont->instrs, cont->nextInstr,
                                &allowedRegs, &cont->regVal);
     }
+
+    drvector_delete(&allowedRegs);
 }
 
 static void move(add_instr_context_t cont, reg_id_t dst, reg_id_t src) {
@@ -455,15 +1196,25 @@ static void saveDirCall(app_pc instrAddr, app_pc targetAddr) {
     entry->pc = (uint64_t)instrAddr;
     entry->bp = 0;
 
+    uint64_t *pendingTsc = (uint64_t *)(threadData->segmBase + offset +
+                                        TIMESTAMP_SLOT);
+    entry->tsc = *pendingTsc;
+    *pendingTsc = 0;
+
     instr_t instr;
     instr_init(drcontext, &instr);
-    decode(drcontext, instrAddr, &instr);
+    app_pc nextAddr = decode(drcontext, instrAddr, &instr);
     entry->opcode = instr_get_opcode(&instr);
+    entry->branch = branchNone;
     instr_free(drcontext, &instr);
     entry->numVals = 1;
 
     entry->vals[0].type = target;
     createTargetOpnd(targetAddr, &entry->vals[0].val.target);
+
+    // Calls are not all 5 bytes long, such as those relaxed from GOT calls to
+    // addr32 calls with -fno-plt
+    entry->vals[0].val.target.returnPc = (uint64_t)nextAddr;
     
     (*(trace_entry_t**)(threadData->segmBase + offset))++;
 }
@@ -495,3 +1246,15 @@ static void createTargetOpnd(app_pc targetAddr, call_target_t *target) {
     dr_get_mcontext(drcontext, &mc);
     target->sp = (void *)reg_get_value(DR_REG_RSP, &mc);
 }
+
+static void reserveSpecificRegister(void *drcontext, instrlist_t *instrs,
+                                    instr_t *instr, reg_id_t reg) {
+
+    drvector_t allowedRegs;
+    drreg_init_and_fill_vector(&allowedRegs, false);
+    drreg_set_vector_entry(&allowedRegs, reg, true);
+
+    reg_id_t reserved;
+    drreg_reserve_register(drcontext, instrs, instr, &allowedRegs, &reserved);
+    drvector_delete(&allowedRegs);
+}
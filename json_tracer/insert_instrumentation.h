@@ -7,11 +7,13 @@
 #include "drreg.h"
 
 #include "trace_entry.h"
+#include "debug_info.h"
 
 /*
- * Initialises drreg
+ * Initialises drreg, resolving variables with the given debugging information
+ * of the main module starting at the given segment base
  */
-void instrContextInit();
+void instrContextInit(const debug_info_t *info, void *segmBase);
 
 /*
  * Exits drreg
@@ -19,9 +21,38 @@ void instrContextInit();
 void instrContextDeinit();
 
 /*
- * Inserts recording instrumentation before an instruction
+ * Inserts recording instrumentation before an instruction, only recording
+ * accesses to watched variables if there are any
  */
 void insertInstrumentation(void *drcontext, instrlist_t *instrs,
                            instr_t *instr, reg_id_t regSegmBase, uint offset);
 
+/*
+ * Inserts leaving the PC of an instruction for its writes to be compared
+ * against the last-seen values of watched variables and registers, if it may
+ * write to any of them
+ */
+void insertChangeInstrumentation(void *drcontext, instrlist_t *instrs,
+                                 instr_t *instr, reg_id_t regSegmBase,
+                                 uint offset);
+
+/*
+ * Returns whether an instruction may write to a watched variable or register
+ */
+int mayChangeWatched(instr_t *instr);
+
+/*
+ * Inserts a clean call to a function if a write is left pending
+ */
+void insertPendingCall(void *drcontext, instrlist_t *instrs, instr_t *instr,
+                       reg_id_t regSegmBase, uint offset, void *callee);
+
+/*
+ * Inserts reading a timestamp before an instruction into the pending
+ * timestamp, which is recorded by the next recorded entry, only every given
+ * number of times if the interval is above 1
+ */
+void insertTimestamp(void *drcontext, instrlist_t *instrs, instr_t *instr,
+                     reg_id_t regSegmBase, uint offset, uint64_t interval);
+
 #endif
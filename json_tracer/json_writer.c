@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 
 #include "dr_api.h"
@@ -6,11 +7,152 @@
 #include "drsyms.h"
 
 #include "json_writer.h"
+#include "options.h"
+#include "timestamps.h"
+#include "allocations.h"
+
+#define OPCODE_FRAGMENT_SIZE 80
+
+/*
+ * The opcode field of an entry for each opcode, formatted once
+ */
+static char opcodeFragments[OP_LAST][OPCODE_FRAGMENT_SIZE];
+static size_t opcodeFragmentLengths[OP_LAST];
+
+/*
+ * Generates a unique file handle, storing its path
+ */
+static file_t getUniqueHandle(const char *prefix, const char *suffix,
+                              char *path);
+
+/*
+ * Writes formatted output to the current chunk of a trace
+ */
+static void writeFormat(json_trace_t *traceFile, const char *format, ...);
+
+/*
+ * Writes a string of a given length
+ */
+static void writeChars(json_trace_t *traceFile, const char *chars,
+                       size_t length);
+
+/*
+ * Writes a null-terminated string
+ */
+static void writeString(json_trace_t *traceFile, const char *str);
+
+/*
+ * Writes an unsigned integer in decimal
+ */
+static void writeUnsigned(json_trace_t *traceFile, uint64_t val);
+
+/*
+ * Writes a signed integer in decimal
+ */
+static void writeSigned(json_trace_t *traceFile, int64_t val);
+
+/*
+ * Writes an integer as a quoted hexadecimal string prefixed by 0x
+ */
+static void writeHex(json_trace_t *traceFile, uint64_t val);
+
+/*
+ * Formats the opcode field of an entry for every opcode
+ */
+static void initOpcodeFragments();
+
+/*
+ * Writes the opcode field of an entry
+ */
+static void writeOpcode(json_trace_t *traceFile, int opcode);
+
+/*
+ * Returns whether chunks of a trace are limited in size
+ */
+static int rotationEnabled();
+
+/*
+ * Opens a new chunk file for a trace
+ */
+static void openChunk(json_trace_t *traceFile);
+
+/*
+ * Closes the current chunk file of a trace
+ */
+static void closeChunk(json_trace_t *traceFile);
+
+/*
+ * Appends an entry for a new chunk to the chunks of a trace
+ */
+static void appendChunk(json_trace_t *traceFile);
+
+/*
+ * Deletes the oldest chunks of a trace beyond the number to keep
+ */
+static void removeOldChunks(json_trace_t *traceFile);
+
+/*
+ * Returns whether trace files are indexed
+ */
+static int indexEnabled();
 
 /*
- * Generates a unique file handle
+ * Gets the path of the index of a trace file
  */
-static file_t getUniqueHandle();
+static void getIndexPath(const char *path, char *indexPath);
+
+/*
+ * Widens the range of PCs of the entries in the current index block
+ */
+static void indexPc(json_trace_t *traceFile, uint64_t pc);
+
+/*
+ * Writes the record of the current index block to the index file
+ */
+static void writeIndexRecord(json_trace_t *traceFile);
+
+/*
+ * Writes the manifest listing the kept chunks of a trace
+ */
+static void writeManifest(json_trace_t *traceFile);
+
+/*
+ * Writes the header of a chunk, giving the timestamp frequency and, for
+ * offline symbolization, the main module
+ */
+static void writeHeader(json_trace_t *traceFile);
+
+/*
+ * Starts a new entry, moving to a new chunk if the current one is full
+ */
+static void beginEntry(json_trace_t *traceFile);
+
+/*
+ * Finishes an entry, counting the given number of instructions
+ */
+static void endEntry(json_trace_t *traceFile, uint64_t instrs);
+
+/*
+ * Writes the object for a trace entry
+ */
+static void writeEntry(json_trace_t *traceFile, trace_entry_t entry);
+
+/*
+ * Writes the source file and line of a PC within a module, if known
+ */
+static void writeSourceLine(json_trace_t *traceFile,
+                            const module_range_t *module, uint64_t pc);
+
+/*
+ * Writes the object for a change to a watched variable or register
+ */
+static void writeChange(json_trace_t *traceFile, value_change_t change);
+
+/*
+ * Writes a system call record
+ */
+static void writeSyscallRecord(json_trace_t *traceFile,
+                               syscall_record_t record);
 
 /*
  * Writes an operand entry
@@ -47,52 +189,554 @@ static void writeTarget(json_trace_t *traceFile, call_target_t target);
  */
 static void writeNullOpnd(json_trace_t *traceFile);
 
+/*
+ * Writes a value of a given size, or null if the size is too large
+ */
+static void writeValue(json_trace_t *traceFile, const uint8_t *bytes,
+                       uint64_t size);
+
+/*
+ * Writes the variable accessed by a memory operand at a given address, if
+ * any, using its ID if resolved when instrumenting
+ */
+static void writeOpndVar(json_trace_t *traceFile, uint64_t varId,
+                         uint64_t addr);
+
+/*
+ * Writes the live heap allocation containing the address accessed by a memory
+ * operand, if heap tracking is enabled and there is one
+ */
+static void writeOpndAllocation(json_trace_t *traceFile, uint64_t addr);
+
 /*
  * Writes information for an identified variable
  */
 static void writeVar(json_trace_t *traceFile, variable_info_t varInfo);
 
-json_trace_t createTraceFile(int interleaved) {
+json_trace_t createTraceFile(int interleaved, thread_id_t tid,
+                             const debug_info_t *info) {
     json_trace_t traceFile;
-    traceFile.fileHandle = getUniqueHandle();
-    traceFile.file = fdopen(traceFile.fileHandle, "w");
-    traceFile.firstLine = true;
+    traceFile.interleaved = interleaved;
+    traceFile.tid = tid;
+    traceFile.entries = 0;
+    traceFile.bytes = 0;
+    traceFile.chunks = NULL;
+    traceFile.sizeChunks = 0;
+    traceFile.capacityChunks = 0;
+    traceFile.nextChunk = 0;
+    traceFile.manifestPath[0] = '\0';
+    traceFile.indexFile = INVALID_FILE;
+    traceFile.indexEntries = 0;
+    traceFile.symbolTicks = 0;
+    traceFile.heapSince = UINT64_MAX;
+    traceFile.info = info;
+    traceFile.lastFunc = -1;
+    initModuleCache(&traceFile.moduleCache);
+
+    // The interleaved trace is created before any thread's trace
+    if (opcodeFragmentLengths[OP_INVALID] == 0) {
+        initOpcodeFragments();
+    }
 
     module_data_t *mainModule = dr_get_main_module();
-    traceFile.info = getDebugInfo(mainModule->full_path);
     traceFile.segmBase = mainModule->start;
     dr_free_module_data(mainModule);
-    
-    fprintf(traceFile.file, "[\n");
+
+    if (rotationEnabled()) {
+        file_t manifest = getUniqueHandle("manifest", "json",
+                                          traceFile.manifestPath);
+        dr_close_file(manifest);
+    }
+
+    openChunk(&traceFile);
 
     return traceFile;
 }
 
 void destroyTraceFile(json_trace_t traceFile) {
-    fprintf(traceFile.file, "\n]");
+    closeChunk(&traceFile);
 
-    destroyDebugInfo(traceFile.info);
-
-    if (traceFile.file != NULL) {
-        fclose(traceFile.file);
+    if (rotationEnabled()) {
+        writeManifest(&traceFile);
     }
+
+    dr_global_free(traceFile.chunks,
+                   sizeof(trace_chunk_t) * traceFile.capacityChunks);
 }
 
 void writeInterleavedTraceEntry(json_trace_t *traceFile, thread_id_t tid, trace_entry_t entry) {
-    fprintf(traceFile->file,
-            "%s{\"tid\": %i, \"entry\": ",
-            traceFile->firstLine ? "" : ",\n",
-            tid);
+    beginEntry(traceFile);
+    writeString(traceFile, "{\"tid\": ");
+    writeSigned(traceFile, tid);
+    writeString(traceFile, ", \"entry\": ");
+    writeEntry(traceFile, entry);
+    writeString(traceFile, "}");
+    endEntry(traceFile, 1);
+}
+
+void writeTraceEntry(json_trace_t *traceFile, trace_entry_t entry) {
+    beginEntry(traceFile);
+    writeEntry(traceFile, entry);
+    endEntry(traceFile, 1);
+}
+
+void writeInterleavedLossMarker(json_trace_t *traceFile, thread_id_t tid,
+                                uint64_t buffers, uint64_t entries) {
+    beginEntry(traceFile);
+    writeFormat(traceFile,
+                "{\"tid\": %i, \"lost\": {\"buffers\": %lu, \"entries\": %lu}}",
+                tid, buffers, entries);
+    endEntry(traceFile, entries);
+}
+
+void writeLossMarker(json_trace_t *traceFile, uint64_t buffers,
+                     uint64_t entries) {
+    beginEntry(traceFile);
+    writeFormat(traceFile,
+                "{\"lost\": {\"buffers\": %lu, \"entries\": %lu}}",
+                buffers, entries);
+    endEntry(traceFile, entries);
+}
+
+void writeInterleavedValueChange(json_trace_t *traceFile, thread_id_t tid,
+                                 value_change_t change) {
+    beginEntry(traceFile);
+    writeString(traceFile, "{\"tid\": ");
+    writeSigned(traceFile, tid);
+    writeString(traceFile, ", \"entry\": ");
+    writeChange(traceFile, change);
+    writeString(traceFile, "}");
+    endEntry(traceFile, 1);
+}
+
+void writeValueChange(json_trace_t *traceFile, value_change_t change) {
+    beginEntry(traceFile);
+    writeChange(traceFile, change);
+    endEntry(traceFile, 1);
+}
+
+void writeInterleavedSyscall(json_trace_t *traceFile, thread_id_t tid,
+                             syscall_record_t record) {
+    beginEntry(traceFile);
+    writeFormat(traceFile, "{\"tid\": %i, ", tid);
+    writeSyscallRecord(traceFile, record);
+    writeFormat(traceFile, "}");
+    endEntry(traceFile, 0);
+}
+
+void writeSyscall(json_trace_t *traceFile, syscall_record_t record) {
+    beginEntry(traceFile);
+    writeFormat(traceFile, "{");
+    writeSyscallRecord(traceFile, record);
+    writeFormat(traceFile, "}");
+    endEntry(traceFile, 0);
+}
+
+static file_t getUniqueHandle(const char *prefix, const char *suffix,
+                              char *path) {
+    return drx_open_unique_file("./", prefix, suffix,
+                                DR_FILE_ALLOW_LARGE | outputFileFlags(),
+                                path, MAXIMUM_PATH);
+}
+
+static void writeFormat(json_trace_t *traceFile, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = outputFormat(&traceFile->output, format, args);
+    va_end(args);
+
+    if (written > 0) {
+        traceFile->bytes += written;
+        traceFile->chunkBytes += written;
+    }
+}
 
+static void writeChars(json_trace_t *traceFile, const char *chars,
+                       size_t length) {
+    int written = outputBytes(&traceFile->output, chars, length);
+    traceFile->bytes += written;
+    traceFile->chunkBytes += written;
+}
+
+static void writeString(json_trace_t *traceFile, const char *str) {
+    writeChars(traceFile, str, strlen(str));
+}
+
+static void writeUnsigned(json_trace_t *traceFile, uint64_t val) {
+    char digits[20];
+    char *start = digits + sizeof(digits);
+
+    do {
+        *--start = '0' + val % 10;
+        val /= 10;
+    } while (val != 0);
+
+    writeChars(traceFile, start, digits + sizeof(digits) - start);
+}
+
+static void writeSigned(json_trace_t *traceFile, int64_t val) {
+    if (val < 0) {
+        writeChars(traceFile, "-", 1);
+        writeUnsigned(traceFile, -(uint64_t)val);
+    } else {
+        writeUnsigned(traceFile, val);
+    }
+}
+
+static void writeHex(json_trace_t *traceFile, uint64_t val) {
+    static const char hexDigits[] = "0123456789abcdef";
+    char chars[20];
+    char *start = chars + sizeof(chars);
+
+    *--start = '"';
+    do {
+        *--start = hexDigits[val & 0xf];
+        val >>= 4;
+    } while (val != 0);
+    *--start = 'x';
+    *--start = '0';
+    *--start = '"';
+
+    writeChars(traceFile, start, chars + sizeof(chars) - start);
+}
+
+static void initOpcodeFragments() {
+    for (int opcode = 0; opcode < OP_LAST; opcode++) {
+        int length = dr_snprintf(opcodeFragments[opcode], OPCODE_FRAGMENT_SIZE,
+                                 "\"opcode\": {\"value\": %d, "
+                                 "\"name\": \"%s\"}, ",
+                                 opcode, decode_opcode_name(opcode));
+        opcodeFragmentLengths[opcode] = length > 0 ? length : 0;
+    }
+}
+
+static void writeOpcode(json_trace_t *traceFile, int opcode) {
+    if (opcode >= 0 && opcode < OP_LAST && opcodeFragmentLengths[opcode] != 0) {
+        writeChars(traceFile, opcodeFragments[opcode],
+                   opcodeFragmentLengths[opcode]);
+    } else {
+        writeFormat(traceFile,
+                    "\"opcode\": {\"value\": %d, \"name\": \"%s\"}, ",
+                    opcode, decode_opcode_name(opcode));
+    }
+}
+
+static int rotationEnabled() {
+    return options.chunkBytes != 0 || options.chunkEntries != 0;
+}
+
+static void openChunk(json_trace_t *traceFile) {
+    appendChunk(traceFile);
+    trace_chunk_t *chunk = &traceFile->chunks[traceFile->sizeChunks - 1];
+
+    file_t handle = getUniqueHandle("trace", "log", chunk->path);
+    traceFile->output = openOutput(handle);
     traceFile->firstLine = true;
-    writeTraceEntry(traceFile, entry);
+    traceFile->chunkEntries = 0;
+    traceFile->chunkBytes = 0;
+
+    if (!options.ndjson) {
+        writeFormat(traceFile, "[\n");
+    }
+
+    if (options.timestampInterval != 0 || options.syscalls ||
+        options.offline) {
+
+        writeHeader(traceFile);
+    }
+
+    if (indexEnabled()) {
+        char indexPath[MAXIMUM_PATH];
+        getIndexPath(chunk->path, indexPath);
+        traceFile->indexFile = dr_open_file(indexPath,
+                                            DR_FILE_WRITE_OVERWRITE);
+        traceFile->indexEntries = 0;
+    }
+}
+
+static void closeChunk(json_trace_t *traceFile) {
+    if (!options.ndjson) {
+        writeFormat(traceFile, "\n]");
+    }
+    closeOutput(&traceFile->output);
+
+    if (traceFile->indexFile != INVALID_FILE) {
+        if (traceFile->indexEntries != 0) {
+            writeIndexRecord(traceFile);
+        }
+        dr_close_file(traceFile->indexFile);
+        traceFile->indexFile = INVALID_FILE;
+    }
+
+    trace_chunk_t *chunk = &traceFile->chunks[traceFile->sizeChunks - 1];
+    chunk->lastEntry = traceFile->entries;
+}
+
+static void appendChunk(json_trace_t *traceFile) {
+    if (traceFile->sizeChunks == traceFile->capacityChunks) {
+        int capacity = traceFile->capacityChunks == 0
+                       ? 16 : traceFile->capacityChunks * 2;
+        trace_chunk_t *chunks = dr_global_alloc(sizeof(trace_chunk_t) * capacity);
+
+        if (traceFile->chunks != NULL) {
+            memcpy(chunks, traceFile->chunks,
+                   sizeof(trace_chunk_t) * traceFile->sizeChunks);
+            dr_global_free(traceFile->chunks,
+                           sizeof(trace_chunk_t) * traceFile->capacityChunks);
+        }
+
+        traceFile->chunks = chunks;
+        traceFile->capacityChunks = capacity;
+    }
+
+    trace_chunk_t *chunk = &traceFile->chunks[traceFile->sizeChunks++];
+    chunk->index = traceFile->nextChunk++;
+    chunk->firstEntry = traceFile->entries;
+    chunk->lastEntry = traceFile->entries;
+}
+
+static void removeOldChunks(json_trace_t *traceFile) {
+    if (options.keepChunks <= 0 || traceFile->sizeChunks <= options.keepChunks) {
+        return;
+    }
+
+    int numRemoved = traceFile->sizeChunks - options.keepChunks;
+    for (int i = 0; i < numRemoved; i++) {
+        dr_delete_file(traceFile->chunks[i].path);
+
+        if (indexEnabled()) {
+            char indexPath[MAXIMUM_PATH];
+            getIndexPath(traceFile->chunks[i].path, indexPath);
+            dr_delete_file(indexPath);
+        }
+    }
+
+    memmove(traceFile->chunks, traceFile->chunks + numRemoved,
+            sizeof(trace_chunk_t) * options.keepChunks);
+    traceFile->sizeChunks = options.keepChunks;
+}
+
+static void writeManifest(json_trace_t *traceFile) {
+    file_t handle = dr_open_file(traceFile->manifestPath,
+                                 DR_FILE_WRITE_OVERWRITE);
+    if (handle == INVALID_FILE) {
+        return;
+    }
+
+    FILE *manifest = fdopen(handle, "w");
+    if (traceFile->interleaved) {
+        fprintf(manifest, "{\"thread\": null, \"interleaved\": true, ");
+    } else {
+        fprintf(manifest, "{\"thread\": %i, \"interleaved\": false, ",
+                traceFile->tid);
+    }
+
+    fprintf(manifest, "\"chunks\": [");
+    for (int i = 0; i < traceFile->sizeChunks; i++) {
+        trace_chunk_t chunk = traceFile->chunks[i];
+        fprintf(manifest,
+                "%s\n{\"index\": %i, \"file\": \"%s\", "
+                "\"firstEntry\": %lu, \"numEntries\": %lu}",
+                i == 0 ? "" : ",", chunk.index, chunk.path,
+                chunk.firstEntry, chunk.lastEntry - chunk.firstEntry);
+    }
+    fprintf(manifest, "\n]}\n");
+
+    fclose(manifest);
+}
+
+static void writeHeader(json_trace_t *traceFile) {
+    writeFormat(traceFile, "{\"header\": {");
+
+    int timed = options.timestampInterval != 0 || options.syscalls;
+    if (timed) {
+        writeFormat(traceFile, "\"tscFrequency\": %lu, \"timestamps\": %lu",
+                    tscFrequency, options.timestampInterval);
+    }
+
+    if (options.offline) {
+        module_data_t *mainModule = dr_get_main_module();
+        writeFormat(traceFile,
+                    "%s\"module\": {\"path\": \"%s\", \"start\": \"0x%lx\"}",
+                    timed ? ", " : "", mainModule->full_path,
+                    (uint64_t)mainModule->start);
+        dr_free_module_data(mainModule);
+    }
+
+    writeFormat(traceFile, "}}%s", options.ndjson ? "\n" : "");
     traceFile->firstLine = false;
-    fprintf(traceFile->file, "}");
 }
 
-void writeTraceEntry(json_trace_t *traceFile, trace_entry_t entry) {
-    module_data_t *module = dr_lookup_module((byte *)entry.pc);
-    size_t offset = (void *)entry.pc - (void *)module->start;
+static void beginEntry(json_trace_t *traceFile) {
+    if ((options.chunkEntries != 0 &&
+         traceFile->chunkEntries >= options.chunkEntries) ||
+        (options.chunkBytes != 0 &&
+         traceFile->chunkBytes >= options.chunkBytes)) {
+
+        closeChunk(traceFile);
+        openChunk(traceFile);
+        removeOldChunks(traceFile);
+        writeManifest(traceFile);
+    }
+
+    // Lines of ndjson are ended rather than separated
+    if (!traceFile->firstLine && !options.ndjson) {
+        writeChars(traceFile, ",\n", 2);
+    }
+    traceFile->firstLine = false;
+
+    if (traceFile->indexFile != INVALID_FILE &&
+        traceFile->indexEntries == 0) {
+
+        traceFile->indexOffset = traceFile->chunkBytes;
+        traceFile->indexFirstEntry = traceFile->entries;
+        traceFile->indexMinPc = UINT64_MAX;
+        traceFile->indexMaxPc = 0;
+    }
+}
+
+static void endEntry(json_trace_t *traceFile, uint64_t instrs) {
+    if (options.ndjson) {
+        writeChars(traceFile, "\n", 1);
+    }
+
+    traceFile->entries += instrs;
+    traceFile->chunkEntries++;
+
+    if (traceFile->indexFile != INVALID_FILE &&
+        ++traceFile->indexEntries == options.indexInterval) {
+        writeIndexRecord(traceFile);
+    }
+}
+
+static int indexEnabled() {
+    return options.ndjson && options.indexInterval != 0;
+}
+
+static void getIndexPath(const char *path, char *indexPath) {
+    dr_snprintf(indexPath, MAXIMUM_PATH, "%s.idx", path);
+    indexPath[MAXIMUM_PATH - 1] = '\0';
+}
+
+static void indexPc(json_trace_t *traceFile, uint64_t pc) {
+    if (pc < traceFile->indexMinPc) {
+        traceFile->indexMinPc = pc;
+    }
+    if (pc > traceFile->indexMaxPc) {
+        traceFile->indexMaxPc = pc;
+    }
+}
+
+static void writeIndexRecord(json_trace_t *traceFile) {
+    char thread[16], pcs[64];
+    if (traceFile->interleaved) {
+        dr_snprintf(thread, sizeof(thread), "null");
+    } else {
+        dr_snprintf(thread, sizeof(thread), "%d", traceFile->tid);
+    }
+
+    if (traceFile->indexMinPc > traceFile->indexMaxPc) {
+        dr_snprintf(pcs, sizeof(pcs), "\"minPc\": null, \"maxPc\": null");
+    } else {
+        dr_snprintf(pcs, sizeof(pcs), "\"minPc\": \"0x%lx\", \"maxPc\": \"0x%lx\"",
+                    traceFile->indexMinPc, traceFile->indexMaxPc);
+    }
+
+    char record[256];
+    int length = dr_snprintf(record, sizeof(record),
+                             "{\"offset\": %lu, \"entries\": %lu, "
+                             "\"thread\": %s, \"firstInstr\": %lu, %s}\n",
+                             traceFile->indexOffset, traceFile->indexEntries,
+                             thread, traceFile->indexFirstEntry, pcs);
+    if (length > 0) {
+        dr_write_file(traceFile->indexFile, record, length);
+    }
+
+    traceFile->indexEntries = 0;
+}
+
+static void writeEntry(json_trace_t *traceFile, trace_entry_t entry) {
+    const module_range_t *module = findModule(&traceFile->moduleCache,
+                                              entry.pc);
+    if (traceFile->indexFile != INVALID_FILE) {
+        indexPc(traceFile, entry.pc);
+    }
+
+    writeString(traceFile, "{\"pc\": ");
+    writeHex(traceFile, entry.pc);
+    writeString(traceFile, ", ");
+    writeOpcode(traceFile, (int)entry.opcode);
+
+    if (entry.tsc != 0) {
+        writeString(traceFile, "\"timestamp\": ");
+        writeUnsigned(traceFile, entry.tsc);
+        writeString(traceFile, ", ");
+    }
+
+    if (options.branches && entry.branch != branchNone) {
+        writeString(traceFile, entry.branch == branchTaken ?
+                               "\"taken\": true, " : "\"taken\": false, ");
+    }
+
+    writeSourceLine(traceFile, module, entry.pc);
+
+    if (module != NULL && module->isMain) {
+        traceFile->pc = (void *)entry.pc;
+        traceFile->sp = (void *)entry.bp + FRAME_BASE_OFFSET;
+
+        // Locals are found offline from the frame base
+        if (options.offline) {
+            writeString(traceFile, "\"frame\": ");
+            writeHex(traceFile, (uint64_t)traceFile->sp);
+            writeString(traceFile, ", ");
+        }
+    }
+
+    writeString(traceFile, "\"operands\": [");
+
+    for (int i = 0; i < entry.numVals; i++) {
+        if (i != 0) {
+            writeString(traceFile, ", ");
+        }
+
+        writeOpnd(traceFile, entry.vals[i]);
+    }
+
+    writeString(traceFile, "]}");
+}
+
+static void writeSourceLine(json_trace_t *traceFile,
+                            const module_range_t *module, uint64_t pc) {
+
+    if (options.offline) {
+        return;
+    }
+
+    if (module == NULL) {
+        return;
+    }
+
+    // Modules with a loaded line table avoid the general symbol lookup
+    const char *lineFile;
+    unsigned lineNo;
+    uint64_t start = readTimestamp();
+    int res = module->lines == NULL ||
+              getSourceLine(module->lines, (void *)pc, module->start,
+                            &lineFile, &lineNo);
+    traceFile->symbolTicks += readTimestamp() - start;
+
+    if (res == 0) {
+        if (lineFile[0] == '/') {
+            writeString(traceFile, "\"file\": \"");
+            writeString(traceFile, lineFile);
+            writeString(traceFile, "\", \"line\": ");
+            writeUnsigned(traceFile, lineNo);
+            writeString(traceFile, ", ");
+        }
+        return;
+    }
+
+    size_t offset = (void *)pc - (void *)module->start;
 
     drsym_info_t info;
     char name[512], file[512];
@@ -103,47 +747,91 @@ void writeTraceEntry(json_trace_t *traceFile, trace_entry_t entry) {
     info.file = file;
     info.file_size = sizeof(file);
     info.file_available_size = sizeof(file);
+    start = readTimestamp();
     drsym_error_t err;
-    err = drsym_lookup_address(module->full_path, offset, &info, DRSYM_DEFAULT_FLAGS);
-
-    fprintf(traceFile->file,
-            "%s{\"pc\": \"0x%lx\", \"opcode\": {\"value\": %d, \"name\": \"%s\"}, ",
-            traceFile->firstLine ? "" : ",\n", entry.pc,
-            (int)entry.opcode, decode_opcode_name((int)entry.opcode));
+    err = drsym_lookup_address(module->path, offset, &info, DRSYM_DEFAULT_FLAGS);
+    traceFile->symbolTicks += readTimestamp() - start;
 
     if (err == DRSYM_SUCCESS && info.file_available_size > 0 && file[0] == '/') {
-        fprintf(traceFile->file, "\"file\": \"%s\", \"line\": %li, ", file, info.line);
+        writeString(traceFile, "\"file\": \"");
+        writeString(traceFile, file);
+        writeString(traceFile, "\", \"line\": ");
+        writeSigned(traceFile, (int64_t)info.line);
+        writeString(traceFile, ", ");
     }
+}
 
-    fprintf(traceFile->file, "\"operands\": [");
-    module_data_t *mainModule = dr_get_main_module();
-    if (strcmp(module->full_path, mainModule->full_path) == 0) {
-        traceFile->pc = (void *)entry.pc;
-        traceFile->sp = (void *)entry.bp + 0x10;
+static void writeChange(json_trace_t *traceFile, value_change_t change) {
+    if (traceFile->indexFile != INVALID_FILE) {
+        indexPc(traceFile, change.pc);
     }
-    dr_free_module_data(mainModule);
-    dr_free_module_data(module);
 
-    traceFile->firstLine = false;
+    writeString(traceFile, "{\"pc\": ");
+    writeHex(traceFile, change.pc);
+    writeString(traceFile, ", ");
 
-    for (int i = 0; i < entry.numVals; i++) {
-        if (i != 0) {
-            fprintf(traceFile->file, ", ");
+    if (change.tsc != 0) {
+        writeString(traceFile, "\"timestamp\": ");
+        writeUnsigned(traceFile, change.tsc);
+        writeString(traceFile, ", ");
+    }
+
+    writeSourceLine(traceFile, findModule(&traceFile->moduleCache, change.pc),
+                    change.pc);
+
+    if (change.isReg) {
+        writeString(traceFile, "\"change\": {\"register\": \"");
+        writeString(traceFile, (char *)change.regName);
+        writeString(traceFile, "\", ");
+    } else {
+        writeString(traceFile, "\"change\": {\"address\": ");
+        writeHex(traceFile, change.addr);
+        writeString(traceFile, ", ");
+
+        if (traceFile->info != NULL && change.varId != VAR_ID_NONE) {
+            writeString(traceFile, "\"variable\": ");
+            writeVar(traceFile, getVariableById(traceFile->info, change.varId));
+            writeString(traceFile, ", \"offset\": ");
+            writeUnsigned(traceFile, change.offset);
+            writeString(traceFile, ", ");
         }
+    }
 
-        writeOpnd(traceFile, entry.vals[i]);
+    writeString(traceFile, "\"size\": ");
+    writeUnsigned(traceFile, change.size);
+    writeString(traceFile, ", \"old\": ");
+    if (change.oldNull) {
+        writeString(traceFile, "null");
+    } else {
+        writeValue(traceFile, change.oldBytes, change.size);
     }
 
-    fprintf(traceFile->file, "]}");
+    writeString(traceFile, ", \"new\": ");
+    writeValue(traceFile, change.newBytes, change.size);
+    writeString(traceFile, "}}");
 }
 
-static file_t getUniqueHandle() {
-    return drx_open_unique_file("./", "trace", "log",
-                                DR_FILE_ALLOW_LARGE, NULL, 0);
+static void writeSyscallRecord(json_trace_t *traceFile,
+                               syscall_record_t record) {
+    writeFormat(traceFile, "\"syscall\": {\"number\": %lu, ", record.number);
+
+    if (record.hasFd) {
+        writeFormat(traceFile, "\"fd\": %li, ", (int64_t)record.fd);
+    }
+
+    if (record.hasSize) {
+        writeFormat(traceFile, "\"size\": %lu, ", record.size);
+    }
+
+    writeFormat(traceFile,
+                "\"result\": %li, \"timestamp\": %lu, \"duration\": %lu, "
+                "\"instr\": %lu}",
+                record.result, record.start, record.duration, record.instrs);
 }
 
 static void writeOpnd(json_trace_t *traceFile, operand_value_t opndVal) {
-    fprintf(traceFile->file, "{\"isSrc\": %s", opndVal.isSrc ? "true" : "false");
+    writeString(traceFile, opndVal.isSrc ? "{\"isSrc\": true"
+                                         : "{\"isSrc\": false");
 
     switch (opndVal.type) {
         case (uint64_t)reg:
@@ -173,96 +861,194 @@ static void writeOpnd(json_trace_t *traceFile, operand_value_t opndVal) {
 }
 
 static void writeReg(json_trace_t *traceFile, register_value_t regVal) {
-    fprintf(traceFile->file, 
-            ", \"type\": \"register\", \"name\": \"%s\", \"value\": \"0x%lx\"}",
-            (char *)regVal.name,
-            regVal.val);
+    writeString(traceFile, ", \"type\": \"register\", \"name\": \"");
+    writeString(traceFile, (char *)regVal.name);
+    writeString(traceFile, "\", \"size\": ");
+    writeUnsigned(traceFile, regVal.size);
+    writeString(traceFile, ", \"value\": ");
+
+    if (regVal.valNull) {
+        writeString(traceFile, "null");
+    } else {
+        writeValue(traceFile, regVal.bytes + regVal.shift / 8, regVal.size);
+    }
+
+    writeString(traceFile, "}");
 }
 
 static void writeImm(json_trace_t *traceFile, immediate_value_t immVal) {
-    fprintf(traceFile->file,
-            ", \"type\": \"immediate\", \"value\": \"0x%lx\"}",
-            immVal.val);
+    writeString(traceFile, ", \"type\": \"immediate\", \"size\": ");
+    writeUnsigned(traceFile, immVal.size);
+    writeString(traceFile, ", \"value\": ");
+    writeHex(traceFile, immVal.val);
+    writeString(traceFile, "}");
 }
 
 static void writeMem(json_trace_t *traceFile, memory_value_t memVal) {
-    fprintf(traceFile->file,
-            ", \"type\": \"memory\", \"distance\": \"%s\", "
-            "\"address\": \"0x%lx\", \"value\": \"0x%lx\"",
-            memVal.isFar ? "far" : "near",
-            memVal.addr,
-            memVal.val);
-
-    if (traceFile->info != NULL) {
-        variable_info_t varInfo = getVariableInfo(traceFile->info,
-            (void *)memVal.addr, traceFile->pc, traceFile->segmBase,
-            traceFile->sp);
-        if (varInfo.varName != NULL) {
-            fprintf(traceFile->file, ", \"variable\": ");
-            writeVar(traceFile, varInfo);
-        }
+    writeString(traceFile, memVal.isFar ?
+            ", \"type\": \"memory\", \"distance\": \"far\", \"address\": " :
+            ", \"type\": \"memory\", \"distance\": \"near\", \"address\": ");
+    writeHex(traceFile, memVal.addr);
+    writeString(traceFile, ", \"size\": ");
+    writeUnsigned(traceFile, memVal.size);
+    writeString(traceFile, ", \"value\": ");
+
+    if (memVal.valNull) {
+        writeString(traceFile, "null");
+    } else {
+        writeValue(traceFile, memVal.bytes, memVal.size);
     }
 
-    fprintf(traceFile->file, "}");
+    writeOpndVar(traceFile, memVal.varId, memVal.addr);
+    writeOpndAllocation(traceFile, memVal.addr);
+
+    writeString(traceFile, "}");
 }
 
 static void writeIndir(json_trace_t *traceFile, indirect_value_t indirVal) {
-    fprintf(traceFile->file,
-            ", \"type\": \"indirect\", \"distance\": \"%s\", ",
-            indirVal.isFar ? "far" : "near");
+    writeString(traceFile, indirVal.isFar ?
+            ", \"type\": \"indirect\", \"distance\": \"far\", " :
+            ", \"type\": \"indirect\", \"distance\": \"near\", ");
 
     if (indirVal.baseNull) {
-        fprintf(traceFile->file, "\"base\": null, \"baseValue\": null, ");
+        writeString(traceFile, "\"base\": null, \"baseValue\": null, ");
         indirVal.baseVal = 0;
     } else {
-        fprintf(traceFile->file,
-                "\"base\": \"%s\", \"baseValue\": \"0x%lx\", ",
-                (char *)indirVal.baseName,
-                indirVal.baseVal);
+        writeString(traceFile, "\"base\": \"");
+        writeString(traceFile, (char *)indirVal.baseName);
+        writeString(traceFile, "\", \"baseValue\": ");
+        writeHex(traceFile, indirVal.baseVal);
+        writeString(traceFile, ", ");
     }
 
-    uint64_t addr = indirVal.baseVal + indirVal.disp;
-    fprintf(traceFile->file,
-            "\"offset\": \"0x%lx\", \"address\":\"0x%lx\", ",
-            indirVal.disp, addr);
-    
+    uint64_t addr = indirVal.isFar ? indirVal.baseVal + indirVal.disp
+                                   : indirVal.addr;
+    writeString(traceFile, "\"offset\": ");
+    writeHex(traceFile, indirVal.disp);
+    writeString(traceFile, ", \"address\":");
+    writeHex(traceFile, addr);
+    writeString(traceFile, ", \"size\": ");
+    writeUnsigned(traceFile, indirVal.size);
+    writeString(traceFile, ", ");
+
     if(indirVal.valNull) {
-        fprintf(traceFile->file, "\"value\": null");
+        writeString(traceFile, "\"value\": null");
     } else {
-        fprintf(traceFile->file,
-                "\"value\": \"0x%lx\"",
-                indirVal.val);
+        writeString(traceFile, "\"value\": ");
+        writeValue(traceFile, indirVal.bytes, indirVal.size);
     }
 
 
-    if (traceFile->info != NULL) {
-        variable_info_t varInfo = getVariableInfo(traceFile->info,
-            (void *)addr, traceFile->pc, traceFile->segmBase,
-            traceFile->sp);
-        if (varInfo.varName != NULL) {
-            fprintf(traceFile->file, ", \"variable\": ");
-            writeVar(traceFile, varInfo);
-        }
-    }
+    writeOpndVar(traceFile, indirVal.varId, addr);
+    writeOpndAllocation(traceFile, addr);
 
-    fprintf(traceFile->file, "}");
+    writeString(traceFile, "}");
 }
 
 static void writeTarget(json_trace_t *traceFile, call_target_t target) {
-    fprintf(traceFile->file, ", \"type\": \"target\", \"pc\": \"0x%lx\", "
-            "\"name\": \"%s\"}", target.pc, target.name);
+    writeString(traceFile, ", \"type\": \"target\", \"pc\": ");
+    writeHex(traceFile, target.pc);
+    writeString(traceFile, ", \"return\": ");
+    writeHex(traceFile, target.returnPc);
+    writeString(traceFile, ", \"name\": \"");
+    writeString(traceFile, target.name);
+    writeString(traceFile, "\"}");
 }
 
 static void writeNullOpnd(json_trace_t *traceFile) {
-    fprintf(traceFile->file, ", \"type\": null}");
+    writeString(traceFile, ", \"type\": null}");
+}
+
+static void writeValue(json_trace_t *traceFile, const uint8_t *bytes,
+                       uint64_t size) {
+
+    if (size <= sizeof(uint64_t)) {
+        uint64_t val = 0;
+        memcpy(&val, bytes, size);
+        writeHex(traceFile, val);
+        return;
+    }
+
+    // Write wider values most significant byte first
+    static const char hexDigits[] = "0123456789abcdef";
+    char chars[2 * MAX_VALUE_SIZE + 4];
+    size_t length = 0;
+    chars[length++] = '"';
+    chars[length++] = '0';
+    chars[length++] = 'x';
+    for (uint64_t i = size; i > 0; i--) {
+        chars[length++] = hexDigits[bytes[i - 1] >> 4];
+        chars[length++] = hexDigits[bytes[i - 1] & 0xf];
+    }
+    chars[length++] = '"';
+    writeChars(traceFile, chars, length);
+}
+
+static void writeOpndVar(json_trace_t *traceFile, uint64_t varId,
+                         uint64_t addr) {
+
+    if (traceFile->info == NULL) {
+        return;
+    }
+
+    uint64_t start = readTimestamp();
+    variable_info_t varInfo;
+    if (varId == VAR_ID_NONE) {
+        varInfo.varName = NULL;
+    } else if (varId != VAR_ID_UNRESOLVED) {
+        varInfo = getVariableById(traceFile->info, varId);
+    } else if (options.offline) {
+        varInfo.varName = NULL;
+    } else {
+        varInfo = getVariableInfo(traceFile->info, (void *)addr, traceFile->pc,
+                                  traceFile->segmBase, traceFile->sp,
+                                  &traceFile->lastFunc);
+    }
+    traceFile->symbolTicks += readTimestamp() - start;
+
+    if (varInfo.varName != NULL) {
+        writeString(traceFile, ", \"variable\": ");
+        writeVar(traceFile, varInfo);
+    }
+}
+
+static void writeOpndAllocation(json_trace_t *traceFile, uint64_t addr) {
+    allocation_t alloc;
+    if (!options.heap ||
+        !findAllocation(addr, traceFile->heapSince, &alloc)) {
+        return;
+    }
+
+    writeString(traceFile, ", \"allocation\": {\"site\": ");
+    writeHex(traceFile, alloc.site);
+    writeString(traceFile, ", ");
+
+    // The site is a return address, so the line is that of the call before it
+    writeSourceLine(traceFile, findModule(&traceFile->moduleCache, alloc.site),
+                    alloc.site - 1);
+
+    writeString(traceFile, "\"start\": ");
+    writeHex(traceFile, alloc.start);
+    writeString(traceFile, ", \"size\": ");
+    writeUnsigned(traceFile, alloc.size);
+    writeString(traceFile, ", \"offset\": ");
+    writeUnsigned(traceFile, addr - alloc.start);
+    writeString(traceFile, "}");
 }
 
 static void writeVar(json_trace_t *traceFile, variable_info_t varInfo) {
-    fprintf(traceFile->file, "{\"name\": \"%s\", \"local\": %s",
-            varInfo.varName, varInfo.isLocal ? "true" : "false");
+    writeString(traceFile, "{\"name\": \"");
+    writeString(traceFile, varInfo.varName);
+    writeString(traceFile, varInfo.isLocal ? "\", \"local\": true"
+                                           : "\", \"local\": false");
 
     if (varInfo.type.name != NULL) {
-        fprintf(traceFile->file, ", \"type\": {\"name\": \"%s\", \"size\": %u}}",
-                varInfo.type.name, varInfo.type.size);
+        writeString(traceFile, ", \"type\": {\"name\": \"");
+        writeString(traceFile, varInfo.type.name);
+        writeString(traceFile, "\", \"size\": ");
+        writeUnsigned(traceFile, varInfo.type.size);
+        writeString(traceFile, "}");
     }
+
+    writeString(traceFile, "}");
 }
@@ -3,21 +3,47 @@
 
 #include "trace_entry.h"
 #include "debug_info.h"
+#include "trace_output.h"
+#include "module_table.h"
 #include "dr_api.h"
 
 typedef struct {
-    file_t fileHandle;
-    FILE *file;
+    char path[MAXIMUM_PATH];
+    int index;
+    uint64_t firstEntry, lastEntry;
+} trace_chunk_t;
+
+typedef struct {
+    trace_output_t output;
     bool firstLine;
 
-    debug_info_t *info;
+    int interleaved;
+    thread_id_t tid;
+    uint64_t entries, bytes, chunkEntries, chunkBytes;
+    trace_chunk_t *chunks;
+    int sizeChunks, capacityChunks, nextChunk;
+    char manifestPath[MAXIMUM_PATH];
+
+    file_t indexFile;
+    uint64_t indexOffset, indexFirstEntry, indexEntries;
+    uint64_t indexMinPc, indexMaxPc;
+
+    const debug_info_t *info;
     void *pc, *segmBase, *sp;
+    int lastFunc;
+    module_cache_t moduleCache;
+
+    uint64_t symbolTicks;
+    uint64_t heapSince;
 } json_trace_t;
 
 /*
- * Creates a JSON trace in a unique file
+ * Creates a JSON trace in a unique file, for the given thread if not
+ * interleaved, given the debugging information of the main module shared by
+ * every trace, or NULL if it has none
  */
-json_trace_t createTraceFile(int interleaved);
+json_trace_t createTraceFile(int interleaved, thread_id_t tid,
+                             const debug_info_t *info);
 
 /*
  * Closes the file belonging to a JSON trace
@@ -34,4 +60,40 @@ void writeInterleavedTraceEntry(json_trace_t *traceFile, thread_id_t tid, trace_
  */
 void writeTraceEntry(json_trace_t *traceFile, trace_entry_t entry);
 
+/*
+ * Writes a marker for buffers of entries of a thread which were dropped to an
+ * interleaved trace file
+ */
+void writeInterleavedLossMarker(json_trace_t *traceFile, thread_id_t tid,
+                                uint64_t buffers, uint64_t entries);
+
+/*
+ * Writes a marker for buffers of entries which were dropped to the file
+ */
+void writeLossMarker(json_trace_t *traceFile, uint64_t buffers,
+                     uint64_t entries);
+
+/*
+ * Writes a change to a watched variable or register of a thread to an
+ * interleaved trace file
+ */
+void writeInterleavedValueChange(json_trace_t *traceFile, thread_id_t tid,
+                                 value_change_t change);
+
+/*
+ * Writes a change to a watched variable or register to the file
+ */
+void writeValueChange(json_trace_t *traceFile, value_change_t change);
+
+/*
+ * Writes a system call made by a thread to an interleaved trace file
+ */
+void writeInterleavedSyscall(json_trace_t *traceFile, thread_id_t tid,
+                             syscall_record_t record);
+
+/*
+ * Writes a system call to the file
+ */
+void writeSyscall(json_trace_t *traceFile, syscall_record_t record);
+
 #endif
@@ -0,0 +1,200 @@
+#include <string.h>
+
+#include "dr_api.h"
+#include "drx.h"
+
+#include "metrics.h"
+#include "options.h"
+#include "timestamps.h"
+
+static void *metricsMutex;
+static uint64_t startTime, lastSnapshotTime;
+static file_t snapshotFile = INVALID_FILE;
+
+static metrics_t **liveThreads;
+static int sizeLive, capacityLive;
+
+static metrics_t *exitedThreads;
+static int sizeExited, capacityExited;
+
+/*
+ * Writes the counts of all threads and their totals as a JSON object
+ */
+static void writeMetrics(file_t file);
+
+/*
+ * Writes the counts of a thread, or of the totals if given no thread, as a
+ * JSON object
+ */
+static void writeThreadMetrics(file_t file, metrics_t *metrics, int isTotal);
+
+/*
+ * Adds the counts of a thread to a total
+ */
+static void addMetrics(metrics_t *total, metrics_t *metrics);
+
+/*
+ * Converts timestamp counter ticks to microseconds
+ */
+static uint64_t ticksToMicroseconds(uint64_t ticks);
+
+/*
+ * Grows an array allocated with dr_global_alloc to fit at least one more
+ * element
+ */
+static void *growArray(void *array, int size, int *capacity, size_t elemSize);
+
+void metricsInit() {
+    metricsMutex = dr_mutex_create();
+    startTime = dr_get_microseconds();
+    lastSnapshotTime = startTime;
+
+    if (options.metricsInterval != 0) {
+        char path[MAXIMUM_PATH];
+        snapshotFile = drx_open_unique_file("./", "metrics_snapshots", "json",
+                                            DR_FILE_ALLOW_LARGE, path,
+                                            MAXIMUM_PATH);
+    }
+}
+
+void metricsExit() {
+    char path[MAXIMUM_PATH];
+    file_t file = drx_open_unique_file("./", "metrics", "json", 0, path,
+                                       MAXIMUM_PATH);
+
+    dr_mutex_lock(metricsMutex);
+    if (file != INVALID_FILE) {
+        writeMetrics(file);
+        dr_fprintf(file, "\n");
+        dr_close_file(file);
+    }
+
+    if (snapshotFile != INVALID_FILE) {
+        dr_close_file(snapshotFile);
+    }
+    dr_mutex_unlock(metricsMutex);
+
+    if (liveThreads != NULL) {
+        dr_global_free(liveThreads, capacityLive * sizeof(metrics_t *));
+    }
+    if (exitedThreads != NULL) {
+        dr_global_free(exitedThreads, capacityExited * sizeof(metrics_t));
+    }
+    dr_mutex_destroy(metricsMutex);
+}
+
+void metricsThreadInit(metrics_t *metrics, thread_id_t tid) {
+    memset(metrics, 0, sizeof(metrics_t));
+    metrics->tid = tid;
+
+    dr_mutex_lock(metricsMutex);
+    liveThreads = growArray(liveThreads, sizeLive, &capacityLive,
+                            sizeof(metrics_t *));
+    liveThreads[sizeLive++] = metrics;
+    dr_mutex_unlock(metricsMutex);
+}
+
+void metricsThreadExit(metrics_t *metrics) {
+    dr_mutex_lock(metricsMutex);
+    for (int i = 0; i < sizeLive; i++) {
+        if (liveThreads[i] == metrics) {
+            liveThreads[i] = liveThreads[--sizeLive];
+            break;
+        }
+    }
+
+    exitedThreads = growArray(exitedThreads, sizeExited, &capacityExited,
+                              sizeof(metrics_t));
+    exitedThreads[sizeExited++] = *metrics;
+    dr_mutex_unlock(metricsMutex);
+}
+
+void metricsSnapshot() {
+    if (snapshotFile == INVALID_FILE) {
+        return;
+    }
+
+    uint64_t now = dr_get_microseconds();
+    if (now - lastSnapshotTime < options.metricsInterval * 1000) {
+        return;
+    }
+
+    // Counts of other threads are read while they run, so are approximate
+    dr_mutex_lock(metricsMutex);
+    if (now - lastSnapshotTime >= options.metricsInterval * 1000) {
+        lastSnapshotTime = now;
+        writeMetrics(snapshotFile);
+        dr_fprintf(snapshotFile, "\n");
+    }
+    dr_mutex_unlock(metricsMutex);
+}
+
+static void writeMetrics(file_t file) {
+    metrics_t total;
+    memset(&total, 0, sizeof(total));
+
+    dr_fprintf(file, "{\"timeUs\": %lu, \"threads\": [",
+               dr_get_microseconds() - startTime);
+
+    for (int i = 0; i < sizeExited + sizeLive; i++) {
+        metrics_t *metrics = i < sizeExited ? &exitedThreads[i]
+                                            : liveThreads[i - sizeExited];
+        if (i != 0) {
+            dr_fprintf(file, ", ");
+        }
+
+        writeThreadMetrics(file, metrics, 0);
+        addMetrics(&total, metrics);
+    }
+
+    dr_fprintf(file, "], \"total\": ");
+    writeThreadMetrics(file, &total, 1);
+    dr_fprintf(file, "}");
+}
+
+static void writeThreadMetrics(file_t file, metrics_t *metrics, int isTotal) {
+    dr_fprintf(file, "{");
+    if (!isTotal) {
+        dr_fprintf(file, "\"tid\": %i, ", metrics->tid);
+    }
+
+    dr_fprintf(file,
+               "\"instrs\": %lu, \"flushes\": %lu, \"bytes\": %lu, "
+               "\"blocks\": %lu, \"outputTimeUs\": %lu, "
+               "\"mutexWaitTimeUs\": %lu, \"symbolTimeUs\": %lu}",
+               metrics->instrs, metrics->flushes, metrics->bytes,
+               metrics->blocks, ticksToMicroseconds(metrics->outputTicks),
+               ticksToMicroseconds(metrics->mutexWaitTicks),
+               ticksToMicroseconds(metrics->symbolTicks));
+}
+
+static void addMetrics(metrics_t *total, metrics_t *metrics) {
+    total->instrs += metrics->instrs;
+    total->flushes += metrics->flushes;
+    total->bytes += metrics->bytes;
+    total->blocks += metrics->blocks;
+    total->outputTicks += metrics->outputTicks;
+    total->mutexWaitTicks += metrics->mutexWaitTicks;
+    total->symbolTicks += metrics->symbolTicks;
+}
+
+static uint64_t ticksToMicroseconds(uint64_t ticks) {
+    return tscFrequency == 0 ? 0 : ticks * 1000000.0 / tscFrequency;
+}
+
+static void *growArray(void *array, int size, int *capacity, size_t elemSize) {
+    if (size < *capacity) {
+        return array;
+    }
+
+    int newCapacity = *capacity == 0 ? 16 : 2 * *capacity;
+    void *newArray = dr_global_alloc(newCapacity * elemSize);
+
+    if (array != NULL) {
+        memcpy(newArray, array, size * elemSize);
+        dr_global_free(array, *capacity * elemSize);
+    }
+
+    *capacity = newCapacity;
+    return newArray;
+}
@@ -0,0 +1,41 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <inttypes.h>
+
+#include "dr_api.h"
+
+typedef struct {
+    thread_id_t tid;
+    uint64_t instrs, flushes, bytes, blocks;
+    uint64_t outputTicks, mutexWaitTicks, symbolTicks;
+} metrics_t;
+
+/*
+ * Starts timing the run, opening the snapshot file if periodic snapshots are
+ * enabled
+ */
+void metricsInit();
+
+/*
+ * Writes the summary of all threads and the totals, closing any snapshot file
+ */
+void metricsExit();
+
+/*
+ * Starts counting for a thread
+ */
+void metricsThreadInit(metrics_t *metrics, thread_id_t tid);
+
+/*
+ * Stops counting for a thread, keeping its final counts for the summary
+ */
+void metricsThreadExit(metrics_t *metrics);
+
+/*
+ * Writes a snapshot of all threads and the totals if the snapshot interval
+ * has passed since the last one
+ */
+void metricsSnapshot();
+
+#endif
@@ -0,0 +1,203 @@
+#include <string.h>
+
+#include "dr_api.h"
+
+#include "module_table.h"
+#include "options.h"
+
+static module_range_t *modules;
+static int sizeModules, capacityModules;
+
+// Unloaded modules are kept until exit, as caches may still use their paths
+// and line tables, and strings from their line tables may still be in use by a
+// writer
+static module_range_t *retired;
+static int sizeRetired, capacityRetired;
+
+static app_pc mainStart;
+static debug_info_t *mainLines;
+static void *modulesLock;
+
+// Changed on every load and unload, so that caches from before are not used
+static volatile uint64_t generation = 1;
+
+/*
+ * Returns the index of the last module starting at or before a PC, or -1 if
+ * there is none, while holding the lock
+ */
+static int searchModules(app_pc pc);
+
+/*
+ * Loads the line table of a shared library, returning NULL if it has none
+ */
+static debug_info_t *loadLines(const module_data_t *module);
+
+/*
+ * Adds an unloaded module to those freed at exit
+ */
+static void retireModule(module_range_t module);
+
+/*
+ * Frees the path copied into the table for a module, and its line table if
+ * it was loaded for the module
+ */
+static void freeModule(module_range_t module);
+
+void moduleTableInit(const module_data_t *mainModule, debug_info_t *mainInfo) {
+    modulesLock = dr_rwlock_create();
+    mainStart = mainModule->start;
+    mainLines = mainInfo;
+}
+
+void moduleTableExit() {
+    for (int i = 0; i < sizeModules; i++) {
+        freeModule(modules[i]);
+    }
+    for (int i = 0; i < sizeRetired; i++) {
+        freeModule(retired[i]);
+    }
+
+    if (modules != NULL) {
+        dr_global_free(modules, capacityModules * sizeof(module_range_t));
+    }
+    if (retired != NULL) {
+        dr_global_free(retired, capacityRetired * sizeof(module_range_t));
+    }
+
+    modules = NULL;
+    sizeModules = 0;
+    capacityModules = 0;
+    retired = NULL;
+    sizeRetired = 0;
+    capacityRetired = 0;
+    dr_rwlock_destroy(modulesLock);
+}
+
+void addModuleRange(const module_data_t *module) {
+    size_t pathSize = strlen(module->full_path) + 1;
+    char *path = dr_global_alloc(pathSize);
+    memcpy(path, module->full_path, pathSize);
+
+    module_range_t range;
+    range.start = module->start;
+    range.end = module->end;
+    range.path = path;
+    range.isMain = module->start == mainStart;
+
+    // Line tables are loaded before taking the lock, as parsing them is slow
+    range.lines = range.isMain ? mainLines :
+                  options.libLines ? loadLines(module) : NULL;
+
+    dr_rwlock_write_lock(modulesLock);
+
+    if (sizeModules == capacityModules) {
+        int capacity = capacityModules == 0 ? 64 : 2 * capacityModules;
+        module_range_t *newModules = dr_global_alloc(capacity *
+                                                     sizeof(module_range_t));
+
+        if (modules != NULL) {
+            memcpy(newModules, modules, sizeModules * sizeof(module_range_t));
+            dr_global_free(modules, capacityModules * sizeof(module_range_t));
+        }
+
+        modules = newModules;
+        capacityModules = capacity;
+    }
+
+    int i = searchModules(range.start) + 1;
+    memmove(&modules[i + 1], &modules[i],
+            (sizeModules - i) * sizeof(module_range_t));
+    modules[i] = range;
+    sizeModules++;
+    generation++;
+
+    dr_rwlock_write_unlock(modulesLock);
+}
+
+void removeModuleRange(const module_data_t *module) {
+    dr_rwlock_write_lock(modulesLock);
+
+    int i = searchModules(module->start);
+    if (i != -1 && modules[i].start == module->start) {
+        retireModule(modules[i]);
+        memmove(&modules[i], &modules[i + 1],
+                (sizeModules - i - 1) * sizeof(module_range_t));
+        sizeModules--;
+        generation++;
+    }
+
+    dr_rwlock_write_unlock(modulesLock);
+}
+
+void initModuleCache(module_cache_t *cache) {
+    cache->generation = 0;
+}
+
+const module_range_t *findModule(module_cache_t *cache, uint64_t pc) {
+    if (cache->generation == generation &&
+        (app_pc)pc >= cache->module.start && (app_pc)pc < cache->module.end) {
+        return &cache->module;
+    }
+
+    const module_range_t *found = NULL;
+
+    dr_rwlock_read_lock(modulesLock);
+    int i = searchModules((app_pc)pc);
+    if (i != -1 && (app_pc)pc < modules[i].end) {
+        cache->module = modules[i];
+        cache->generation = generation;
+        found = &cache->module;
+    }
+    dr_rwlock_read_unlock(modulesLock);
+
+    return found;
+}
+
+static int searchModules(app_pc pc) {
+    int low = 0, high = sizeModules;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (modules[mid].start <= pc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low - 1;
+}
+
+static debug_info_t *loadLines(const module_data_t *module) {
+    debug_info_t *info = getDebugInfo(module->full_path);
+    if (info != NULL && info->sizeLines == 0) {
+        destroyDebugInfo(info);
+        info = NULL;
+    }
+
+    return info;
+}
+
+static void retireModule(module_range_t module) {
+    if (sizeRetired == capacityRetired) {
+        int capacity = capacityRetired == 0 ? 16 : 2 * capacityRetired;
+        module_range_t *newRetired = dr_global_alloc(capacity *
+                                                     sizeof(module_range_t));
+
+        if (retired != NULL) {
+            memcpy(newRetired, retired, sizeRetired * sizeof(module_range_t));
+            dr_global_free(retired, capacityRetired * sizeof(module_range_t));
+        }
+
+        retired = newRetired;
+        capacityRetired = capacity;
+    }
+
+    retired[sizeRetired++] = module;
+}
+
+static void freeModule(module_range_t module) {
+    dr_global_free((char *)module.path, strlen(module.path) + 1);
+    if (!module.isMain && module.lines != NULL) {
+        destroyDebugInfo(module.lines);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef MODULE_TABLE_H
+#define MODULE_TABLE_H
+
+#include <inttypes.h>
+
+#include "dr_api.h"
+
+#include "debug_info.h"
+
+typedef struct {
+    app_pc start, end;
+    const char *path;
+    int isMain;
+
+    // The debugging information holding the module's line table, or NULL if
+    // its lines are looked up through drsyms
+    debug_info_t *lines;
+} module_range_t;
+
+typedef struct {
+    module_range_t module;
+    uint64_t generation;
+} module_cache_t;
+
+/*
+ * Starts keeping the address ranges of loaded modules, given the main module
+ * and the debugging information holding its line table
+ */
+void moduleTableInit(const module_data_t *mainModule, debug_info_t *mainInfo);
+
+/*
+ * Frees the table of modules, with the line tables loaded for shared libraries
+ */
+void moduleTableExit();
+
+/*
+ * Adds a loaded module to the table, loading the line table of a shared
+ * library if enabled and it has one
+ */
+void addModuleRange(const module_data_t *module);
+
+/*
+ * Removes an unloaded module from the table
+ */
+void removeModuleRange(const module_data_t *module);
+
+/*
+ * Empties a cache of the last module found
+ */
+void initModuleCache(module_cache_t *cache);
+
+/*
+ * Finds the module containing a PC, trying the last module found by the given
+ * cache before searching the table, returning NULL if there is none
+ *
+ * Note: The module passed back is only valid until the next call with the
+ * same cache
+ */
+const module_range_t *findModule(module_cache_t *cache, uint64_t pc);
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "options.h"
+
+/*
+ * Sets all options to their default values
+ */
+static void setDefaults(options_t *opts);
+
+/*
+ * Parses an unsigned integer option value, returning 0 on success
+ */
+static int parseUnsigned(const char *name, const char *val, uint64_t *dst);
+
+/*
+ * Parses a floating point option value, returning 0 on success
+ */
+static int parseDouble(const char *name, const char *val, double *dst);
+
+/*
+ * Prints the available options
+ */
+static void printUsage();
+
+int parseOptions(int argc, const char *argv[], options_t *opts) {
+    setDefaults(opts);
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Missing value for option %s\n", argv[i]);
+            printUsage();
+            return 1;
+        }
+
+        const char *name = argv[i], *val = argv[++i];
+        uint64_t num;
+
+        if (strcmp(name, "-chunk_bytes") == 0) {
+            if (parseUnsigned(name, val, &opts->chunkBytes)) return 1;
+        } else if (strcmp(name, "-chunk_entries") == 0) {
+            if (parseUnsigned(name, val, &opts->chunkEntries)) return 1;
+        } else if (strcmp(name, "-keep_chunks") == 0) {
+            if (parseUnsigned(name, val, &num)) return 1;
+            opts->keepChunks = (int)num;
+        } else if (strcmp(name, "-mmap_window") == 0) {
+            if (parseUnsigned(name, val, &opts->mmapWindow)) return 1;
+        } else if (strcmp(name, "-timestamps") == 0) {
+            if (parseUnsigned(name, val, &opts->timestampInterval)) return 1;
+        } else if (strcmp(name, "-max_slowdown") == 0) {
+            if (parseDouble(name, val, &opts->maxSlowdown)) return 1;
+        } else if (strcmp(name, "-max_bytes_per_sec") == 0) {
+            if (parseUnsigned(name, val, &opts->maxBytesPerSec)) return 1;
+        } else if (strcmp(name, "-watch") == 0) {
+            opts->watch = val;
+        } else if (strcmp(name, "-watch_regs") == 0) {
+            opts->watchRegs = val;
+        } else if (strcmp(name, "-watch_mode") == 0) {
+            if (strcmp(val, "changes") == 0) {
+                opts->watchChanges = 1;
+            } else if (strcmp(val, "accesses") == 0) {
+                opts->watchChanges = 0;
+            } else {
+                fprintf(stderr, "Error: Unknown watch mode %s\n", val);
+                return 1;
+            }
+        } else if (strcmp(name, "-metrics_interval") == 0) {
+            if (parseUnsigned(name, val, &opts->metricsInterval)) return 1;
+        } else if (strcmp(name, "-syscalls") == 0) {
+            if (parseUnsigned(name, val, &num)) return 1;
+            opts->syscalls = num != 0;
+        } else if (strcmp(name, "-heap") == 0) {
+            if (parseUnsigned(name, val, &num)) return 1;
+            opts->heap = num != 0;
+        } else if (strcmp(name, "-branches") == 0) {
+            if (parseUnsigned(name, val, &num)) return 1;
+            opts->branches = num != 0;
+        } else if (strcmp(name, "-predictor") == 0) {
+            if (strcmp(val, "bimodal") == 0) {
+                opts->predictor = predictorBimodal;
+            } else if (strcmp(val, "gshare") == 0) {
+                opts->predictor = predictorGshare;
+            } else if (strcmp(val, "tage") == 0) {
+                opts->predictor = predictorTage;
+            } else {
+                fprintf(stderr, "Error: Unknown predictor %s\n", val);
+                return 1;
+            }
+        } else if (strcmp(name, "-predictor_bits") == 0) {
+            if (parseUnsigned(name, val, &num)) return 1;
+            if (num < 1 || num > 24) {
+                fprintf(stderr, "Error: Predictor bits must be from 1 to 24\n");
+                return 1;
+            }
+            opts->predictorBits = (int)num;
+        } else if (strcmp(name, "-lib_lines") == 0) {
+            if (parseUnsigned(name, val, &num)) return 1;
+            opts->libLines = num != 0;
+        } else if (strcmp(name, "-format") == 0) {
+            if (strcmp(val, "ndjson") == 0) {
+                opts->ndjson = 1;
+            } else if (strcmp(val, "json") == 0) {
+                opts->ndjson = 0;
+            } else {
+                fprintf(stderr, "Error: Unknown format %s\n", val);
+                return 1;
+            }
+        } else if (strcmp(name, "-index_interval") == 0) {
+            if (parseUnsigned(name, val, &opts->indexInterval)) return 1;
+        } else if (strcmp(name, "-offline") == 0) {
+            if (parseUnsigned(name, val, &num)) return 1;
+            opts->offline = num != 0;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", name);
+            printUsage();
+            return 1;
+        }
+    }
+
+    // Only NDJSON trace files can be indexed, whichever option comes first
+    if (opts->indexInterval != 0 && !opts->ndjson) {
+        fprintf(stderr, "Error: -index_interval requires -format ndjson\n");
+        return 1;
+    }
+
+    // Changes are written straight from clean calls, with no entries to hold
+    // branch outcomes
+    if (opts->branches && opts->watchChanges) {
+        fprintf(stderr, "Error: -branches cannot be used with -watch_mode "
+                "changes\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void setDefaults(options_t *opts) {
+    opts->chunkBytes = 0;
+    opts->chunkEntries = 0;
+    opts->keepChunks = 0;
+    opts->mmapWindow = 0;
+    opts->timestampInterval = 0;
+    opts->maxSlowdown = 0;
+    opts->maxBytesPerSec = 0;
+    opts->watch = NULL;
+    opts->watchRegs = NULL;
+    opts->watchChanges = 0;
+    opts->metricsInterval = 0;
+    opts->syscalls = 0;
+    opts->heap = 0;
+    opts->branches = 0;
+    opts->predictor = predictorGshare;
+    opts->predictorBits = 12;
+    opts->libLines = 0;
+    opts->ndjson = 0;
+    opts->indexInterval = 0;
+    opts->offline = 0;
+}
+
+static int parseUnsigned(const char *name, const char *val, uint64_t *dst) {
+    char *end;
+    *dst = strtoull(val, &end, 0);
+
+    if (*val == '\0' || *end != '\0') {
+        fprintf(stderr, "Error: Expected an unsigned integer for option %s\n",
+                name);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parseDouble(const char *name, const char *val, double *dst) {
+    char *end;
+    *dst = strtod(val, &end);
+
+    if (*val == '\0' || *end != '\0') {
+        fprintf(stderr, "Error: Expected a number for option %s\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void printUsage() {
+    fprintf(stderr,
+            "Options:\n"
+            "  -chunk_bytes <n>    Start a new trace file after n bytes\n"
+            "  -chunk_entries <n>  Start a new trace file after n entries\n"
+            "  -keep_chunks <n>    Only keep the last n trace files of each "
+            "trace\n"
+            "  -mmap_window <n>    Write trace files through memory-mapped "
+            "windows of n bytes\n"
+            "  -timestamps <n>     Record a timestamp at the start of every "
+            "nth block\n"
+            "  -max_slowdown <x>   Sample trace buffers when writing slows a "
+            "thread by more than a factor of x\n"
+            "  -max_bytes_per_sec <n>\n"
+            "                      Sample trace buffers when a thread writes "
+            "more than n bytes per second\n"
+            "  -watch <names>      Only record instructions accessing the "
+            "comma-separated variables\n"
+            "  -watch_regs <names> Only record instructions using the "
+            "comma-separated registers\n"
+            "  -watch_mode <mode>  Record every access to watched variables "
+            "and registers with accesses, or\n"
+            "                      only writes changing their values with "
+            "changes\n"
+            "  -metrics_interval <n>\n"
+            "                      Write a snapshot of the tracer's metrics "
+            "every n milliseconds\n"
+            "  -syscalls <n>       Record system calls with their duration "
+            "if n is 1\n"
+            "  -heap <n>           Name the heap allocations accessed by "
+            "memory operands if n is 1\n"
+            "  -branches <n>       Record whether conditional branches are "
+            "taken and\n"
+            "                      simulate a branch predictor if n is 1\n"
+            "  -predictor <name>   Simulate a bimodal, gshare or tage "
+            "predictor\n"
+            "  -predictor_bits <n> Use predictor tables of 2^n entries\n"
+            "  -lib_lines <n>      Load the line tables of shared libraries "
+            "if n is 1\n"
+            "  -format <format>    Write trace files as a json array, the "
+            "default, or as ndjson\n"
+            "  -index_interval <n> With ndjson, index every n entries in a "
+            "side file\n"
+            "  -offline <n>        Leave source lines and variables to the "
+            "offline symbolizer if n is 1\n");
+}
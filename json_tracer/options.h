@@ -0,0 +1,51 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <inttypes.h>
+
+typedef enum {
+    predictorBimodal,
+    predictorGshare,
+    predictorTage
+} predictor_kind_t;
+
+typedef struct {
+    uint64_t chunkBytes;
+    uint64_t chunkEntries;
+    int keepChunks;
+    uint64_t mmapWindow;
+
+    uint64_t timestampInterval;
+
+    double maxSlowdown;
+    uint64_t maxBytesPerSec;
+
+    const char *watch;
+    const char *watchRegs;
+    int watchChanges;
+
+    uint64_t metricsInterval;
+
+    int syscalls;
+
+    int heap;
+
+    int branches;
+    predictor_kind_t predictor;
+    int predictorBits;
+
+    int libLines;
+
+    int ndjson;
+    uint64_t indexInterval;
+    int offline;
+} options_t;
+
+extern options_t options;
+
+/*
+ * Parses the options given to the client, returning 0 on success
+ */
+int parseOptions(int argc, const char *argv[], options_t *opts);
+
+#endif
@@ -0,0 +1,52 @@
+#include <sys/syscall.h>
+
+#include "dr_api.h"
+
+#include "syscalls.h"
+#include "options.h"
+#include "timestamps.h"
+
+bool syscallTraced(void *drcontext, int sysnum) {
+    return options.syscalls != 0;
+}
+
+void beginSyscall(void *drcontext, int sysnum, syscall_record_t *record) {
+    record->number = sysnum;
+    record->hasFd = 0;
+    record->hasSize = 0;
+
+    // Only the file descriptor and byte count of I/O calls are of interest
+    switch (sysnum) {
+        case SYS_read:
+        case SYS_write:
+        case SYS_pread64:
+        case SYS_pwrite64:
+            record->hasSize = 1;
+            record->size = dr_syscall_get_param(drcontext, 2);
+            /* FALLTHROUGH */
+
+        case SYS_close:
+        case SYS_lseek:
+        case SYS_fstat:
+        case SYS_readv:
+        case SYS_writev:
+        case SYS_fsync:
+            record->hasFd = 1;
+            record->fd = dr_syscall_get_param(drcontext, 0);
+            break;
+
+        case SYS_mmap:
+            record->hasSize = 1;
+            record->size = dr_syscall_get_param(drcontext, 1);
+            record->hasFd = 1;
+            record->fd = dr_syscall_get_param(drcontext, 4);
+            break;
+    }
+
+    record->start = readTimestamp();
+}
+
+void endSyscall(void *drcontext, syscall_record_t *record) {
+    record->duration = readTimestamp() - record->start;
+    record->result = (int64_t)dr_syscall_get_result(drcontext);
+}
@@ -0,0 +1,25 @@
+#ifndef SYSCALLS_H
+#define SYSCALLS_H
+
+#include "dr_api.h"
+
+#include "trace_entry.h"
+
+/*
+ * Returns whether a system call is traced
+ */
+bool syscallTraced(void *drcontext, int sysnum);
+
+/*
+ * Starts a record of a system call about to be made, saving its arguments of
+ * interest and start time
+ */
+void beginSyscall(void *drcontext, int sysnum, syscall_record_t *record);
+
+/*
+ * Finishes a record of a system call which has just returned, saving its
+ * result and duration
+ */
+void endSyscall(void *drcontext, syscall_record_t *record);
+
+#endif
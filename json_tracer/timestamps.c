@@ -0,0 +1,24 @@
+#include <x86intrin.h>
+
+#include "dr_api.h"
+
+#include "timestamps.h"
+
+#define CALIBRATION_TIME 20
+
+uint64_t tscFrequency;
+
+void calibrateTimestamps() {
+    uint64_t startTime = dr_get_microseconds();
+    uint64_t startTimestamp = readTimestamp();
+
+    dr_sleep(CALIBRATION_TIME);
+
+    uint64_t ticks = readTimestamp() - startTimestamp;
+    uint64_t time = dr_get_microseconds() - startTime;
+    tscFrequency = time == 0 ? 0 : ticks * 1000000 / time;
+}
+
+uint64_t readTimestamp() {
+    return __rdtsc();
+}
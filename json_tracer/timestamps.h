@@ -0,0 +1,18 @@
+#ifndef TIMESTAMPS_H
+#define TIMESTAMPS_H
+
+#include <inttypes.h>
+
+extern uint64_t tscFrequency;
+
+/*
+ * Measures the frequency of the timestamp counter
+ */
+void calibrateTimestamps();
+
+/*
+ * Reads the timestamp counter
+ */
+uint64_t readTimestamp();
+
+#endif
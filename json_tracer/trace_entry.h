@@ -3,6 +3,17 @@
 
 #include <inttypes.h>
 
+#define MAX_OPERANDS 8
+#define MAX_VALUE_SIZE 64
+
+// Offsets of the raw TLS slots from offset
+#define BUF_PTR_SLOT 0
+#define COUNTER_SLOT (sizeof(void *))
+#define TIMESTAMP_SLOT (2 * sizeof(void *))
+#define PENDING_WRITE_SLOT (3 * sizeof(void *))
+#define PENDING_ADDR_SLOT (4 * sizeof(void *))
+#define NUM_TLS_SLOTS 5
+
 typedef enum {
     unknown,
     reg,
@@ -12,19 +23,38 @@ typedef enum {
     target
 } value_type_t;
 
+typedef enum {
+    branchNone,
+    branchNotTaken,
+    branchTaken
+} branch_outcome_t;
+
 typedef struct {
     uint64_t name;
-    uint64_t val;
+    uint64_t size;
+    uint64_t shift;
+    uint64_t valNull;
+    union {
+        uint64_t val;
+        uint8_t bytes[MAX_VALUE_SIZE];
+    };
 } register_value_t;
 
 typedef struct {
+    uint64_t size;
     uint64_t val;
 } immediate_value_t;
 
 typedef struct {
     uint64_t isFar;
     uint64_t addr;
-    uint64_t val;
+    uint64_t size;
+    uint64_t valNull;
+    uint64_t varId;
+    union {
+        uint64_t val;
+        uint8_t bytes[MAX_VALUE_SIZE];
+    };
 } memory_value_t;
 
 typedef struct {
@@ -33,14 +63,23 @@ typedef struct {
     uint64_t baseName;
     uint64_t baseVal;
     uint64_t disp;
+    uint64_t addr;
+    uint64_t size;
     uint64_t valNull;
-    uint64_t val;
+    uint64_t varId;
+    union {
+        uint64_t val;
+        uint8_t bytes[MAX_VALUE_SIZE];
+    };
 } indirect_value_t;
 
 typedef struct {
     uint64_t pc;
     char name[64];
     void *sp;
+
+    // The address following the call, which its return reaches
+    uint64_t returnPc;
 } call_target_t;
 
 typedef struct {
@@ -57,15 +96,39 @@ typedef struct {
 
 typedef struct {
     uint64_t pc;
-    uint64_t opcode;
+
+    // Stored together by a single write
+    uint32_t opcode;
+    uint32_t branch;
+
     uint64_t numVals;
     uint64_t bp;
-    operand_value_t vals[8];
+    uint64_t tsc;
+    operand_value_t vals[MAX_OPERANDS];
 } trace_entry_t;
 
-extern reg_id_t regSegmBase;
-extern uint offset;
-extern int tlsSlot;
+typedef struct {
+    uint64_t pc;
+    uint64_t tsc;
+    uint64_t isReg;
+    uint64_t regName;
+    uint64_t varId;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t oldNull;
+    uint8_t oldBytes[MAX_VALUE_SIZE];
+    uint8_t newBytes[MAX_VALUE_SIZE];
+} value_change_t;
+
+typedef struct {
+    uint64_t number;
+    uint64_t hasFd, fd;
+    uint64_t hasSize, size;
+    int64_t result;
+    uint64_t start, duration;
+    uint64_t instrs;
+} syscall_record_t;
 
 extern reg_id_t regSegmBase;
 extern uint offset;
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dr_api.h"
+
+#include "trace_output.h"
+#include "options.h"
+
+#define FORMAT_BUFFER_SIZE 512
+
+/*
+ * Writes the buffered output to the file with a single write
+ */
+static void flushBuffer(trace_output_t *out);
+
+/*
+ * Maps the window of the file containing the given offset, growing the file
+ * to fit it, returning 0 on success
+ */
+static int mapWindow(trace_output_t *out, uint64_t fileOffset);
+
+/*
+ * Unmaps the current window
+ */
+static void unmapWindow(trace_output_t *out);
+
+uint outputFileFlags() {
+    // Shared mappings need the file to be readable as well as writable
+    return options.mmapWindow != 0 ? DR_FILE_READ : 0;
+}
+
+trace_output_t openOutput(file_t handle) {
+    trace_output_t out;
+    out.handle = handle;
+    out.buf = NULL;
+    out.bufPos = 0;
+    out.map = NULL;
+    out.mapOffset = 0;
+    out.mapSize = 0;
+    out.mapPos = 0;
+    out.size = 0;
+
+    if (options.mmapWindow == 0 || mapWindow(&out, 0)) {
+        out.buf = dr_global_alloc(OUTPUT_BUFFER_SIZE);
+    }
+
+    return out;
+}
+
+void closeOutput(trace_output_t *out) {
+    if (out->buf != NULL) {
+        flushBuffer(out);
+        dr_global_free(out->buf, OUTPUT_BUFFER_SIZE);
+        out->buf = NULL;
+        dr_close_file(out->handle);
+        return;
+    }
+
+    unmapWindow(out);
+    if (ftruncate(out->handle, out->size) != 0) {
+        fprintf(stderr, "Error: Could not truncate trace file\n");
+    }
+    dr_close_file(out->handle);
+}
+
+int outputBytes(trace_output_t *out, const char *bytes, size_t length) {
+    size_t written = 0;
+
+    while (written < length) {
+        char *dst;
+        size_t space;
+        if (out->buf != NULL) {
+            if (out->bufPos == OUTPUT_BUFFER_SIZE) {
+                flushBuffer(out);
+            }
+            dst = out->buf + out->bufPos;
+            space = OUTPUT_BUFFER_SIZE - out->bufPos;
+        } else {
+            if ((out->map == NULL || out->mapPos == out->mapSize) &&
+                mapWindow(out, out->size)) {
+                break;
+            }
+            dst = out->map + out->mapPos;
+            space = out->mapSize - out->mapPos;
+        }
+
+        size_t chunk = length - written < space ? length - written : space;
+        memcpy(dst, bytes + written, chunk);
+        written += chunk;
+        out->size += chunk;
+
+        if (out->buf != NULL) {
+            out->bufPos += chunk;
+        } else {
+            out->mapPos += chunk;
+        }
+    }
+
+    return (int)written;
+}
+
+int outputFormat(trace_output_t *out, const char *format, va_list args) {
+    char buf[FORMAT_BUFFER_SIZE];
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int length = vsnprintf(buf, sizeof(buf), format, argsCopy);
+    va_end(argsCopy);
+
+    if (length < 0) {
+        return length;
+    } else if (length < sizeof(buf)) {
+        return outputBytes(out, buf, length);
+    }
+
+    // Rare long output, such as deep paths, is formatted on the heap
+    char *longBuf = dr_global_alloc(length + 1);
+    vsnprintf(longBuf, length + 1, format, args);
+    int written = outputBytes(out, longBuf, length);
+    dr_global_free(longBuf, length + 1);
+    return written;
+}
+
+static void flushBuffer(trace_output_t *out) {
+    size_t flushed = 0;
+    while (flushed < out->bufPos) {
+        ssize_t written = dr_write_file(out->handle, out->buf + flushed,
+                                        out->bufPos - flushed);
+        if (written <= 0) {
+            fprintf(stderr, "Error: Could not write to trace file\n");
+            break;
+        }
+        flushed += written;
+    }
+
+    out->bufPos = 0;
+}
+
+static int mapWindow(trace_output_t *out, uint64_t fileOffset) {
+    unmapWindow(out);
+
+    size_t pageSize = dr_page_size();
+    uint64_t mapOffset = ALIGN_BACKWARD(fileOffset, pageSize);
+    size_t mapSize = ALIGN_FORWARD(options.mmapWindow, pageSize);
+
+    if (ftruncate(out->handle, mapOffset + mapSize) != 0) {
+        return 1;
+    }
+
+    size_t size = mapSize;
+    char *map = dr_map_file(out->handle, &size, mapOffset, NULL,
+                            DR_MEMPROT_READ | DR_MEMPROT_WRITE, 0);
+    if (map == NULL) {
+        return 1;
+    }
+
+    out->map = map;
+    out->mapOffset = mapOffset;
+    out->mapSize = size;
+    out->mapPos = fileOffset - mapOffset;
+    return 0;
+}
+
+static void unmapWindow(trace_output_t *out) {
+    if (out->map != NULL) {
+        dr_unmap_file(out->map, out->mapSize);
+        out->map = NULL;
+    }
+}
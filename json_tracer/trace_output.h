@@ -0,0 +1,51 @@
+#ifndef TRACE_OUTPUT_H
+#define TRACE_OUTPUT_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "dr_api.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    file_t handle;
+
+    char *buf;
+    size_t bufPos;
+
+    char *map;
+    uint64_t mapOffset;
+    size_t mapSize, mapPos;
+
+    uint64_t size;
+} trace_output_t;
+
+/*
+ * Returns the extra flags a file must be opened with to be used for output
+ */
+uint outputFileFlags();
+
+/*
+ * Starts output to an open file, writing through memory-mapped windows if
+ * enabled
+ */
+trace_output_t openOutput(file_t handle);
+
+/*
+ * Finishes output, closing the file
+ */
+void closeOutput(trace_output_t *out);
+
+/*
+ * Writes bytes, returning the number of bytes written
+ */
+int outputBytes(trace_output_t *out, const char *bytes, size_t length);
+
+/*
+ * Writes formatted output, returning the number of bytes written
+ */
+int outputFormat(trace_output_t *out, const char *format, va_list args);
+
+#endif
@@ -1,11 +1,23 @@
 #include "dr_api.h"
 #include "drmgr.h"
 #include "drsyms.h"
+#include "drutil.h"
+#include "drx.h"
 
 #include "trace_entry.h"
 #include "insert_instrumentation.h"
 #include "json_writer.h"
 #include "debug_info.h"
+#include "options.h"
+#include "governor.h"
+#include "timestamps.h"
+#include "watch.h"
+#include "value_changes.h"
+#include "metrics.h"
+#include "syscalls.h"
+#include "allocations.h"
+#include "branch_predictor.h"
+#include "module_table.h"
 
 #include <string.h>
 
@@ -16,14 +28,25 @@ typedef struct {
     byte *segmBase;
     trace_entry_t *buf;
     json_trace_t traceFile;
+    governor_t governor;
+    value_shadow_t shadow;
+    metrics_t metrics;
+    syscall_record_t syscall;
+    branch_predictor_t predictor;
+    allocation_window_t heapWindow;
 } thread_data_t;
 
 reg_id_t regSegmBase;
 uint offset;
 int tlsSlot;
 
+options_t options;
+
+debug_info_t *debugInfo;
+
 json_trace_t interleavedTrace;
 void *interleavedTraceMutex;
+static uint64_t writeStartBytes, writeStartSymbolTicks;
 
 /*
  * Cleans allocated objects
@@ -50,6 +73,13 @@ static void eventThreadInit(void *drcontext);
  */
 static void eventThreadExit(void *drcontext);
 
+/*
+ * Expands rep string instructions into loops and scatter and gather
+ * instructions into accesses of each element
+ */
+static dr_emit_flags_t eventApp2App(void *drcontext, void *tag,
+    instrlist_t *instrs, bool for_trace, bool translating);
+
 /*
  * Inserts clean call into basic block
  */
@@ -67,49 +97,179 @@ static void cleanCall(void);
  */
 static void outputInstr(void *drcontext);
 
+/*
+ * Writes the instructions stored in buffer to the JSON files
+ */
+static void writeInstr(void *drcontext, trace_entry_t *end);
+
+/*
+ * Writes a marker for any buffers dropped since the last marker
+ */
+static void writeLostEntries(void *drcontext);
+
+/*
+ * Runs the conditional branches stored in buffer through the thread's
+ * simulated branch predictor
+ */
+static void simulateBranches(thread_data_t *data, trace_entry_t *end);
+
+/*
+ * Locks the trace files for a thread to write to, counting the time spent
+ * waiting for the interleaved trace
+ */
+static void beginWrite(thread_data_t *data);
+
+/*
+ * Unlocks the trace files, counting the bytes written and time spent
+ * symbolizing by the thread
+ */
+static void endWrite(thread_data_t *data);
+
+/*
+ * Inserts a clean call to check for changes to watched variables and
+ * registers before an instruction if the previous instruction may have
+ * changed them, or at the start of each block, made only if a write is pending
+ */
+static void insertChangeCall(void *drcontext, instrlist_t *instrs,
+                             instr_t *nextInstr);
+
+/*
+ * Clean call to call checkValueChanges
+ */
+static void changeCall(void);
+
+/*
+ * Writes any changes to watched variables and registers made by the last
+ * instruction left to be checked
+ */
+static void checkValueChanges(void *drcontext);
+
+/*
+ * Writes a change to watched variable or register to the JSON files
+ */
+static void writeChange(value_change_t *change, void *drcontext);
+
+/*
+ * Returns whether a system call is traced or, with -heap, flushed before
+ */
+static bool eventFilterSyscall(void *drcontext, int sysnum);
+
+/*
+ * Flushes the entries before a system call and starts its record if traced
+ */
+static bool eventPreSyscall(void *drcontext, int sysnum);
+
+/*
+ * Finishes the record of a traced system call and writes it to the JSON files
+ */
+static void eventPostSyscall(void *drcontext, int sysnum);
+
 DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])  {
+    if (parseOptions(argc, argv, &options)) {
+        dr_abort();
+    }
+
     drmgr_init();
+    drutil_init();
+    drx_init();
     drsym_init(0);
-    instrContextInit();
+
+    module_data_t *mainModule = dr_get_main_module();
+    debugInfo = getDebugInfo(mainModule->full_path);
+    if (options.watch != NULL &&
+        initWatchList(options.watch, debugInfo, mainModule->start)) {
+        dr_abort();
+    }
+    if (options.watchRegs != NULL && initWatchedRegisters(options.watchRegs)) {
+        dr_abort();
+    }
+    if (options.watchChanges && !watchListEnabled()) {
+        fprintf(stderr, "Error: Watching changes requires watched variables "
+                        "or registers\n");
+        dr_abort();
+    }
+    valueChangesInit(debugInfo, mainModule->start);
+    moduleTableInit(mainModule, debugInfo);
+    instrContextInit(debugInfo, mainModule->start);
+    dr_free_module_data(mainModule);
 
     dr_register_exit_event(eventExit);
     drmgr_register_module_load_event(eventModuleLoad);
     drmgr_register_module_unload_event(eventModuleUnload);
     drmgr_register_thread_init_event(eventThreadInit);
     drmgr_register_thread_exit_event(eventThreadExit);
+    drmgr_register_bb_app2app_event(eventApp2App, NULL);
     drmgr_register_bb_instrumentation_event(NULL, eventInstr, NULL);
+    dr_register_filter_syscall_event(eventFilterSyscall);
+    drmgr_register_pre_syscall_event(eventPreSyscall);
+    drmgr_register_post_syscall_event(eventPostSyscall);
 
     tlsSlot = drmgr_register_tls_field();
-    dr_raw_tls_calloc(&regSegmBase, &offset, 1, 0);
+    dr_raw_tls_calloc(&regSegmBase, &offset, NUM_TLS_SLOTS, 0);
+
+    if (options.heap) {
+        allocationsInit(outputInstr);
+    }
+    if (options.branches) {
+        predictorsInit();
+    }
 
-    interleavedTrace = createTraceFile(1);
+    // Metrics are timed with the timestamp counter even without -timestamps
+    calibrateTimestamps();
+    metricsInit();
+
+    interleavedTrace = createTraceFile(1, 0, debugInfo);
     interleavedTraceMutex = dr_mutex_create();
 }
 
 static void eventExit(void) {
+    metricsExit();
     dr_mutex_destroy(interleavedTraceMutex);
     destroyTraceFile(interleavedTrace);
 
-    dr_raw_tls_cfree(offset, 1);
+    dr_raw_tls_cfree(offset, NUM_TLS_SLOTS);
 
     drmgr_unregister_tls_field(tlsSlot);
+    drmgr_unregister_post_syscall_event(eventPostSyscall);
+    drmgr_unregister_pre_syscall_event(eventPreSyscall);
+    dr_unregister_filter_syscall_event(eventFilterSyscall);
     drmgr_unregister_bb_insertion_event(eventInstr);
+    drmgr_unregister_bb_app2app_event(eventApp2App);
     drmgr_unregister_thread_exit_event(eventThreadExit);
     drmgr_unregister_thread_init_event(eventThreadInit);
     drmgr_unregister_module_unload_event(eventModuleUnload);
     drmgr_unregister_module_load_event(eventModuleLoad);
 
     instrContextDeinit();
+    destroyWatchList();
+    moduleTableExit();
+    if (debugInfo != NULL) {
+        destroyDebugInfo(debugInfo);
+    }
+    if (options.heap) {
+        allocationsExit();
+    }
+    if (options.branches) {
+        predictorsExit();
+    }
     drsym_exit();
+    drx_exit();
+    drutil_exit();
     drmgr_exit();
 }
 
 static void eventModuleLoad(void *drcontext, const module_data_t *info, bool loaded) {
     printf("Loading module: %s\n", info->full_path);
+    addModuleRange(info);
+
+    if (options.heap) {
+        wrapAllocators(info);
+    }
 }
 
 static void eventModuleUnload(void *drcontext, const module_data_t *info) {
     printf("Unloading module: %s\n", info->full_path);
+    removeModuleRange(info);
 }
 
 static void eventThreadInit(void *drcontext) {
@@ -120,17 +280,66 @@ static void eventThreadInit(void *drcontext) {
     data->buf = dr_raw_mem_alloc(BUF_SIZE, DR_MEMPROT_READ | DR_MEMPROT_WRITE,
                                  NULL);
     *(trace_entry_t **)(data->segmBase + offset) = data->buf;
-    data->traceFile = createTraceFile(0);
+    *(uint64_t *)(data->segmBase + offset + COUNTER_SLOT) = 1;
+    *(uint64_t *)(data->segmBase + offset + TIMESTAMP_SLOT) = 0;
+    *(uint64_t *)(data->segmBase + offset + PENDING_WRITE_SLOT) = 0;
+    *(uint64_t *)(data->segmBase + offset + PENDING_ADDR_SLOT) = 0;
+    data->traceFile = createTraceFile(0, dr_get_thread_id(drcontext),
+                                       debugInfo);
+    governorInit(&data->governor);
+    metricsThreadInit(&data->metrics, dr_get_thread_id(drcontext));
+
+    if (options.watchChanges) {
+        createValueShadow(drcontext, &data->shadow);
+    }
+    if (options.branches) {
+        createPredictor(&data->predictor);
+    }
+    if (options.heap) {
+        openAllocationWindow(&data->heapWindow,
+                             (void **)(data->segmBase + offset + BUF_PTR_SLOT),
+                             data->buf);
+    }
 }
 
 static void eventThreadExit(void *drcontext) {
     outputInstr(drcontext);
     thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+    writeLostEntries(drcontext);
+
+    if (data->governor.droppedBuffers != 0) {
+        printf("Thread %i: Dropped %lu of %lu buffers (%lu entries)\n",
+               dr_get_thread_id(drcontext), data->governor.droppedBuffers,
+               data->governor.buffers, data->governor.droppedEntries);
+    }
+
+    if (options.watchChanges) {
+        destroyValueShadow(&data->shadow);
+    }
+    if (options.branches) {
+        destroyPredictor(&data->predictor);
+    }
+    if (options.heap) {
+        closeAllocationWindow(&data->heapWindow);
+    }
+
+    metricsThreadExit(&data->metrics);
+
     destroyTraceFile(data->traceFile);
     dr_raw_mem_free(data->buf, BUF_SIZE);
     dr_thread_free(drcontext, data, sizeof(thread_data_t));
 }
 
+static dr_emit_flags_t eventApp2App(void *drcontext, void *tag,
+    instrlist_t *instrs, bool for_trace, bool translating) {
+
+    bool expanded;
+    drutil_expand_rep_string(drcontext, instrs);
+    drx_expand_scatter_gather(drcontext, instrs, &expanded);
+
+    return DR_EMIT_DEFAULT;
+}
+
 static dr_emit_flags_t eventInstr(void *drcontext, void *tag,
     instrlist_t *instrs, instr_t *nextInstr, bool for_trace, bool translating,
     void *user_data) {
@@ -138,7 +347,28 @@ static dr_emit_flags_t eventInstr(void *drcontext, void *tag,
     if (!instr_is_app(nextInstr)) {
         return DR_EMIT_DEFAULT;
     }
-    
+
+    if (drmgr_is_first_instr(drcontext, nextInstr) && !translating) {
+        thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+        data->metrics.blocks++;
+    }
+
+    // Only writes changing watched values are written, straight from clean
+    // calls, so the buffer is unused
+    if (options.watchChanges) {
+        insertChangeCall(drcontext, instrs, nextInstr);
+        insertChangeInstrumentation(drcontext, instrs, nextInstr, regSegmBase,
+                                    offset);
+        return DR_EMIT_DEFAULT;
+    }
+
+    if (drmgr_is_first_instr(drcontext, nextInstr) &&
+        options.timestampInterval != 0) {
+
+        insertTimestamp(drcontext, instrs, nextInstr, regSegmBase, offset,
+                        options.timestampInterval);
+    }
+
     insertInstrumentation(drcontext, instrs, nextInstr, regSegmBase, offset);
 
     if (drmgr_is_first_instr(drcontext, nextInstr)) {
@@ -154,17 +384,189 @@ static void cleanCall(void) {
 }
 
 static void outputInstr(void *drcontext) {
+    uint64_t start = readTimestamp();
     thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
     trace_entry_t *buf = *(trace_entry_t **)(data->segmBase + offset);
 
-    dr_mutex_lock(interleavedTraceMutex);
-    for (trace_entry_t *curr = data->buf; curr < buf; curr++) {
+    data->metrics.instrs += buf - data->buf;
+    if (buf != data->buf) {
+        data->metrics.flushes++;
+    }
+
+    // Branches are simulated even in buffers the governor drops
+    if (options.branches) {
+        simulateBranches(data, buf);
+    }
+
+    if (!governorEnabled()) {
+        writeInstr(drcontext, buf);
+    } else if (buf != data->buf) {
+        if (governorShouldWrite(&data->governor)) {
+            uint64_t startTime = dr_get_microseconds();
+            uint64_t startBytes = data->traceFile.bytes;
+
+            writeLostEntries(drcontext);
+            writeInstr(drcontext, buf);
+
+            governorFlushed(&data->governor,
+                            dr_get_microseconds() - startTime,
+                            data->traceFile.bytes - startBytes);
+        } else {
+            governorDropped(&data->governor, buf - data->buf);
+        }
+    }
+
+    *(trace_entry_t **)(data->segmBase + offset) = data->buf;
+    if (options.heap) {
+        moveAllocationWindow(&data->heapWindow);
+    }
+
+    data->metrics.outputTicks += readTimestamp() - start;
+    metricsSnapshot();
+}
+
+static void writeInstr(void *drcontext, trace_entry_t *end) {
+    thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+
+    beginWrite(data);
+
+    // Accesses are named by the allocations live since the buffer was emptied
+    if (options.heap) {
+        data->traceFile.heapSince = data->heapWindow.since;
+        interleavedTrace.heapSince = data->heapWindow.since;
+    }
+
+    for (trace_entry_t *curr = data->buf; curr < end; curr++) {
         writeTraceEntry(&data->traceFile, *curr);
 
         thread_id_t tid = dr_get_thread_id(drcontext);
         writeInterleavedTraceEntry(&interleavedTrace, tid, *curr);
     }
+    endWrite(data);
+}
+
+static void writeLostEntries(void *drcontext) {
+    thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+    governor_t *gov = &data->governor;
+    if (gov->pendingBuffers == 0) {
+        return;
+    }
+
+    beginWrite(data);
+    writeLossMarker(&data->traceFile, gov->pendingBuffers, gov->pendingEntries);
+    writeInterleavedLossMarker(&interleavedTrace, dr_get_thread_id(drcontext),
+                               gov->pendingBuffers, gov->pendingEntries);
+    endWrite(data);
+
+    governorClearPending(gov);
+}
+
+static void simulateBranches(thread_data_t *data, trace_entry_t *end) {
+    for (trace_entry_t *curr = data->buf; curr < end; curr++) {
+        if (curr->branch != branchNone) {
+            predictBranch(&data->predictor, curr->pc,
+                          curr->branch == branchTaken);
+        }
+    }
+}
+
+static void beginWrite(thread_data_t *data) {
+    uint64_t start = readTimestamp();
+    dr_mutex_lock(interleavedTraceMutex);
+    data->metrics.mutexWaitTicks += readTimestamp() - start;
+
+    writeStartBytes = data->traceFile.bytes + interleavedTrace.bytes;
+    writeStartSymbolTicks = data->traceFile.symbolTicks +
+                            interleavedTrace.symbolTicks;
+}
+
+static void endWrite(thread_data_t *data) {
+    data->metrics.bytes += data->traceFile.bytes + interleavedTrace.bytes -
+                           writeStartBytes;
+    data->metrics.symbolTicks += data->traceFile.symbolTicks +
+                                 interleavedTrace.symbolTicks -
+                                 writeStartSymbolTicks;
     dr_mutex_unlock(interleavedTraceMutex);
+}
 
-    *(trace_entry_t **)(data->segmBase + offset) = data->buf;
+static void insertChangeCall(void *drcontext, instrlist_t *instrs,
+                             instr_t *nextInstr) {
+
+    // Writes by the last instruction of a block are checked at the next block
+    instr_t *prevInstr = instr_get_prev_app(nextInstr);
+    if (drmgr_is_first_instr(drcontext, nextInstr) ||
+        (prevInstr != NULL && mayChangeWatched(prevInstr))) {
+
+        insertPendingCall(drcontext, instrs, nextInstr, regSegmBase, offset,
+                          changeCall);
+    }
+}
+
+static void changeCall(void) {
+    void *drcontext = dr_get_current_drcontext();
+    checkValueChanges(drcontext);
+}
+
+static void checkValueChanges(void *drcontext) {
+    thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+    app_pc *pendingPc = (app_pc *)(data->segmBase + offset +
+                                   PENDING_WRITE_SLOT);
+    uint64_t *pendingAddr = (uint64_t *)(data->segmBase + offset +
+                                         PENDING_ADDR_SLOT);
+    if (*pendingPc == NULL) {
+        return;
+    }
+
+    dr_mcontext_t mc;
+    mc.size = sizeof(mc);
+    mc.flags = DR_MC_ALL;
+    dr_get_mcontext(drcontext, &mc);
+
+    findValueChanges(&data->shadow, *pendingPc, *pendingAddr, &mc, writeChange,
+                     drcontext);
+    *pendingPc = NULL;
+    *pendingAddr = 0;
+}
+
+static void writeChange(value_change_t *change, void *drcontext) {
+    thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+
+    beginWrite(data);
+    writeValueChange(&data->traceFile, *change);
+    writeInterleavedValueChange(&interleavedTrace,
+                                dr_get_thread_id(drcontext), *change);
+    endWrite(data);
+}
+
+static bool eventFilterSyscall(void *drcontext, int sysnum) {
+    // A thread blocked in a call keeps no freed blocks alive for its entries
+    return syscallTraced(drcontext, sysnum) || options.heap;
+}
+
+static bool eventPreSyscall(void *drcontext, int sysnum) {
+    // Flushing first places the call exactly after the entries before it
+    outputInstr(drcontext);
+    if (!syscallTraced(drcontext, sysnum)) {
+        return true;
+    }
+
+    thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+    beginSyscall(drcontext, sysnum, &data->syscall);
+    return true;
+}
+
+static void eventPostSyscall(void *drcontext, int sysnum) {
+    if (!syscallTraced(drcontext, sysnum)) {
+        return;
+    }
+
+    thread_data_t *data = drmgr_get_tls_field(drcontext, tlsSlot);
+    endSyscall(drcontext, &data->syscall);
+    data->syscall.instrs = data->traceFile.entries;
+
+    beginWrite(data);
+    writeSyscall(&data->traceFile, data->syscall);
+    writeInterleavedSyscall(&interleavedTrace, dr_get_thread_id(drcontext),
+                            data->syscall);
+    endWrite(data);
 }
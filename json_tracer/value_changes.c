@@ -0,0 +1,289 @@
+#include <string.h>
+
+#include "dr_api.h"
+
+#include "value_changes.h"
+#include "watch.h"
+#include "options.h"
+#include "timestamps.h"
+
+static const debug_info_t *debugInfo;
+static void *mainSegmBase;
+
+/*
+ * Returns the size of the largest memory destination of an instruction, or 0
+ * if it is unknown
+ */
+static uint64_t getWriteSize(instr_t *instr);
+
+/*
+ * Compares a span of bytes of a watched variable at a given address with its
+ * last-seen value
+ */
+static void compareVariable(value_shadow_t *shadow, int i, uint64_t addr,
+                            uint64_t start, uint64_t end,
+                            value_change_t *change, change_callback_t onChange,
+                            void *arg);
+
+/*
+ * Compares a watched register with its last-seen value
+ */
+static void compareRegister(value_shadow_t *shadow, int i, dr_mcontext_t *mc,
+                            value_change_t *change, change_callback_t onChange,
+                            void *arg);
+
+/*
+ * Reports the changed bytes between an old and new value at a given offset
+ * into a variable, with the old value unknown if given as NULL, as a single
+ * change if it fits in one and as changes to each span of differing bytes
+ * otherwise
+ */
+static void reportChanges(const uint8_t *old, const uint8_t *new,
+                          uint64_t offset, uint64_t size,
+                          value_change_t *change, change_callback_t onChange,
+                          void *arg);
+
+void valueChangesInit(const debug_info_t *info, void *segmBase) {
+    debugInfo = info;
+    mainSegmBase = segmBase;
+}
+
+void createValueShadow(void *drcontext, value_shadow_t *shadow) {
+    shadow->drcontext = drcontext;
+
+    int vars = watchList.sizeRanges, regs = watchList.sizeRegs;
+    shadow->vars = dr_thread_alloc(drcontext, vars * sizeof(uint8_t *));
+    shadow->varAddrs = dr_thread_alloc(drcontext, vars * sizeof(uint64_t));
+    shadow->regs = dr_thread_alloc(drcontext, regs * MAX_VALUE_SIZE);
+    shadow->regsSeen = dr_thread_alloc(drcontext, regs * sizeof(bool));
+
+    shadow->scratchSize = MAX_VALUE_SIZE;
+    for (int i = 0; i < vars; i++) {
+        watch_range_t *range = &watchList.ranges[i];
+        shadow->vars[i] = dr_thread_alloc(drcontext, range->size);
+
+        // Static variables can be seen before they are first written
+        shadow->varAddrs[i] = 0;
+        if (!range->isLocal &&
+            dr_safe_read((void *)range->start, range->size, shadow->vars[i],
+                         NULL)) {
+
+            shadow->varAddrs[i] = range->start;
+        }
+
+        if (range->size > shadow->scratchSize) {
+            shadow->scratchSize = range->size;
+        }
+    }
+
+    for (int i = 0; i < regs; i++) {
+        shadow->regsSeen[i] = false;
+    }
+
+    shadow->scratch = dr_thread_alloc(drcontext, shadow->scratchSize);
+}
+
+void destroyValueShadow(value_shadow_t *shadow) {
+    void *drcontext = shadow->drcontext;
+    int vars = watchList.sizeRanges, regs = watchList.sizeRegs;
+
+    for (int i = 0; i < vars; i++) {
+        dr_thread_free(drcontext, shadow->vars[i], watchList.ranges[i].size);
+    }
+
+    dr_thread_free(drcontext, shadow->vars, vars * sizeof(uint8_t *));
+    dr_thread_free(drcontext, shadow->varAddrs, vars * sizeof(uint64_t));
+    dr_thread_free(drcontext, shadow->regs, regs * MAX_VALUE_SIZE);
+    dr_thread_free(drcontext, shadow->regsSeen, regs * sizeof(bool));
+    dr_thread_free(drcontext, shadow->scratch, shadow->scratchSize);
+}
+
+void findValueChanges(value_shadow_t *shadow, app_pc pc, uint64_t writeAddr,
+                      dr_mcontext_t *mc, change_callback_t onChange,
+                      void *arg) {
+
+    instr_t instr;
+    instr_init(shadow->drcontext, &instr);
+    if (decode(shadow->drcontext, pc, &instr) == NULL) {
+        instr_free(shadow->drcontext, &instr);
+        return;
+    }
+
+    value_change_t change;
+    change.pc = (uint64_t)pc;
+    change.tsc = options.timestampInterval != 0 ? readTimestamp() : 0;
+
+    // Locals are only watched within the frame of their own function
+    int func = -1;
+    if (debugInfo != NULL) {
+        func = getFunctionIndex(debugInfo, pc, mainSegmBase);
+    }
+    uint64_t bp = reg_get_value(DR_REG_RBP, mc);
+
+    // Only the written bytes are compared, so writes by other threads are
+    // never given this PC, with a write of unknown size comparing the whole of
+    // each variable it starts in
+    uint64_t writeSize = getWriteSize(&instr);
+    for (int i = 0; writeAddr != 0 && i < watchList.sizeRanges; i++) {
+        watch_range_t *range = &watchList.ranges[i];
+        if (range->isLocal && range->func != func) {
+            continue;
+        }
+
+        uint64_t addr = range->isLocal ? bp + range->start : range->start;
+        uint64_t writeEnd = writeSize != 0 ? writeAddr + writeSize
+                                           : writeAddr + 1;
+        if (writeEnd <= addr || writeAddr >= addr + range->size) {
+            continue;
+        }
+
+        uint64_t start = 0, end = range->size;
+        if (writeSize != 0) {
+            start = writeAddr > addr ? writeAddr - addr : 0;
+            end = writeEnd < addr + range->size ? writeEnd - addr : end;
+        }
+        compareVariable(shadow, i, addr, start, end, &change, onChange, arg);
+    }
+
+    for (int i = 0; i < watchList.sizeRegs; i++) {
+        if (instr_writes_to_reg(&instr, watchList.regs[i],
+                                DR_QUERY_INCLUDE_COND_DSTS)) {
+
+            compareRegister(shadow, i, mc, &change, onChange, arg);
+        }
+    }
+
+    instr_free(shadow->drcontext, &instr);
+}
+
+static uint64_t getWriteSize(instr_t *instr) {
+    uint64_t size = 0;
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        opnd_t opnd = instr_get_dst(instr, i);
+        if (!opnd_is_memory_reference(opnd)) {
+            continue;
+        }
+
+        uint64_t opndSize = opnd_size_in_bytes(opnd_get_size(opnd));
+        if (opndSize == 0) {
+            return 0;
+        } else if (opndSize > size) {
+            size = opndSize;
+        }
+    }
+
+    return size;
+}
+
+static void compareVariable(value_shadow_t *shadow, int i, uint64_t addr,
+                            uint64_t start, uint64_t end,
+                            value_change_t *change, change_callback_t onChange,
+                            void *arg) {
+
+    watch_range_t *range = &watchList.ranges[i];
+    uint8_t *seen = shadow->vars[i];
+
+    change->isReg = 0;
+    change->varId = range->varId;
+    change->addr = addr + start;
+
+    // The last-seen value of a local belongs to another frame if it moved, so
+    // the whole of it is seen again and only the written bytes are reported
+    if (shadow->varAddrs[i] != addr) {
+        if (!dr_safe_read((void *)addr, range->size, seen, NULL)) {
+            shadow->varAddrs[i] = 0;
+            return;
+        }
+
+        shadow->varAddrs[i] = addr;
+        reportChanges(NULL, seen + start, start, end - start, change, onChange,
+                      arg);
+        return;
+    }
+
+    if (!dr_safe_read((void *)(addr + start), end - start, shadow->scratch,
+                      NULL)) {
+        return;
+    }
+
+    reportChanges(seen + start, shadow->scratch, start, end - start, change,
+                  onChange, arg);
+    memcpy(seen + start, shadow->scratch, end - start);
+}
+
+static void compareRegister(value_shadow_t *shadow, int i, dr_mcontext_t *mc,
+                            value_change_t *change, change_callback_t onChange,
+                            void *arg) {
+
+    reg_id_t reg = watchList.regs[i];
+    uint64_t size = opnd_size_in_bytes(reg_get_size(reg));
+    uint8_t *seen = shadow->regs + i * MAX_VALUE_SIZE;
+
+    uint8_t val[MAX_VALUE_SIZE];
+    if (size == 0 || size > MAX_VALUE_SIZE || !reg_get_value_ex(reg, mc, val)) {
+        return;
+    }
+
+    change->isReg = 1;
+    change->regName = (uint64_t)get_register_name(reg);
+    change->varId = VAR_ID_NONE;
+    change->addr = 0;
+    reportChanges(shadow->regsSeen[i] ? seen : NULL, val, 0, size, change,
+                  onChange, arg);
+
+    memcpy(seen, val, size);
+    shadow->regsSeen[i] = true;
+}
+
+static void reportChanges(const uint8_t *old, const uint8_t *new,
+                          uint64_t offset, uint64_t size,
+                          value_change_t *change, change_callback_t onChange,
+                          void *arg) {
+
+    uint64_t addr = change->addr;
+
+    if (size <= MAX_VALUE_SIZE) {
+        if (old != NULL && memcmp(old, new, size) == 0) {
+            return;
+        }
+
+        change->offset = offset;
+        change->size = size;
+        change->oldNull = old == NULL;
+        if (old != NULL) {
+            memcpy(change->oldBytes, old, size);
+        }
+        memcpy(change->newBytes, new, size);
+        onChange(change, arg);
+        return;
+    }
+
+    // Report each span of changed bytes of larger values, up to the size of a
+    // value at a time
+    uint64_t i = 0;
+    while (i < size) {
+        if (old != NULL && old[i] == new[i]) {
+            i++;
+            continue;
+        }
+
+        uint64_t end = i + 1;
+        for (uint64_t j = i + 1; j < size && j < i + MAX_VALUE_SIZE; j++) {
+            if (old == NULL || old[j] != new[j]) {
+                end = j + 1;
+            }
+        }
+
+        change->offset = offset + i;
+        change->addr = addr + i;
+        change->size = end - i;
+        change->oldNull = old == NULL;
+        if (old != NULL) {
+            memcpy(change->oldBytes, old + i, end - i);
+        }
+        memcpy(change->newBytes, new + i, end - i);
+        onChange(change, arg);
+
+        i = end;
+    }
+}
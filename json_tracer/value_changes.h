@@ -0,0 +1,50 @@
+#ifndef VALUE_CHANGES_H
+#define VALUE_CHANGES_H
+
+#include <inttypes.h>
+
+#include "dr_api.h"
+
+#include "trace_entry.h"
+#include "debug_info.h"
+
+typedef struct {
+    void *drcontext;
+    uint8_t **vars;
+    uint64_t *varAddrs;
+    uint8_t *regs;
+    bool *regsSeen;
+    uint8_t *scratch;
+    uint64_t scratchSize;
+} value_shadow_t;
+
+typedef void (*change_callback_t)(value_change_t *change, void *arg);
+
+/*
+ * Sets the debugging information and segment base of the main module used to
+ * find the function of each write
+ */
+void valueChangesInit(const debug_info_t *info, void *segmBase);
+
+/*
+ * Creates the last-seen values of watched variables and registers for a
+ * thread, seeing the current values of static variables
+ */
+void createValueShadow(void *drcontext, value_shadow_t *shadow);
+
+/*
+ * Frees the last-seen values of a thread
+ */
+void destroyValueShadow(value_shadow_t *shadow);
+
+/*
+ * Compares the bytes of watched variables and the watched registers written by
+ * the instruction at the given PC, which wrote memory at the given address or
+ * 0 for none, with their last-seen values, calling a function with each change
+ * found and updating the last-seen values
+ */
+void findValueChanges(value_shadow_t *shadow, app_pc pc, uint64_t writeAddr,
+                      dr_mcontext_t *mc, change_callback_t onChange,
+                      void *arg);
+
+#endif
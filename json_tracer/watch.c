@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "dr_api.h"
+
+#include "watch.h"
+
+#define MAX_NAME_LENGTH 256
+
+watch_list_t watchList;
+
+/*
+ * Copies the next name of a comma-separated list, moving past it, returning 0
+ * on success
+ */
+static int nextName(const char **names, char *name);
+
+/*
+ * Adds the ranges of all variables with a given name, returning the number
+ * added
+ */
+static int watchVariable(const char *name, debug_info_t *info,
+                         void *segmBase);
+
+/*
+ * Appends a range to the watch list
+ */
+static void appendRange(watch_range_t range);
+
+/*
+ * Appends a register to the watch list
+ */
+static void appendRegister(reg_id_t reg);
+
+int initWatchList(const char *names, debug_info_t *info, void *segmBase) {
+    if (info == NULL) {
+        fprintf(stderr, "Error: Watching variables requires debugging "
+                        "information for the main module\n");
+        return 1;
+    }
+
+    char name[MAX_NAME_LENGTH];
+    while (*names != '\0') {
+        if (nextName(&names, name)) {
+            return 1;
+        }
+
+        if (name[0] != '\0' && watchVariable(name, info, segmBase) == 0) {
+            fprintf(stderr, "Error: Could not find variable %s\n", name);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int initWatchedRegisters(const char *names) {
+    char name[MAX_NAME_LENGTH];
+    while (*names != '\0') {
+        if (nextName(&names, name)) {
+            return 1;
+        }
+
+        if (name[0] == '\0') {
+            continue;
+        }
+
+        reg_id_t reg = DR_REG_NULL;
+        for (reg_id_t curr = DR_REG_NULL + 1; curr <= DR_REG_LAST_VALID_ENUM;
+             curr++) {
+
+            if (strcmp(get_register_name(curr), name) == 0) {
+                reg = curr;
+                break;
+            }
+        }
+
+        if (reg == DR_REG_NULL) {
+            fprintf(stderr, "Error: Unknown register %s\n", name);
+            return 1;
+        }
+
+        appendRegister(reg);
+    }
+
+    return 0;
+}
+
+void destroyWatchList() {
+    if (watchList.ranges != NULL) {
+        dr_global_free(watchList.ranges,
+                       watchList.capacityRanges * sizeof(watch_range_t));
+    }
+
+    if (watchList.regs != NULL) {
+        dr_global_free(watchList.regs,
+                       watchList.capacityRegs * sizeof(reg_id_t));
+    }
+
+    watchList.ranges = NULL;
+    watchList.sizeRanges = 0;
+    watchList.capacityRanges = 0;
+    watchList.regs = NULL;
+    watchList.sizeRegs = 0;
+    watchList.capacityRegs = 0;
+}
+
+int watchListEnabled() {
+    return watchList.sizeRanges != 0 || watchList.sizeRegs != 0;
+}
+
+int isWatchedVariable(uint64_t varId) {
+    for (int i = 0; i < watchList.sizeRanges; i++) {
+        if (watchList.ranges[i].varId == varId) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int usesWatchedRegister(instr_t *instr, int writesOnly) {
+    for (int i = 0; i < watchList.sizeRegs; i++) {
+        reg_id_t reg = watchList.regs[i];
+        if (writesOnly ? instr_writes_to_reg(instr, reg,
+                                             DR_QUERY_INCLUDE_COND_DSTS)
+                       : instr_uses_reg(instr, reg)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int nextName(const char **names, char *name) {
+    size_t length = strcspn(*names, ",");
+    if (length >= MAX_NAME_LENGTH) {
+        fprintf(stderr, "Error: Watched name is too long\n");
+        return 1;
+    }
+
+    memcpy(name, *names, length);
+    name[length] = '\0';
+
+    *names += length;
+    if (**names == ',') {
+        (*names)++;
+    }
+
+    return 0;
+}
+
+static int watchVariable(const char *name, debug_info_t *info,
+                         void *segmBase) {
+    int added = 0;
+
+    for (int i = 0; i < info->sizeVars; i++) {
+        static_variable_t *var = &info->vars[i];
+        if (strcmp(var->varInfo.varName, name) != 0) {
+            continue;
+        }
+
+        watch_range_t range;
+        range.varId = (uint64_t)i + 1;
+        range.isLocal = 0;
+        range.func = -1;
+        range.start = (int64_t)(segmBase + (size_t)var->addr);
+        range.size = var->varInfo.type.size != 0 ? var->varInfo.type.size : 1;
+        appendRange(range);
+        added++;
+    }
+
+    // Locals are found relative to RBP in the frame of their own function
+    for (int i = 0; i < info->sizeFuncs; i++) {
+        function_info_t *func = &info->funcs[i];
+
+        for (int j = 0; j < func->sizeVars; j++) {
+            local_variable_t *var = &func->vars[j];
+            if (strcmp(var->varInfo.varName, name) != 0) {
+                continue;
+            }
+
+            watch_range_t range;
+            range.varId = VAR_ID_LOCAL | (uint64_t)i << 32 | (uint64_t)j;
+            range.isLocal = 1;
+            range.func = i;
+            range.start = var->offset + FRAME_BASE_OFFSET;
+            range.size = var->varInfo.type.size != 0 ?
+                         var->varInfo.type.size : 1;
+            appendRange(range);
+            added++;
+        }
+    }
+
+    return added;
+}
+
+static void appendRange(watch_range_t range) {
+    if (watchList.sizeRanges == watchList.capacityRanges) {
+        int capacity = watchList.capacityRanges == 0 ?
+                       16 : 2 * watchList.capacityRanges;
+        watch_range_t *ranges = dr_global_alloc(capacity *
+                                                sizeof(watch_range_t));
+
+        if (watchList.ranges != NULL) {
+            memcpy(ranges, watchList.ranges,
+                   watchList.sizeRanges * sizeof(watch_range_t));
+            dr_global_free(watchList.ranges,
+                           watchList.capacityRanges * sizeof(watch_range_t));
+        }
+
+        watchList.ranges = ranges;
+        watchList.capacityRanges = capacity;
+    }
+
+    watchList.ranges[watchList.sizeRanges++] = range;
+}
+
+static void appendRegister(reg_id_t reg) {
+    if (watchList.sizeRegs == watchList.capacityRegs) {
+        int capacity = watchList.capacityRegs == 0 ?
+                       16 : 2 * watchList.capacityRegs;
+        reg_id_t *regs = dr_global_alloc(capacity * sizeof(reg_id_t));
+
+        if (watchList.regs != NULL) {
+            memcpy(regs, watchList.regs, watchList.sizeRegs * sizeof(reg_id_t));
+            dr_global_free(watchList.regs,
+                           watchList.capacityRegs * sizeof(reg_id_t));
+        }
+
+        watchList.regs = regs;
+        watchList.capacityRegs = capacity;
+    }
+
+    watchList.regs[watchList.sizeRegs++] = reg;
+}
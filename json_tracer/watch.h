@@ -0,0 +1,65 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <inttypes.h>
+
+#include "dr_api.h"
+
+#include "debug_info.h"
+
+typedef struct {
+    uint64_t varId;
+    int isLocal;
+    int func;
+    int64_t start;
+    uint64_t size;
+} watch_range_t;
+
+typedef struct {
+    watch_range_t *ranges;
+    int sizeRanges, capacityRanges;
+    reg_id_t *regs;
+    int sizeRegs, capacityRegs;
+} watch_list_t;
+
+/*
+ * The ranges of all watched variables, where static variables start at their
+ * address and locals of a function start at an offset from RBP, and all
+ * watched registers
+ */
+extern watch_list_t watchList;
+
+/*
+ * Resolves a comma-separated list of variable names to the ranges they occupy
+ * in the main module starting at the given segment base, returning 0 on
+ * success
+ */
+int initWatchList(const char *names, debug_info_t *info, void *segmBase);
+
+/*
+ * Resolves a comma-separated list of register names, returning 0 on success
+ */
+int initWatchedRegisters(const char *names);
+
+/*
+ * Frees the watched ranges and registers
+ */
+void destroyWatchList();
+
+/*
+ * Returns whether only accesses to watched variables and registers are traced
+ */
+int watchListEnabled();
+
+/*
+ * Returns whether the variable with the given ID is watched
+ */
+int isWatchedVariable(uint64_t varId);
+
+/*
+ * Returns whether an instruction uses any watched register, only counting
+ * writes if given
+ */
+int usesWatchedRegister(instr_t *instr, int writesOnly);
+
+#endif
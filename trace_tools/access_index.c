@@ -0,0 +1,706 @@
+#define _GNU_SOURCE
+
+#include "access_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace_lines.h"
+
+#define MIN_CAPACITY 16
+#define INDEX_MAGIC "PCTDAIX2"
+
+// Postings are sorted in runs of at most 56 MiB, merged a block at a time
+#define RUN_POSTINGS (1 << 20)
+#define MERGE_POSTINGS 1024
+
+typedef struct {
+    index_posting_t *buf;
+    uint64_t pos, size;
+    uint64_t offset, remaining;
+} run_reader_t;
+
+typedef struct {
+    run_reader_t *readers;
+    int *heap;
+    int sizeHeap;
+    int fd;
+    index_posting_t current;
+} run_merger_t;
+
+typedef struct {
+    FILE *lines;
+    index_key_t *vars;
+    index_key_t current;
+    int hasCurrent;
+    uint64_t currentIsVar;
+    uint64_t numLines, numVars, numPostings;
+} key_writer_t;
+
+/*
+ * Appends a posting of an access under a key, returning 0 on success
+ */
+static int appendPosting(index_builder_t *builder, uint64_t key, int isVar,
+                         int isWrite, const indexed_access_t *access);
+
+/*
+ * Gets the ID of a variable by name, adding it if it is not yet seen,
+ * returning -1 on error
+ */
+static int internName(index_builder_t *builder, const char *name,
+                      size_t length);
+
+/*
+ * Frees the builder of an index
+ */
+static void destroyIndexBuilder(index_builder_t *builder);
+
+/*
+ * Sorts the postings held in memory and appends them to the temporary file as
+ * a run, returning 0 on success
+ */
+static int spillRun(index_builder_t *builder);
+
+/*
+ * Starts merging the runs in the temporary file with the sorted postings held
+ * in memory, returning 0 on success
+ */
+static int initMerger(index_builder_t *builder, run_merger_t *merger);
+
+/*
+ * Frees the buffers of a merger
+ */
+static void destroyMerger(index_builder_t *builder, run_merger_t *merger);
+
+/*
+ * Takes the next posting in sorted order from a merger, returning NULL once
+ * every run is merged or on error, given by the error flag
+ */
+static const index_posting_t *nextPosting(run_merger_t *merger, int *error);
+
+/*
+ * Gets the next posting of a run, reading its next block if needed, returning
+ * NULL at its end or on error, given by the error flag
+ */
+static const index_posting_t *peekRun(run_reader_t *reader, int fd,
+                                      int *error);
+
+/*
+ * Moves a run down the heap of a merger to its place
+ */
+static void siftDown(run_merger_t *merger, int i);
+
+/*
+ * Counts a posting, in sorted order, towards the key it belongs to, writing
+ * out the previous key once it is complete, returning 0 on success
+ */
+static int addKeyPosting(key_writer_t *writer, const index_posting_t *posting);
+
+/*
+ * Writes out the key being built, with those of lines written to the lines
+ * file and those of variables kept, returning 0 on success
+ */
+static int finishKey(key_writer_t *writer);
+
+/*
+ * Appends the contents of a file from its start to another, returning 0 on
+ * success
+ */
+static int copyFile(FILE *from, FILE *to);
+
+/*
+ * Compares postings by kind of key, key, kind of access and entry
+ */
+static int comparePostings(const void *a, const void *b);
+
+/*
+ * Compares the keys of variables by the names they are given in a table
+ */
+static int compareVariables(const void *a, const void *b, void *names);
+
+/*
+ * Fills in the accesses of a key
+ */
+static void getAccessList(const access_index_t *index, const index_key_t *key,
+                          access_list_t *list);
+
+void initIndexBuilder(index_builder_t *builder) {
+    memset(builder, 0, sizeof(index_builder_t));
+}
+
+int addAccess(const trace_access_t *access, void *arg) {
+    index_builder_t *builder = arg;
+    if (access->kind == kindNone) {
+        return 0;
+    }
+
+    indexed_access_t indexed;
+    indexed.entry = access->entry;
+    indexed.pc = access->pc;
+    indexed.address = access->address;
+    indexed.tid = (int32_t)access->tid;
+    indexed.size = access->size == 0 ? 1 : (uint32_t)access->size;
+
+    builder->numAccesses++;
+
+    int isWrite = access->kind == kindStore;
+    uint64_t firstLine = access->address >> INDEX_LINE_SHIFT;
+    uint64_t lastLine = (access->address + indexed.size - 1) >> INDEX_LINE_SHIFT;
+    for (uint64_t line = firstLine; line <= lastLine; line++) {
+        if (appendPosting(builder, line, 0, isWrite, &indexed)) {
+            return 1;
+        }
+    }
+
+    if (access->variable != NULL) {
+        int id = internName(builder, access->variable, access->variableLength);
+        if (id < 0 || appendPosting(builder, id, 1, isWrite, &indexed)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int writeIndex(index_builder_t *builder, const char *path) {
+    uint64_t namesSize = 0;
+    for (int i = 0; i < builder->sizeNames; i++) {
+        namesSize += strlen(builder->names[i]) + 1;
+    }
+
+    key_writer_t writer;
+    memset(&writer, 0, sizeof(key_writer_t));
+    writer.lines = tmpfile();
+    writer.vars = malloc((builder->sizeNames + 1) * sizeof(index_key_t));
+    char *names = malloc(namesSize + 1);
+    FILE *file = fopen(path, "wb");
+
+    run_merger_t merger;
+    int merging = writer.lines != NULL && writer.vars != NULL &&
+                  names != NULL && file != NULL &&
+                  initMerger(builder, &merger) == 0;
+
+    // The counts in the header are only known after the accesses, which are
+    // written as they are merged
+    index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, 8);
+
+    int res = !merging || fwrite(&header, sizeof(header), 1, file) != 1;
+    int error = 0;
+    const index_posting_t *posting;
+    while (!res && (posting = nextPosting(&merger, &error)) != NULL) {
+        res = fwrite(&posting->access, sizeof(indexed_access_t), 1, file) != 1 ||
+              addKeyPosting(&writer, posting);
+    }
+    res = res || error || finishKey(&writer);
+
+    if (merging) {
+        destroyMerger(builder, &merger);
+    }
+
+    // Variables are keyed by the offsets of their names, sorted by name
+    if (!res) {
+        uint64_t nameOffsets[builder->sizeNames + 1];
+        uint64_t offset = 0;
+        for (int i = 0; i < builder->sizeNames; i++) {
+            nameOffsets[i] = offset;
+            strcpy(names + offset, builder->names[i]);
+            offset += strlen(builder->names[i]) + 1;
+        }
+
+        for (uint64_t i = 0; i < writer.numVars; i++) {
+            writer.vars[i].key = nameOffsets[writer.vars[i].key];
+        }
+        qsort_r(writer.vars, writer.numVars, sizeof(index_key_t),
+                compareVariables, names);
+
+        header.numLines = writer.numLines;
+        header.numVars = writer.numVars;
+        header.numAccesses = writer.numPostings;
+        header.namesSize = namesSize;
+
+        res = copyFile(writer.lines, file) ||
+              fwrite(writer.vars, sizeof(index_key_t), writer.numVars, file) !=
+              writer.numVars ||
+              fwrite(names, 1, namesSize, file) != namesSize ||
+              fseek(file, 0, SEEK_SET) != 0 ||
+              fwrite(&header, sizeof(header), 1, file) != 1;
+    }
+
+    if (file != NULL) {
+        res = fclose(file) != 0 || res;
+    }
+    if (writer.lines != NULL) {
+        fclose(writer.lines);
+    }
+
+    free(writer.vars);
+    free(names);
+    destroyIndexBuilder(builder);
+    return res;
+}
+
+int openIndex(const char *path, access_index_t *index) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_header_t)) {
+        close(fd);
+        return 1;
+    }
+
+    index->mapSize = st.st_size;
+    index->map = mmap(NULL, index->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        return 1;
+    }
+
+    index->header = index->map;
+    const index_header_t *header = index->header;
+    uint64_t size = sizeof(index_header_t) +
+                    (header->numLines + header->numVars) * sizeof(index_key_t) +
+                    header->numAccesses * sizeof(indexed_access_t) +
+                    header->namesSize;
+
+    if (memcmp(header->magic, INDEX_MAGIC, 8) != 0 || size != index->mapSize) {
+        munmap(index->map, index->mapSize);
+        return 1;
+    }
+
+    index->accesses = (const indexed_access_t *)(header + 1);
+    index->lines = (const index_key_t *)(index->accesses +
+                                         header->numAccesses);
+    index->vars = index->lines + header->numLines;
+    index->names = (const char *)(index->vars + header->numVars);
+    return 0;
+}
+
+void closeIndex(access_index_t *index) {
+    munmap(index->map, index->mapSize);
+}
+
+int findLineAccesses(const access_index_t *index, uint64_t address,
+                     access_list_t *list) {
+
+    uint64_t line = address >> INDEX_LINE_SHIFT;
+    uint64_t low = 0, high = index->header->numLines;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (index->lines[mid].key < line) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == index->header->numLines || index->lines[low].key != line) {
+        return 1;
+    }
+
+    getAccessList(index, &index->lines[low], list);
+    return 0;
+}
+
+int findVariableAccesses(const access_index_t *index, const char *name,
+                         access_list_t *list) {
+
+    uint64_t low = 0, high = index->header->numVars;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        int cmp = strcmp(index->names + index->vars[mid].key, name);
+        if (cmp == 0) {
+            getAccessList(index, &index->vars[mid], list);
+            return 0;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return 1;
+}
+
+uint64_t findEntry(const indexed_access_t *accesses, uint64_t numAccesses,
+                   uint64_t entry) {
+
+    uint64_t low = 0, high = numAccesses;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (accesses[mid].entry < entry) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static int appendPosting(index_builder_t *builder, uint64_t key, int isVar,
+                         int isWrite, const indexed_access_t *access) {
+
+    if (builder->sizePostings == RUN_POSTINGS && spillRun(builder)) {
+        return 1;
+    }
+
+    if (builder->sizePostings == builder->capacityPostings) {
+        uint64_t capacity = builder->capacityPostings == 0 ?
+                            MIN_CAPACITY : 2 * builder->capacityPostings;
+        index_posting_t *postings = reallocarray(builder->postings, capacity,
+                                                 sizeof(index_posting_t));
+        if (postings == NULL) {
+            return 1;
+        }
+
+        builder->postings = postings;
+        builder->capacityPostings = capacity;
+    }
+
+    index_posting_t *posting = &builder->postings[builder->sizePostings++];
+    posting->key = key;
+    posting->isVar = isVar;
+    posting->isWrite = isWrite;
+    posting->access = *access;
+    return 0;
+}
+
+static int internName(index_builder_t *builder, const char *name,
+                      size_t length) {
+
+    if (2 * builder->sizeNames >= builder->capacityNameTable) {
+        int capacity = builder->capacityNameTable == 0 ?
+                       MIN_CAPACITY : 2 * builder->capacityNameTable;
+        int *table = calloc(capacity, sizeof(int));
+        if (table == NULL) {
+            return -1;
+        }
+
+        for (int i = 0; i < builder->sizeNames; i++) {
+            const char *other = builder->names[i];
+            uint64_t slot = hashName(other, strlen(other)) & (capacity - 1);
+            while (table[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table[slot] = i + 1;
+        }
+
+        free(builder->nameTable);
+        builder->nameTable = table;
+        builder->capacityNameTable = capacity;
+    }
+
+    // Slots hold one more than the ID of a name, with 0 for an empty slot
+    int mask = builder->capacityNameTable - 1;
+    uint64_t slot = hashName(name, length) & mask;
+    for (; builder->nameTable[slot] != 0; slot = (slot + 1) & mask) {
+        const char *other = builder->names[builder->nameTable[slot] - 1];
+        if (strncmp(other, name, length) == 0 && other[length] == '\0') {
+            return builder->nameTable[slot] - 1;
+        }
+    }
+
+    if (builder->sizeNames == builder->capacityNames) {
+        int capacity = builder->capacityNames == 0 ? MIN_CAPACITY
+                                                   : 2 * builder->capacityNames;
+        char **names = reallocarray(builder->names, capacity, sizeof(char *));
+        if (names == NULL) {
+            return -1;
+        }
+
+        builder->names = names;
+        builder->capacityNames = capacity;
+    }
+
+    char *copy = strndup(name, length);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    builder->names[builder->sizeNames++] = copy;
+    builder->nameTable[slot] = builder->sizeNames;
+    return builder->sizeNames - 1;
+}
+
+static void destroyIndexBuilder(index_builder_t *builder) {
+    for (int i = 0; i < builder->sizeNames; i++) {
+        free(builder->names[i]);
+    }
+
+    free(builder->names);
+    free(builder->nameTable);
+    free(builder->postings);
+    free(builder->runSizes);
+    if (builder->runs != NULL) {
+        fclose(builder->runs);
+    }
+}
+
+static int spillRun(index_builder_t *builder) {
+    if (builder->runs == NULL && (builder->runs = tmpfile()) == NULL) {
+        return 1;
+    }
+
+    if (builder->sizeRuns == builder->capacityRuns) {
+        int capacity = builder->capacityRuns == 0 ? MIN_CAPACITY
+                                                  : 2 * builder->capacityRuns;
+        uint64_t *runSizes = reallocarray(builder->runSizes, capacity,
+                                          sizeof(uint64_t));
+        if (runSizes == NULL) {
+            return 1;
+        }
+
+        builder->runSizes = runSizes;
+        builder->capacityRuns = capacity;
+    }
+
+    qsort(builder->postings, builder->sizePostings, sizeof(index_posting_t),
+          comparePostings);
+    if (fwrite(builder->postings, sizeof(index_posting_t),
+               builder->sizePostings, builder->runs) != builder->sizePostings) {
+        return 1;
+    }
+
+    builder->runSizes[builder->sizeRuns++] = builder->sizePostings;
+    builder->sizePostings = 0;
+    return 0;
+}
+
+static int initMerger(index_builder_t *builder, run_merger_t *merger) {
+    qsort(builder->postings, builder->sizePostings, sizeof(index_posting_t),
+          comparePostings);
+
+    // The postings still in memory are the last run
+    int numRuns = builder->sizeRuns + 1;
+    merger->readers = calloc(numRuns, sizeof(run_reader_t));
+    merger->heap = malloc(numRuns * sizeof(int));
+    merger->sizeHeap = 0;
+    merger->fd = -1;
+    if (merger->readers == NULL || merger->heap == NULL ||
+        (builder->runs != NULL && fflush(builder->runs) != 0)) {
+
+        destroyMerger(builder, merger);
+        return 1;
+    }
+
+    if (builder->runs != NULL) {
+        merger->fd = fileno(builder->runs);
+    }
+
+    uint64_t offset = 0;
+    for (int i = 0; i < builder->sizeRuns; i++) {
+        run_reader_t *reader = &merger->readers[i];
+        reader->buf = malloc(MERGE_POSTINGS * sizeof(index_posting_t));
+        if (reader->buf == NULL) {
+            destroyMerger(builder, merger);
+            return 1;
+        }
+
+        reader->offset = offset;
+        reader->remaining = builder->runSizes[i];
+        offset += builder->runSizes[i] * sizeof(index_posting_t);
+    }
+
+    run_reader_t *last = &merger->readers[builder->sizeRuns];
+    last->buf = builder->postings;
+    last->size = builder->sizePostings;
+
+    // Each run starts in the heap, keyed by its next posting
+    int error = 0;
+    for (int i = 0; i < numRuns; i++) {
+        if (peekRun(&merger->readers[i], merger->fd, &error) != NULL) {
+            merger->heap[merger->sizeHeap++] = i;
+        }
+    }
+    for (int i = merger->sizeHeap / 2 - 1; i >= 0; i--) {
+        siftDown(merger, i);
+    }
+
+    if (error) {
+        destroyMerger(builder, merger);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void destroyMerger(index_builder_t *builder, run_merger_t *merger) {
+    for (int i = 0; merger->readers != NULL && i < builder->sizeRuns; i++) {
+        free(merger->readers[i].buf);
+    }
+
+    free(merger->readers);
+    free(merger->heap);
+    merger->readers = NULL;
+    merger->heap = NULL;
+}
+
+static const index_posting_t *nextPosting(run_merger_t *merger, int *error) {
+    if (merger->sizeHeap == 0) {
+        return NULL;
+    }
+
+    // The posting is copied out before its run's next block replaces it
+    run_reader_t *reader = &merger->readers[merger->heap[0]];
+    merger->current = reader->buf[reader->pos++];
+
+    if (peekRun(reader, merger->fd, error) == NULL) {
+        merger->heap[0] = merger->heap[--merger->sizeHeap];
+    }
+    siftDown(merger, 0);
+
+    return *error ? NULL : &merger->current;
+}
+
+static const index_posting_t *peekRun(run_reader_t *reader, int fd,
+                                      int *error) {
+
+    if (reader->pos < reader->size) {
+        return &reader->buf[reader->pos];
+    } else if (reader->remaining == 0) {
+        return NULL;
+    }
+
+    uint64_t count = reader->remaining < MERGE_POSTINGS ? reader->remaining
+                                                        : MERGE_POSTINGS;
+    size_t length = count * sizeof(index_posting_t);
+    if (pread(fd, reader->buf, length, reader->offset) != (ssize_t)length) {
+        *error = 1;
+        return NULL;
+    }
+
+    reader->offset += length;
+    reader->remaining -= count;
+    reader->pos = 0;
+    reader->size = count;
+    return &reader->buf[0];
+}
+
+static void siftDown(run_merger_t *merger, int i) {
+    while (1) {
+        int smallest = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2; child++) {
+            if (child >= merger->sizeHeap) {
+                break;
+            }
+
+            run_reader_t *a = &merger->readers[merger->heap[child]];
+            run_reader_t *b = &merger->readers[merger->heap[smallest]];
+            if (comparePostings(&a->buf[a->pos], &b->buf[b->pos]) < 0) {
+                smallest = child;
+            }
+        }
+
+        if (smallest == i) {
+            return;
+        }
+
+        int tmp = merger->heap[i];
+        merger->heap[i] = merger->heap[smallest];
+        merger->heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static int addKeyPosting(key_writer_t *writer, const index_posting_t *posting) {
+    index_key_t *key = &writer->current;
+    if (!writer->hasCurrent || posting->isVar != writer->currentIsVar ||
+        posting->key != key->key) {
+
+        if (finishKey(writer)) {
+            return 1;
+        }
+
+        writer->hasCurrent = 1;
+        writer->currentIsVar = posting->isVar;
+        key->key = posting->key;
+        key->reads = writer->numPostings;
+        key->numReads = 0;
+        key->numWrites = 0;
+    }
+
+    // Reads of a key sort before its writes
+    if (posting->isWrite) {
+        key->numWrites++;
+    } else {
+        key->numReads++;
+    }
+
+    writer->numPostings++;
+    return 0;
+}
+
+static int finishKey(key_writer_t *writer) {
+    if (!writer->hasCurrent) {
+        return 0;
+    }
+
+    index_key_t *key = &writer->current;
+    key->writes = key->reads + key->numReads;
+    writer->hasCurrent = 0;
+
+    if (writer->currentIsVar) {
+        writer->vars[writer->numVars++] = *key;
+        return 0;
+    }
+
+    writer->numLines++;
+    return fwrite(key, sizeof(index_key_t), 1, writer->lines) != 1;
+}
+
+static int copyFile(FILE *from, FILE *to) {
+    if (fseek(from, 0, SEEK_SET) != 0) {
+        return 1;
+    }
+
+    char buf[65536];
+    size_t length;
+    while ((length = fread(buf, 1, sizeof(buf), from)) != 0) {
+        if (fwrite(buf, 1, length, to) != length) {
+            return 1;
+        }
+    }
+
+    return ferror(from);
+}
+
+static int comparePostings(const void *a, const void *b) {
+    const index_posting_t *x = a, *y = b;
+
+    if (x->isVar != y->isVar) {
+        return x->isVar < y->isVar ? -1 : 1;
+    } else if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    } else if (x->isWrite != y->isWrite) {
+        return x->isWrite < y->isWrite ? -1 : 1;
+    } else if (x->access.entry != y->access.entry) {
+        return x->access.entry < y->access.entry ? -1 : 1;
+    }
+
+    return x->access.address < y->access.address ? -1 :
+           x->access.address > y->access.address;
+}
+
+static int compareVariables(const void *a, const void *b, void *names) {
+    const index_key_t *x = a, *y = b;
+    return strcmp((const char *)names + x->key, (const char *)names + y->key);
+}
+
+static void getAccessList(const access_index_t *index, const index_key_t *key,
+                          access_list_t *list) {
+
+    list->reads = index->accesses + key->reads;
+    list->numReads = key->numReads;
+    list->writes = index->accesses + key->writes;
+    list->numWrites = key->numWrites;
+}
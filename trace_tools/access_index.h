@@ -0,0 +1,117 @@
+#ifndef ACCESS_INDEX_H
+#define ACCESS_INDEX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "trace_accesses.h"
+
+// Addresses are indexed by the 64-byte cache line holding them
+#define INDEX_LINE_SHIFT 6
+
+typedef struct {
+    uint64_t entry;
+    uint64_t pc;
+    uint64_t address;
+    int32_t tid;
+    uint32_t size;
+} indexed_access_t;
+
+typedef struct {
+    uint64_t key;
+    uint64_t reads, numReads;
+    uint64_t writes, numWrites;
+} index_key_t;
+
+typedef struct {
+    char magic[8];
+    uint64_t numLines, numVars, numAccesses, namesSize;
+} index_header_t;
+
+typedef struct {
+    uint64_t key;
+    uint64_t isVar, isWrite;
+    indexed_access_t access;
+} index_posting_t;
+
+typedef struct {
+    index_posting_t *postings;
+    uint64_t sizePostings, capacityPostings;
+    FILE *runs;
+    uint64_t *runSizes;
+    int sizeRuns, capacityRuns;
+    uint64_t numAccesses;
+    char **names;
+    int sizeNames, capacityNames;
+    int *nameTable;
+    int capacityNameTable;
+} index_builder_t;
+
+typedef struct {
+    void *map;
+    size_t mapSize;
+    const index_header_t *header;
+    const index_key_t *lines, *vars;
+    const indexed_access_t *accesses;
+    const char *names;
+} access_index_t;
+
+typedef struct {
+    const indexed_access_t *reads;
+    uint64_t numReads;
+    const indexed_access_t *writes;
+    uint64_t numWrites;
+} access_list_t;
+
+/*
+ * Initialises a builder of an access index
+ */
+void initIndexBuilder(index_builder_t *builder);
+
+/*
+ * Adds an access to the index being built, under the cache lines it touches
+ * and its variable, spilling the postings to a temporary file in sorted runs
+ * of bounded size, returning 0 on success
+ *
+ * Note: This is an access_callback_t given the builder
+ */
+int addAccess(const trace_access_t *access, void *builder);
+
+/*
+ * Writes the index built to a file by merging its sorted runs and destroys
+ * the builder, returning 0 on success
+ */
+int writeIndex(index_builder_t *builder, const char *path);
+
+/*
+ * Opens an index file, returning 0 on success
+ */
+int openIndex(const char *path, access_index_t *index);
+
+/*
+ * Closes an index file
+ */
+void closeIndex(access_index_t *index);
+
+/*
+ * Gets the accesses to the cache line holding an address, returning 0 if there
+ * are any
+ */
+int findLineAccesses(const access_index_t *index, uint64_t address,
+                     access_list_t *list);
+
+/*
+ * Gets the accesses to a variable by name, returning 0 if there are any
+ */
+int findVariableAccesses(const access_index_t *index, const char *name,
+                         access_list_t *list);
+
+/*
+ * Gets the position of the first of the accesses, sorted by entry, at or after
+ * the given entry
+ */
+uint64_t findEntry(const indexed_access_t *accesses, uint64_t numAccesses,
+                   uint64_t entry);
+
+#endif
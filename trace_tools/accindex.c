@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace_lines.h"
+#include "trace_accesses.h"
+#include "access_index.h"
+
+/*
+ * Prints the usage of the indexer
+ */
+static void printUsage();
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        printUsage();
+        return 1;
+    }
+
+    index_builder_t builder;
+    initIndexBuilder(&builder);
+
+    access_reader_t reader;
+    initAccessReader(&reader, addAccess, &builder);
+
+    // Each trace file is parsed on every core
+    reader.numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Trace files not listed by a manifest are numbered by position
+    int failed = 0;
+    for (int i = 2; i < argc && !failed; i++) {
+        failed = forEachTraceFile(argv[i], i - 1, readAccesses, &reader);
+    }
+
+    uint64_t accesses = builder.numAccesses;
+    if (writeIndex(&builder, argv[1])) {
+        fprintf(stderr, "Error: Could not write index %s\n", argv[1]);
+        failed = 1;
+    }
+
+    if (!failed) {
+        printf("%lu accesses indexed from %lu entries of %d threads\n",
+               accesses, reader.entries, reader.sizeThreads);
+    }
+
+    destroyAccessReader(&reader);
+
+    return failed;
+}
+
+static void printUsage() {
+    fprintf(stderr,
+            "Usage: accindex <index> <trace files or manifests...>\n"
+            "Writes an index of the memory accesses of the traces by cache "
+            "line and variable\n");
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "access_index.h"
+
+typedef enum {
+    queryAll,
+    queryLastWriter,
+    queryFirstReader,
+    queryRange
+} query_t;
+
+typedef struct {
+    // Only accesses overlapping the address, if given
+    int hasAddress;
+    uint64_t address;
+
+    uint64_t first, last;
+} access_filter_t;
+
+/*
+ * Parses an unsigned value, returning 0 on success
+ */
+static int parseValue(const char *val, uint64_t *out);
+
+/*
+ * Parses an inclusive range of entries given as first:last, returning 0 on
+ * success
+ */
+static int parseEntryRange(const char *val, uint64_t *first, uint64_t *last);
+
+/*
+ * Returns whether an access matches a filter
+ */
+static int matchesFilter(const indexed_access_t *access,
+                         const access_filter_t *filter);
+
+/*
+ * Prints the accesses of a list matching a filter in order of entry
+ */
+static void printAccesses(const access_list_t *list,
+                              const access_filter_t *filter);
+
+/*
+ * Prints an access as comma-separated values
+ */
+static void printAccess(const indexed_access_t *access, int isWrite);
+
+/*
+ * Prints the usage of the query tool
+ */
+static void printUsage();
+
+int main(int argc, const char *argv[]) {
+    if (argc < 4 || argc % 2 != 0) {
+        printUsage();
+        return 1;
+    }
+
+    const char *variable = NULL;
+    query_t query = queryAll;
+    access_filter_t filter = { 0, 0, 0, UINT64_MAX };
+    uint64_t entry = 0;
+
+    for (int i = 2; i < argc; i += 2) {
+        const char *name = argv[i], *val = argv[i + 1];
+        int failed = 0;
+
+        if (strcmp(name, "-address") == 0) {
+            filter.hasAddress = 1;
+            failed = parseValue(val, &filter.address);
+        } else if (strcmp(name, "-variable") == 0) {
+            variable = val;
+        } else if (strcmp(name, "-last_writer") == 0) {
+            query = queryLastWriter;
+            failed = parseValue(val, &entry);
+        } else if (strcmp(name, "-first_reader") == 0) {
+            query = queryFirstReader;
+            failed = parseValue(val, &entry);
+        } else if (strcmp(name, "-range") == 0) {
+            query = queryRange;
+            failed = parseEntryRange(val, &filter.first, &filter.last);
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", name);
+            printUsage();
+            return 1;
+        }
+
+        if (failed) {
+            fprintf(stderr, "Error: Invalid value %s for option %s\n", val,
+                    name);
+            return 1;
+        }
+    }
+
+    if (filter.hasAddress == (variable != NULL)) {
+        fprintf(stderr, "Error: Exactly one of -address and -variable must be "
+                        "given\n");
+        return 1;
+    }
+
+    access_index_t index;
+    if (openIndex(argv[1], &index)) {
+        fprintf(stderr, "Error: Could not open index %s\n", argv[1]);
+        return 1;
+    }
+
+    access_list_t list;
+    int found = variable != NULL ?
+                findVariableAccesses(&index, variable, &list) == 0 :
+                findLineAccesses(&index, filter.address, &list) == 0;
+
+    printf("entry,thread,pc,kind,address,size\n");
+
+    if (!found) {
+        // Nothing accesses the address or variable
+    } else if (query == queryLastWriter) {
+        // Writes to the rest of the cache line are stepped over one at a time
+        uint64_t end = findEntry(list.writes, list.numWrites, entry + 1);
+        while (end > 0 && !matchesFilter(&list.writes[end - 1], &filter)) {
+            end--;
+        }
+
+        if (end > 0) {
+            printAccess(&list.writes[end - 1], 1);
+        }
+    } else if (query == queryFirstReader) {
+        uint64_t start = findEntry(list.reads, list.numReads, entry + 1);
+        while (start < list.numReads &&
+               !matchesFilter(&list.reads[start], &filter)) {
+            start++;
+        }
+
+        if (start < list.numReads) {
+            printAccess(&list.reads[start], 0);
+        }
+    } else {
+        printAccesses(&list, &filter);
+    }
+
+    closeIndex(&index);
+    return 0;
+}
+
+static int parseValue(const char *val, uint64_t *out) {
+    char *end;
+    *out = strtoull(val, &end, 0);
+    return end == val || *end != '\0';
+}
+
+static int parseEntryRange(const char *val, uint64_t *first, uint64_t *last) {
+    char *end;
+    *first = strtoull(val, &end, 0);
+    if (end == val || *end != ':') {
+        return 1;
+    }
+
+    const char *lastVal = end + 1;
+    *last = strtoull(lastVal, &end, 0);
+    return end == lastVal || *end != '\0' || *last < *first;
+}
+
+static int matchesFilter(const indexed_access_t *access,
+                         const access_filter_t *filter) {
+
+    if (access->entry < filter->first || access->entry > filter->last) {
+        return 0;
+    }
+
+    return !filter->hasAddress || (filter->address >= access->address &&
+                                   filter->address - access->address <
+                                   access->size);
+}
+
+static void printAccesses(const access_list_t *list,
+                          const access_filter_t *filter) {
+
+    uint64_t read = findEntry(list->reads, list->numReads, filter->first);
+    uint64_t write = findEntry(list->writes, list->numWrites, filter->first);
+
+    // Merges the reads and writes, both sorted by entry
+    while (read < list->numReads || write < list->numWrites) {
+        int isWrite = read == list->numReads ||
+                      (write < list->numWrites &&
+                       list->writes[write].entry < list->reads[read].entry);
+        const indexed_access_t *access = isWrite ? &list->writes[write++]
+                                                 : &list->reads[read++];
+
+        if (access->entry > filter->last) {
+            break;
+        } else if (matchesFilter(access, filter)) {
+            printAccess(access, isWrite);
+        }
+    }
+}
+
+static void printAccess(const indexed_access_t *access, int isWrite) {
+    printf("%lu,%d,0x%lx,%s,0x%lx,%u\n", access->entry, access->tid,
+           access->pc, isWrite ? "store" : "load", access->address,
+           access->size);
+}
+
+static void printUsage() {
+    fprintf(stderr,
+            "Usage: accquery <index> (-address <addr> | -variable <name>) "
+            "[query]\n"
+            "Prints the accesses to an address or variable, in order of "
+            "entry\n"
+            "\n"
+            "Queries:\n"
+            "  -last_writer <entry>    Only the last store at or before the "
+            "entry\n"
+            "  -first_reader <entry>   Only the first load after the entry\n"
+            "  -range <first:last>     Only accesses by entries first to "
+            "last\n");
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "column_store.h"
+#include "trace_accesses.h"
+
+#define MAX_PREDICATES 16
+
+/*
+ * Parses a value or inclusive range of a column given as min:max,
+ * returning 0 on success
+ */
+static int parseRange(const char *val, predicate_t *pred);
+
+/*
+ * Prints a matching row as comma-separated values
+ */
+static int printRow(const uint64_t *row, void *arg);
+
+/*
+ * Prints the usage of the query tool
+ */
+static void printUsage();
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    column_store_t *store = openStore(argv[1]);
+    if (store == NULL) {
+        fprintf(stderr, "Error: Could not open store %s\n", argv[1]);
+        return 1;
+    }
+
+    predicate_t preds[MAX_PREDICATES];
+    int numPreds = 0, countOnly = 0;
+
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Missing value for option %s\n", argv[i]);
+            printUsage();
+            closeStore(store);
+            return 1;
+        } else if (numPreds == MAX_PREDICATES) {
+            fprintf(stderr, "Error: At most %d conditions may be given\n",
+                    MAX_PREDICATES);
+            closeStore(store);
+            return 1;
+        }
+
+        const char *name = argv[i], *val = argv[i + 1];
+        predicate_t *pred = &preds[numPreds];
+        int column = name[0] == '-' ? findColumn(name + 1) : -1;
+
+        if (strcmp(name, "-count") == 0) {
+            countOnly = strcmp(val, "0") != 0;
+            continue;
+        } else if (column == columnVariable) {
+            pred->min = pred->max = findVariable(store, val);
+            if (pred->min == STORE_NO_VARIABLE) {
+                fprintf(stderr, "Error: No accesses to variable %s\n", val);
+                closeStore(store);
+                return 1;
+            }
+        } else if (column == columnKind) {
+            if (strcmp(val, "load") == 0) {
+                pred->min = pred->max = kindLoad;
+            } else if (strcmp(val, "store") == 0) {
+                pred->min = pred->max = kindStore;
+            } else if (strcmp(val, "none") == 0) {
+                pred->min = pred->max = kindNone;
+            } else {
+                fprintf(stderr, "Error: Unknown kind %s\n", val);
+                closeStore(store);
+                return 1;
+            }
+        } else if (column < 0) {
+            fprintf(stderr, "Error: Unknown option %s\n", name);
+            printUsage();
+            closeStore(store);
+            return 1;
+        } else if (parseRange(val, pred)) {
+            fprintf(stderr, "Error: Expected a value or range min:max for "
+                            "option %s\n", name);
+            closeStore(store);
+            return 1;
+        }
+
+        pred->column = column;
+        numPreds++;
+    }
+
+    if (!countOnly) {
+        for (int i = 0; i < numColumns; i++) {
+            printf("%s%s", i == 0 ? "" : ",", getColumnName(i));
+        }
+        printf("\n");
+    }
+
+    int64_t matched = scanStore(store, preds, numPreds,
+                                countOnly ? NULL : printRow, store);
+    closeStore(store);
+
+    if (matched < 0) {
+        fprintf(stderr, "Error: Could not read store %s\n", argv[1]);
+        return 1;
+    } else if (countOnly) {
+        printf("%ld\n", matched);
+    }
+
+    return 0;
+}
+
+static int parseRange(const char *val, predicate_t *pred) {
+    char *end;
+    pred->min = strtoull(val, &end, 0);
+    if (end == val) {
+        return 1;
+    }
+
+    pred->max = pred->min;
+    if (*end == ':') {
+        const char *maxVal = end + 1;
+        pred->max = strtoull(maxVal, &end, 0);
+        if (end == maxVal) {
+            return 1;
+        }
+    }
+
+    return *end != '\0' || pred->max < pred->min;
+}
+
+static int printRow(const uint64_t *row, void *arg) {
+    column_store_t *store = arg;
+
+    const char *var = getVariableName(store, row[columnVariable]);
+    printf("0x%lx,%lu,%ld,%lu,%s,0x%lx,0x%lx,%s\n",
+           row[columnPc], row[columnOpcode], (long)row[columnThread],
+           row[columnSequence],
+           row[columnKind] == kindLoad ? "load" :
+           row[columnKind] == kindStore ? "store" : "none",
+           row[columnAddress], row[columnValue], var == NULL ? "" : var);
+
+    return 0;
+}
+
+static void printUsage() {
+    fprintf(stderr,
+            "Usage: colquery <store> [options]\n"
+            "Prints the rows of a columnar store matching every condition\n"
+            "\n"
+            "Options:\n"
+            "  -<column> <value>   Only rows with the value, or a range "
+            "min:max, in a column of\n"
+            "                      pc, opcode, thread, sequence, address or "
+            "value\n"
+            "  -kind <kind>        Only load, store or none rows\n"
+            "  -variable <name>    Only accesses to the variable\n"
+            "  -count <n>          Only print the number of rows if n is 1\n");
+}
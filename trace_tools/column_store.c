@@ -0,0 +1,641 @@
+#define _GNU_SOURCE
+
+#include "column_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+
+#include "trace_lines.h"
+
+#define MIN_CAPACITY 16
+#define INDEX_MAGIC "PCTDACS1"
+
+// Longest encoding of a 64-bit integer, 7 bits to a byte
+#define MAX_VARINT_SIZE 10
+
+static const char *columnNames[numColumns] = {
+    "pc", "opcode", "thread", "sequence", "kind", "address", "value",
+    "variable"
+};
+
+/*
+ * Allocates the buffers of a store, returning 0 on success
+ */
+static int allocateBuffers(column_store_t *store);
+
+/*
+ * Frees a store and everything it holds, closing its files
+ */
+static void freeStore(column_store_t *store);
+
+/*
+ * Opens a column file of a store, returning NULL on error
+ */
+static FILE *openColumn(const char *dir, column_t column, const char *mode);
+
+/*
+ * Opens a file of a store by name, returning NULL on error
+ */
+static FILE *openStoreFile(const char *dir, const char *name,
+                           const char *mode);
+
+/*
+ * Compresses and writes the rows of the block being written,
+ * returning 0 on success
+ */
+static int writeBlock(column_store_t *store);
+
+/*
+ * Writes the index of the blocks of a store, returning 0 on success
+ */
+static int writeIndex(column_store_t *store);
+
+/*
+ * Writes the names of the variables of a store, returning 0 on success
+ */
+static int writeVariables(column_store_t *store);
+
+/*
+ * Reads the index of the blocks of a store, returning 0 on success
+ */
+static int readIndex(column_store_t *store);
+
+/*
+ * Reads the names of the variables of a store, returning 0 on success
+ */
+static int readVariables(column_store_t *store);
+
+/*
+ * Appends the name of a variable to a store, returning 0 on success
+ */
+static int appendVariable(column_store_t *store, char *name);
+
+/*
+ * Reads and decompresses a column of a block, returning 0 on success
+ */
+static int readColumn(column_store_t *store, int block, column_t column);
+
+/*
+ * Encodes the differences between consecutive values, returning the length
+ */
+static uint64_t encodeColumn(const uint64_t *vals, uint64_t numVals,
+                             uint8_t *bytes);
+
+/*
+ * Decodes the differences between consecutive values, returning 0 on success
+ */
+static int decodeColumn(const uint8_t *bytes, uint64_t length, uint64_t *vals,
+                        uint64_t numVals);
+
+/*
+ * Clears the selection of the values outside an inclusive range
+ */
+static void filterRange(const uint64_t *vals, uint64_t numVals, uint64_t min,
+                        uint64_t max, uint8_t *selected);
+
+/*
+ * Clears the selection of the values outside an inclusive range, four at a
+ * time
+ */
+__attribute__((target("avx2")))
+static void filterRangeAvx2(const uint64_t *vals, uint64_t numVals,
+                            uint64_t min, uint64_t max, uint8_t *selected);
+
+column_store_t *createStore(const char *dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        return NULL;
+    }
+
+    column_store_t *store = calloc(1, sizeof(column_store_t));
+    if (store == NULL) {
+        return NULL;
+    }
+
+    store->dir = strdup(dir);
+    if (store->dir == NULL || allocateBuffers(store)) {
+        freeStore(store);
+        return NULL;
+    }
+
+    for (int i = 0; i < numColumns; i++) {
+        store->columns[i] = openColumn(dir, i, "wb");
+        if (store->columns[i] == NULL) {
+            freeStore(store);
+            return NULL;
+        }
+    }
+
+    return store;
+}
+
+int appendRow(column_store_t *store, const uint64_t *row) {
+    for (int i = 0; i < numColumns; i++) {
+        store->rows[i][store->numRows] = row[i];
+    }
+
+    if (++store->numRows == STORE_BLOCK_ROWS) {
+        return writeBlock(store);
+    }
+
+    return 0;
+}
+
+uint64_t addVariable(column_store_t *store, const char *name, size_t length) {
+    if (2 * store->sizeVariables >= store->capacityVariableTable) {
+        int capacity = store->capacityVariableTable == 0 ?
+                       MIN_CAPACITY : 2 * store->capacityVariableTable;
+        int *table = calloc(capacity, sizeof(int));
+        if (table == NULL) {
+            return STORE_NO_VARIABLE;
+        }
+
+        for (int i = 0; i < store->sizeVariables; i++) {
+            const char *var = store->variables[i];
+            uint64_t slot = hashName(var, strlen(var)) & (capacity - 1);
+            while (table[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table[slot] = i + 1;
+        }
+
+        free(store->variableTable);
+        store->variableTable = table;
+        store->capacityVariableTable = capacity;
+    }
+
+    // Slots hold the ID of a variable, with 0 for an empty slot
+    int mask = store->capacityVariableTable - 1;
+    uint64_t slot = hashName(name, length) & mask;
+    for (; store->variableTable[slot] != 0; slot = (slot + 1) & mask) {
+        const char *var = store->variables[store->variableTable[slot] - 1];
+        if (strncmp(var, name, length) == 0 && var[length] == '\0') {
+            return store->variableTable[slot];
+        }
+    }
+
+    char *copy = strndup(name, length);
+    if (copy == NULL || appendVariable(store, copy)) {
+        free(copy);
+        return STORE_NO_VARIABLE;
+    }
+
+    store->variableTable[slot] = store->sizeVariables;
+    return store->sizeVariables;
+}
+
+int finishStore(column_store_t *store) {
+    int res = 0;
+    if (store->numRows != 0) {
+        res = writeBlock(store);
+    }
+
+    for (int i = 0; i < numColumns; i++) {
+        if (fclose(store->columns[i]) != 0) {
+            res = 1;
+        }
+        store->columns[i] = NULL;
+    }
+
+    if (res == 0) {
+        res = writeIndex(store) || writeVariables(store);
+    }
+
+    freeStore(store);
+    return res;
+}
+
+column_store_t *openStore(const char *dir) {
+    column_store_t *store = calloc(1, sizeof(column_store_t));
+    if (store == NULL) {
+        return NULL;
+    }
+
+    store->dir = strdup(dir);
+    if (store->dir == NULL || allocateBuffers(store) || readIndex(store) ||
+        readVariables(store)) {
+
+        freeStore(store);
+        return NULL;
+    }
+
+    for (int i = 0; i < numColumns; i++) {
+        store->columns[i] = openColumn(dir, i, "rb");
+        if (store->columns[i] == NULL) {
+            freeStore(store);
+            return NULL;
+        }
+    }
+
+    return store;
+}
+
+void closeStore(column_store_t *store) {
+    freeStore(store);
+}
+
+uint64_t findVariable(column_store_t *store, const char *name) {
+    for (int i = 0; i < store->sizeVariables; i++) {
+        if (strcmp(store->variables[i], name) == 0) {
+            return i + 1;
+        }
+    }
+
+    return STORE_NO_VARIABLE;
+}
+
+const char *getVariableName(column_store_t *store, uint64_t id) {
+    if (id == STORE_NO_VARIABLE || id > (uint64_t)store->sizeVariables) {
+        return NULL;
+    }
+
+    return store->variables[id - 1];
+}
+
+int findColumn(const char *name) {
+    for (int i = 0; i < numColumns; i++) {
+        if (strcmp(columnNames[i], name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const char *getColumnName(column_t column) {
+    return columnNames[column];
+}
+
+int64_t scanStore(column_store_t *store, const predicate_t *preds,
+                  int numPreds, row_callback_t callback, void *arg) {
+
+    int64_t matched = 0;
+
+    for (int i = 0; i < store->sizeBlocks; i++) {
+        store_block_t *block = &store->blocks[i];
+
+        // Blocks are skipped unread when their statistics exclude a predicate
+        int skip = 0;
+        for (int j = 0; j < numPreds; j++) {
+            column_block_t *stats = &block->columns[preds[j].column];
+            skip |= stats->max < preds[j].min || stats->min > preds[j].max;
+        }
+
+        if (skip) {
+            continue;
+        }
+
+        int read[numColumns];
+        memset(read, 0, sizeof(read));
+        memset(store->selected, 1, block->rows);
+
+        for (int j = 0; j < numPreds; j++) {
+            column_t column = preds[j].column;
+            if (!read[column] && readColumn(store, i, column)) {
+                return -1;
+            }
+            read[column] = 1;
+
+            filterRange(store->rows[column], block->rows, preds[j].min,
+                        preds[j].max, store->selected);
+        }
+
+        uint64_t blockMatched = 0;
+        for (uint64_t j = 0; j < block->rows; j++) {
+            blockMatched += store->selected[j];
+        }
+
+        matched += blockMatched;
+        if (callback == NULL || blockMatched == 0) {
+            continue;
+        }
+
+        for (int column = 0; column < numColumns; column++) {
+            if (!read[column] && readColumn(store, i, column)) {
+                return -1;
+            }
+        }
+
+        for (uint64_t j = 0; j < block->rows; j++) {
+            if (!store->selected[j]) {
+                continue;
+            }
+
+            uint64_t row[numColumns];
+            for (int column = 0; column < numColumns; column++) {
+                row[column] = store->rows[column][j];
+            }
+
+            if (callback(row, arg)) {
+                return matched;
+            }
+        }
+    }
+
+    return matched;
+}
+
+static int allocateBuffers(column_store_t *store) {
+    for (int i = 0; i < numColumns; i++) {
+        store->rows[i] = malloc(STORE_BLOCK_ROWS * sizeof(uint64_t));
+        if (store->rows[i] == NULL) {
+            return 1;
+        }
+    }
+
+    store->encoded = malloc(STORE_BLOCK_ROWS * MAX_VARINT_SIZE);
+    store->selected = malloc(STORE_BLOCK_ROWS);
+    return store->encoded == NULL || store->selected == NULL;
+}
+
+static void freeStore(column_store_t *store) {
+    for (int i = 0; i < numColumns; i++) {
+        if (store->columns[i] != NULL) {
+            fclose(store->columns[i]);
+        }
+        free(store->rows[i]);
+    }
+
+    for (int i = 0; i < store->sizeVariables; i++) {
+        free(store->variables[i]);
+    }
+
+    free(store->variables);
+    free(store->variableTable);
+    free(store->blocks);
+    free(store->encoded);
+    free(store->selected);
+    free(store->dir);
+    free(store);
+}
+
+static FILE *openColumn(const char *dir, column_t column, const char *mode) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s.col", columnNames[column]);
+    return openStoreFile(dir, name, mode);
+}
+
+static FILE *openStoreFile(const char *dir, const char *name,
+                           const char *mode) {
+
+    char path[strlen(dir) + strlen(name) + 2];
+    sprintf(path, "%s/%s", dir, name);
+    return fopen(path, mode);
+}
+
+static int writeBlock(column_store_t *store) {
+    if (store->sizeBlocks == store->capacityBlocks) {
+        int capacity = store->capacityBlocks == 0 ? MIN_CAPACITY
+                                                  : 2 * store->capacityBlocks;
+        store_block_t *blocks = reallocarray(store->blocks, capacity,
+                                             sizeof(store_block_t));
+        if (blocks == NULL) {
+            return 1;
+        }
+
+        store->blocks = blocks;
+        store->capacityBlocks = capacity;
+    }
+
+    store_block_t *block = &store->blocks[store->sizeBlocks];
+    block->rows = store->numRows;
+
+    for (int i = 0; i < numColumns; i++) {
+        column_block_t *column = &block->columns[i];
+        const uint64_t *vals = store->rows[i];
+
+        column->offset = 0;
+        if (store->sizeBlocks != 0) {
+            column_block_t *prev = &store->blocks[store->sizeBlocks - 1]
+                                   .columns[i];
+            column->offset = prev->offset + prev->length;
+        }
+
+        column->min = UINT64_MAX;
+        column->max = 0;
+        for (uint64_t j = 0; j < store->numRows; j++) {
+            column->min = vals[j] < column->min ? vals[j] : column->min;
+            column->max = vals[j] > column->max ? vals[j] : column->max;
+        }
+
+        column->length = encodeColumn(vals, store->numRows, store->encoded);
+        if (fwrite(store->encoded, 1, column->length, store->columns[i])
+            != column->length) {
+
+            return 1;
+        }
+    }
+
+    store->sizeBlocks++;
+    store->numRows = 0;
+    return 0;
+}
+
+static int writeIndex(column_store_t *store) {
+    FILE *index = openStoreFile(store->dir, "blocks.idx", "wb");
+    if (index == NULL) {
+        return 1;
+    }
+
+    uint64_t numBlocks = store->sizeBlocks;
+    int res = fwrite(INDEX_MAGIC, 1, 8, index) != 8 ||
+              fwrite(&numBlocks, sizeof(numBlocks), 1, index) != 1 ||
+              (numBlocks != 0 &&
+               fwrite(store->blocks, sizeof(store_block_t), numBlocks, index)
+               != numBlocks);
+
+    return fclose(index) != 0 || res;
+}
+
+static int writeVariables(column_store_t *store) {
+    FILE *variables = openStoreFile(store->dir, "variables.txt", "w");
+    if (variables == NULL) {
+        return 1;
+    }
+
+    for (int i = 0; i < store->sizeVariables; i++) {
+        fprintf(variables, "%s\n", store->variables[i]);
+    }
+
+    return fclose(variables) != 0;
+}
+
+static int readIndex(column_store_t *store) {
+    FILE *index = openStoreFile(store->dir, "blocks.idx", "rb");
+    if (index == NULL) {
+        return 1;
+    }
+
+    char magic[8];
+    uint64_t numBlocks;
+    if (fread(magic, 1, 8, index) != 8 ||
+        memcmp(magic, INDEX_MAGIC, 8) != 0 ||
+        fread(&numBlocks, sizeof(numBlocks), 1, index) != 1) {
+
+        fclose(index);
+        return 1;
+    }
+
+    store->blocks = calloc(numBlocks == 0 ? 1 : numBlocks,
+                           sizeof(store_block_t));
+    if (store->blocks == NULL ||
+        fread(store->blocks, sizeof(store_block_t), numBlocks, index)
+        != numBlocks) {
+
+        fclose(index);
+        return 1;
+    }
+
+    store->sizeBlocks = numBlocks;
+    store->capacityBlocks = numBlocks;
+    fclose(index);
+    return 0;
+}
+
+static int readVariables(column_store_t *store) {
+    FILE *variables = openStoreFile(store->dir, "variables.txt", "r");
+    if (variables == NULL) {
+        return 1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int res = 0;
+    while (res == 0 && (length = getline(&line, &capacity, variables)) > 0) {
+        char *name = strndup(line, line[length - 1] == '\n' ? length - 1
+                                                            : length);
+        res = name == NULL || appendVariable(store, name);
+        if (res) {
+            free(name);
+        }
+    }
+
+    free(line);
+    fclose(variables);
+    return res;
+}
+
+static int appendVariable(column_store_t *store, char *name) {
+    if (store->sizeVariables == store->capacityVariables) {
+        int capacity = store->capacityVariables == 0 ?
+                       MIN_CAPACITY : 2 * store->capacityVariables;
+        char **variables = reallocarray(store->variables, capacity,
+                                        sizeof(char *));
+        if (variables == NULL) {
+            return 1;
+        }
+
+        store->variables = variables;
+        store->capacityVariables = capacity;
+    }
+
+    store->variables[store->sizeVariables++] = name;
+    return 0;
+}
+
+static int readColumn(column_store_t *store, int block, column_t column) {
+    column_block_t *stats = &store->blocks[block].columns[column];
+    if (stats->length > STORE_BLOCK_ROWS * MAX_VARINT_SIZE ||
+        fseeko(store->columns[column], stats->offset, SEEK_SET) != 0 ||
+        fread(store->encoded, 1, stats->length, store->columns[column])
+        != stats->length) {
+
+        return 1;
+    }
+
+    return decodeColumn(store->encoded, stats->length, store->rows[column],
+                        store->blocks[block].rows);
+}
+
+static uint64_t encodeColumn(const uint64_t *vals, uint64_t numVals,
+                             uint8_t *bytes) {
+
+    // Differences are zigzag encoded so small negative ones stay short
+    uint64_t length = 0, prev = 0;
+    for (uint64_t i = 0; i < numVals; i++) {
+        int64_t delta = (int64_t)(vals[i] - prev);
+        uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+        prev = vals[i];
+
+        while (zigzag >= 0x80) {
+            bytes[length++] = (uint8_t)zigzag | 0x80;
+            zigzag >>= 7;
+        }
+        bytes[length++] = (uint8_t)zigzag;
+    }
+
+    return length;
+}
+
+static int decodeColumn(const uint8_t *bytes, uint64_t length, uint64_t *vals,
+                        uint64_t numVals) {
+
+    uint64_t pos = 0, prev = 0;
+    for (uint64_t i = 0; i < numVals; i++) {
+        uint64_t zigzag = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (pos >= length || shift >= 64) {
+                return 1;
+            }
+
+            uint8_t byte = bytes[pos++];
+            zigzag |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+
+        prev += (zigzag >> 1) ^ -(zigzag & 1);
+        vals[i] = prev;
+    }
+
+    return pos != length;
+}
+
+static void filterRange(const uint64_t *vals, uint64_t numVals, uint64_t min,
+                        uint64_t max, uint8_t *selected) {
+
+    static int haveAvx2 = -1;
+    if (haveAvx2 < 0) {
+        haveAvx2 = __builtin_cpu_supports("avx2");
+    }
+
+    if (haveAvx2) {
+        filterRangeAvx2(vals, numVals, min, max, selected);
+        return;
+    }
+
+    for (uint64_t i = 0; i < numVals; i++) {
+        selected[i] &= vals[i] - min <= max - min;
+    }
+}
+
+__attribute__((target("avx2")))
+static void filterRangeAvx2(const uint64_t *vals, uint64_t numVals,
+                            uint64_t min, uint64_t max, uint8_t *selected) {
+
+    // Unsigned comparisons are signed ones with the sign bits flipped
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i low = _mm256_set1_epi64x(min);
+    const __m256i range = _mm256_xor_si256(_mm256_set1_epi64x(max - min), sign);
+
+    uint64_t i = 0;
+    for (; i + 4 <= numVals; i += 4) {
+        __m256i val = _mm256_loadu_si256((const __m256i *)(vals + i));
+        __m256i offset = _mm256_xor_si256(_mm256_sub_epi64(val, low), sign);
+        __m256i outside = _mm256_cmpgt_epi64(offset, range);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(outside));
+
+        selected[i] &= !(mask & 1);
+        selected[i + 1] &= !(mask & 2);
+        selected[i + 2] &= !(mask & 4);
+        selected[i + 3] &= !(mask & 8);
+    }
+
+    for (; i < numVals; i++) {
+        selected[i] &= vals[i] - min <= max - min;
+    }
+}
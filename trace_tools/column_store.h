@@ -0,0 +1,128 @@
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define STORE_BLOCK_ROWS 65536
+
+// Variable ID of an access to no known variable
+#define STORE_NO_VARIABLE 0
+
+typedef enum {
+    columnPc,
+    columnOpcode,
+    columnThread,
+    columnSequence,
+    columnKind,
+    columnAddress,
+    columnValue,
+    columnVariable,
+    numColumns
+} column_t;
+
+typedef struct {
+    uint64_t offset, length;
+    uint64_t min, max;
+} column_block_t;
+
+typedef struct {
+    uint64_t rows;
+    column_block_t columns[numColumns];
+} store_block_t;
+
+typedef struct {
+    char *dir;
+    FILE *columns[numColumns];
+    store_block_t *blocks;
+    int sizeBlocks, capacityBlocks;
+    char **variables;
+    int sizeVariables, capacityVariables;
+
+    // Rows of the block being written, or decoded columns of one being read
+    uint64_t *rows[numColumns];
+    uint64_t numRows;
+    uint8_t *encoded;
+    uint8_t *selected;
+
+    // Variable IDs by name while writing
+    int *variableTable;
+    int capacityVariableTable;
+} column_store_t;
+
+typedef struct {
+    column_t column;
+    uint64_t min, max;
+} predicate_t;
+
+/*
+ * Callback for each row matching a scan, given the value of each column,
+ * returning nonzero to stop the scan
+ */
+typedef int (*row_callback_t)(const uint64_t *row, void *arg);
+
+/*
+ * Creates an empty store in a directory, returning NULL on error
+ */
+column_store_t *createStore(const char *dir);
+
+/*
+ * Appends a row to a store being written, given the value of each column,
+ * returning 0 on success
+ */
+int appendRow(column_store_t *store, const uint64_t *row);
+
+/*
+ * Gets the ID of a variable by name, adding it to a store being written,
+ * returning STORE_NO_VARIABLE on error
+ */
+uint64_t addVariable(column_store_t *store, const char *name, size_t length);
+
+/*
+ * Writes the last block and index of a store being written and destroys it,
+ * returning 0 on success
+ */
+int finishStore(column_store_t *store);
+
+/*
+ * Opens a store for reading, returning NULL on error
+ */
+column_store_t *openStore(const char *dir);
+
+/*
+ * Closes a store opened for reading
+ */
+void closeStore(column_store_t *store);
+
+/*
+ * Gets the ID of a variable by name, returning STORE_NO_VARIABLE if it is not
+ * in the store
+ */
+uint64_t findVariable(column_store_t *store, const char *name);
+
+/*
+ * Gets the name of a variable by ID
+ *
+ * Note: Do not free the string passed back
+ */
+const char *getVariableName(column_store_t *store, uint64_t id);
+
+/*
+ * Gets a column by name, returning -1 if there is none
+ */
+int findColumn(const char *name);
+
+/*
+ * Gets the name of a column
+ */
+const char *getColumnName(column_t column);
+
+/*
+ * Calls back for each row of a store within the inclusive range of every
+ * predicate, skipping the blocks whose statistics exclude any, returning the
+ * number of rows matched or -1 on error
+ */
+int64_t scanStore(column_store_t *store, const predicate_t *preds,
+                  int numPreds, row_callback_t callback, void *arg);
+
+#endif
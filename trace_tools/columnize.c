@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace_lines.h"
+#include "trace_accesses.h"
+#include "column_store.h"
+
+typedef struct {
+    column_store_t *store;
+    uint64_t rows;
+} converter_t;
+
+/*
+ * Appends the row of an access to the store, returning 0 on success
+ */
+static int convertAccess(const trace_access_t *access, void *arg);
+
+/*
+ * Prints the usage of the converter
+ */
+static void printUsage();
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        printUsage();
+        return 1;
+    }
+
+    converter_t converter;
+    converter.rows = 0;
+    converter.store = createStore(argv[1]);
+    if (converter.store == NULL) {
+        fprintf(stderr, "Error: Could not create store %s\n", argv[1]);
+        return 1;
+    }
+
+    access_reader_t reader;
+    initAccessReader(&reader, convertAccess, &converter);
+
+    // Each trace file is parsed on every core
+    reader.numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Trace files not listed by a manifest are numbered by position
+    int failed = 0;
+    for (int i = 2; i < argc && !failed; i++) {
+        failed = forEachTraceFile(argv[i], i - 1, readAccesses, &reader);
+    }
+
+    if (finishStore(converter.store)) {
+        fprintf(stderr, "Error: Could not write store %s\n", argv[1]);
+        failed = 1;
+    }
+
+    if (!failed) {
+        printf("%lu rows from %d threads\n", converter.rows,
+               reader.sizeThreads);
+    }
+
+    destroyAccessReader(&reader);
+
+    return failed;
+}
+
+static int convertAccess(const trace_access_t *access, void *arg) {
+    converter_t *converter = arg;
+
+    uint64_t row[numColumns];
+    row[columnPc] = access->pc;
+    row[columnOpcode] = access->opcode;
+    row[columnThread] = (uint64_t)access->tid;
+    row[columnSequence] = access->sequence;
+    row[columnKind] = access->kind;
+    row[columnAddress] = access->address;
+    row[columnValue] = access->value;
+    row[columnVariable] = STORE_NO_VARIABLE;
+
+    if (access->variable != NULL) {
+        row[columnVariable] = addVariable(converter->store, access->variable,
+                                          access->variableLength);
+    }
+
+    converter->rows++;
+    if (appendRow(converter->store, row)) {
+        fprintf(stderr, "Error: Could not write rows\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void printUsage() {
+    fprintf(stderr,
+            "Usage: columnize <store> <trace files or manifests...>\n"
+            "Writes the memory accesses of each entry of the traces to a "
+            "columnar store\n");
+}
@@ -0,0 +1,584 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "debug_info.h"
+#include "trace_lines.h"
+
+#define MIN_CAPACITY 16
+#define OUTPUT_SUFFIX ".sym"
+
+typedef struct {
+    char *path;
+    debug_info_t *info;
+} module_t;
+
+typedef struct {
+    const char *path;
+    void *start;
+    debug_info_t *info;
+} input_t;
+
+typedef struct {
+    long tid;
+    void *pc, *frame;
+    int lastFunc;
+} frame_state_t;
+
+typedef struct {
+    char *data;
+    size_t size, capacity;
+} line_buffer_t;
+
+typedef struct {
+    pthread_t thread;
+    frame_state_t *states;
+    int sizeStates, capacityStates;
+    line_buffer_t out;
+    int failed;
+} worker_t;
+
+static module_t *modules;
+static int sizeModules, capacityModules;
+
+static input_t *inputs;
+static int numInputs;
+static int nextInput;
+
+/*
+ * Reads the main module path and start address from the header of a trace
+ * file written with -offline 1, returning 0 on success
+ */
+static int readHeader(const char *path, char **modulePath, void **start);
+
+/*
+ * Gets the debugging information of a module, loading it once for all inputs,
+ * returning NULL on error
+ */
+static debug_info_t *loadModule(const char *path);
+
+/*
+ * Symbolizes inputs until none remain
+ */
+static void *runWorker(void *arg);
+
+/*
+ * Writes a symbolized copy of an input, returning 0 on success
+ */
+static int symbolizeFile(worker_t *worker, const input_t *input);
+
+/*
+ * Symbolizes a line of a trace file into the output buffer of a worker
+ */
+static void symbolizeLine(worker_t *worker, const input_t *input,
+                          const char *line, size_t length);
+
+/*
+ * Symbolizes an operand, adding the variable of a memory operand and the
+ * source line of the site of its allocation
+ */
+static void symbolizeOperand(worker_t *worker, const input_t *input,
+                             frame_state_t *state, const char *opnd,
+                             size_t length);
+
+/*
+ * Gets the last frame seen for a thread, adding one if there is none
+ */
+static frame_state_t *getFrameState(worker_t *worker, long tid);
+
+/*
+ * Appends the source file and line fields of a PC, if known
+ */
+static void appendSourceLine(line_buffer_t *buf, const input_t *input,
+                             void *pc);
+
+/*
+ * Appends the information of a variable
+ */
+static void appendVar(line_buffer_t *buf, variable_info_t varInfo);
+
+/*
+ * Appends a string of a given length to a buffer
+ */
+static void appendChars(line_buffer_t *buf, const char *chars, size_t length);
+
+/*
+ * Appends formatted output to a buffer
+ */
+static void appendFormat(line_buffer_t *buf, const char *format, ...);
+
+/*
+ * Prints the usage of the symbolizer
+ */
+static void printUsage();
+
+int main(int argc, const char *argv[]) {
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Missing value for option %s\n", argv[i]);
+            printUsage();
+            return 1;
+        }
+
+        if (strcmp(argv[i], "-threads") == 0) {
+            char *end;
+            numThreads = strtol(argv[i + 1], &end, 0);
+            if (*end != '\0' || numThreads < 1) {
+                fprintf(stderr, "Error: Expected a positive integer for "
+                                "option -threads\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            printUsage();
+            return 1;
+        }
+    }
+
+    numInputs = argc - i;
+    if (numInputs == 0) {
+        printUsage();
+        return 1;
+    }
+
+    inputs = calloc(numInputs, sizeof(input_t));
+    if (inputs == NULL) {
+        fprintf(stderr, "Error: Could not allocate inputs\n");
+        return 1;
+    }
+
+    // Every debugging information is loaded before any worker reads it
+    for (int j = 0; j < numInputs; j++) {
+        inputs[j].path = argv[i + j];
+
+        char *modulePath;
+        if (readHeader(inputs[j].path, &modulePath, &inputs[j].start)) {
+            fprintf(stderr, "Error: No module header in %s, which must be "
+                            "traced with -offline 1\n", inputs[j].path);
+            return 1;
+        }
+
+        inputs[j].info = loadModule(modulePath);
+        if (inputs[j].info == NULL) {
+            fprintf(stderr, "Error: Could not load debugging information for "
+                            "%s\n", modulePath);
+            free(modulePath);
+            return 1;
+        }
+        free(modulePath);
+    }
+
+    if (numThreads > numInputs) {
+        numThreads = numInputs;
+    }
+
+    worker_t *workers = calloc(numThreads, sizeof(worker_t));
+    if (workers == NULL) {
+        fprintf(stderr, "Error: Could not allocate workers\n");
+        return 1;
+    }
+
+    for (int j = 0; j < numThreads; j++) {
+        if (pthread_create(&workers[j].thread, NULL, runWorker, &workers[j])) {
+            fprintf(stderr, "Error: Could not create worker thread\n");
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (int j = 0; j < numThreads; j++) {
+        pthread_join(workers[j].thread, NULL);
+        failed |= workers[j].failed;
+
+        free(workers[j].states);
+        free(workers[j].out.data);
+    }
+
+    for (int j = 0; j < sizeModules; j++) {
+        destroyDebugInfo(modules[j].info);
+        free(modules[j].path);
+    }
+
+    free(modules);
+    free(workers);
+    free(inputs);
+
+    return failed;
+}
+
+static int readHeader(const char *path, char **modulePath, void **start) {
+    char *line = readHeaderLine(path);
+    if (line == NULL) {
+        return 1;
+    }
+
+    int res = 1;
+    const char *key = "\"module\": {\"path\": \"";
+    const char *pathStart = strstr(line, key);
+    if (pathStart != NULL) {
+        pathStart += strlen(key);
+        const char *pathEnd = strchr(pathStart, '"');
+
+        uint64_t moduleStart;
+        if (pathEnd != NULL &&
+            parseHexField(pathEnd, pathEnd + strlen(pathEnd), "\"start\": \"",
+                          &moduleStart) == 0) {
+
+            *start = (void *)moduleStart;
+            *modulePath = strndup(pathStart, pathEnd - pathStart);
+            res = *modulePath == NULL;
+        }
+    }
+
+    free(line);
+    return res;
+}
+
+static debug_info_t *loadModule(const char *path) {
+    for (int i = 0; i < sizeModules; i++) {
+        if (strcmp(modules[i].path, path) == 0) {
+            return modules[i].info;
+        }
+    }
+
+    if (sizeModules == capacityModules) {
+        int capacity = capacityModules == 0 ? MIN_CAPACITY
+                                            : 2 * capacityModules;
+        module_t *newModules = reallocarray(modules, capacity,
+                                            sizeof(module_t));
+        if (newModules == NULL) {
+            return NULL;
+        }
+
+        modules = newModules;
+        capacityModules = capacity;
+    }
+
+    char *pathCopy = strdup(path);
+    debug_info_t *info = pathCopy != NULL ? getDebugInfo(path) : NULL;
+    if (info == NULL) {
+        free(pathCopy);
+        return NULL;
+    }
+
+    modules[sizeModules].path = pathCopy;
+    modules[sizeModules].info = info;
+    sizeModules++;
+
+    return info;
+}
+
+static void *runWorker(void *arg) {
+    worker_t *worker = arg;
+
+    int i;
+    while ((i = __atomic_fetch_add(&nextInput, 1, __ATOMIC_RELAXED))
+           < numInputs) {
+
+        if (symbolizeFile(worker, &inputs[i])) {
+            worker->failed = 1;
+        }
+    }
+
+    return NULL;
+}
+
+static int symbolizeFile(worker_t *worker, const input_t *input) {
+    char outPath[strlen(input->path) + sizeof(OUTPUT_SUFFIX)];
+    strcpy(outPath, input->path);
+    strcat(outPath, OUTPUT_SUFFIX);
+
+    FILE *in = fopen(input->path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Error: Could not open %s\n", input->path);
+        return 1;
+    }
+
+    FILE *out = fopen(outPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error: Could not open %s\n", outPath);
+        fclose(in);
+        return 1;
+    }
+
+    // Frames are only carried between entries of the same file
+    worker->sizeStates = 0;
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int res = 0;
+    while ((length = getline(&line, &capacity, in)) > 0) {
+        worker->out.size = 0;
+        symbolizeLine(worker, input, line, length);
+
+        if (worker->out.data == NULL ||
+            fwrite(worker->out.data, 1, worker->out.size, out)
+            != worker->out.size) {
+
+            fprintf(stderr, "Error: Could not write %s\n", outPath);
+            res = 1;
+            break;
+        }
+    }
+
+    free(line);
+    fclose(in);
+    if (fclose(out) != 0) {
+        res = 1;
+    }
+
+    return res;
+}
+
+static void symbolizeLine(worker_t *worker, const input_t *input,
+                          const char *line, size_t length) {
+
+    line_buffer_t *out = &worker->out;
+    const char *end = line + length;
+
+    // Lost buffers, system calls, headers and brackets have no PC
+    uint64_t pcVal;
+    const char *pcKey = findIn(line, end, "\"pc\": \"");
+    if (pcKey == NULL || parseHexField(pcKey, end, "\"pc\": \"", &pcVal)) {
+        appendChars(out, line, length);
+        return;
+    }
+    void *pc = (void *)pcVal;
+
+    long tid = -1;
+    if (strncmp(line, "{\"tid\": ", 8) == 0) {
+        tid = strtol(line + 8, NULL, 10);
+    }
+    frame_state_t *state = getFrameState(worker, tid);
+
+    const char *operands = findIn(pcKey, end, "\"operands\": [");
+    if (operands == NULL) {
+        const char *change = findIn(pcKey, end, "\"change\": {");
+        if (change == NULL || findIn(pcKey, change, "\"file\": ") != NULL) {
+            appendChars(out, line, length);
+            return;
+        }
+
+        appendChars(out, line, change - line);
+        appendSourceLine(out, input, pc);
+        appendChars(out, change, end - change);
+        return;
+    }
+
+    // Entries in the main module give the frame base of their locals
+    const char *frame = findIn(pcKey, operands, "\"frame\": \"");
+    uint64_t frameVal;
+    if (frame != NULL &&
+        parseHexField(frame, operands, "\"frame\": \"", &frameVal) == 0) {
+
+        appendChars(out, line, frame - line);
+        state->pc = pc;
+        state->frame = (void *)frameVal;
+    } else {
+        appendChars(out, line, operands - line);
+    }
+
+    if (findIn(pcKey, operands, "\"file\": ") == NULL) {
+        appendSourceLine(out, input, pc);
+    }
+
+    size_t pos = operands - line + strlen("\"operands\": [");
+    appendChars(out, operands, line + pos - operands);
+
+    while (pos < length && line[pos] != ']') {
+        if (line[pos] == '{') {
+            size_t opndLength = objectLength(line, pos, length);
+            symbolizeOperand(worker, input, state, line + pos, opndLength);
+            pos += opndLength;
+        } else {
+            appendChars(out, line + pos, 1);
+            pos++;
+        }
+    }
+
+    appendChars(out, line + pos, length - pos);
+}
+
+static void symbolizeOperand(worker_t *worker, const input_t *input,
+                             frame_state_t *state, const char *opnd,
+                             size_t length) {
+
+    line_buffer_t *out = &worker->out;
+    const char *end = opnd + length;
+
+    if (findIn(opnd, end, "\"type\": \"memory\"") == NULL &&
+        findIn(opnd, end, "\"type\": \"indirect\"") == NULL) {
+
+        appendChars(out, opnd, length);
+        return;
+    }
+
+    const char *alloc = findIn(opnd, end, ", \"allocation\": {");
+    const char *varEnd = alloc != NULL ? alloc : end - 1;
+
+    appendChars(out, opnd, varEnd - opnd);
+
+    // Indirect operands have no space after the address key
+    uint64_t addr;
+    const char *addrKey = findIn(opnd, varEnd, "\"address\":");
+    if (findIn(opnd, varEnd, "\"variable\": ") == NULL && addrKey != NULL &&
+        parseHexField(addrKey, varEnd, addrKey[10] == ' ' ? "\"address\": \""
+                                                         : "\"address\":\"",
+                      &addr) == 0) {
+
+        // Locals cannot be found before the first entry with a frame
+        variable_info_t varInfo;
+        varInfo = getVariableInfo(input->info, (void *)addr, state->pc,
+                                  input->start, state->frame,
+                                  &state->lastFunc);
+
+        if (varInfo.varName != NULL) {
+            appendFormat(out, ", \"variable\": ");
+            appendVar(out, varInfo);
+        }
+    }
+
+    if (alloc == NULL) {
+        appendChars(out, varEnd, end - varEnd);
+        return;
+    }
+
+    // The site is a return address, so the line is that of the call before it
+    uint64_t site;
+    const char *siteKey = "\"site\": \"";
+    const char *siteEnd = findIn(alloc, end, "\", ");
+    if (findIn(alloc, end, "\"file\": ") == NULL && siteEnd != NULL &&
+        parseHexField(alloc, end, siteKey, &site) == 0) {
+
+        siteEnd += 3;
+        appendChars(out, alloc, siteEnd - alloc);
+        appendSourceLine(out, input, (void *)site - 1);
+        appendChars(out, siteEnd, end - siteEnd);
+    } else {
+        appendChars(out, alloc, end - alloc);
+    }
+}
+
+static frame_state_t *getFrameState(worker_t *worker, long tid) {
+    for (int i = 0; i < worker->sizeStates; i++) {
+        if (worker->states[i].tid == tid) {
+            return &worker->states[i];
+        }
+    }
+
+    if (worker->sizeStates == worker->capacityStates) {
+        int capacity = worker->capacityStates == 0 ? MIN_CAPACITY
+                                                   : 2 * worker->capacityStates;
+        frame_state_t *states = reallocarray(worker->states, capacity,
+                                             sizeof(frame_state_t));
+        if (states == NULL) {
+            fprintf(stderr, "Error: Could not allocate frame states\n");
+            exit(1);
+        }
+
+        worker->states = states;
+        worker->capacityStates = capacity;
+    }
+
+    // A PC outside the module is in no function, so no local is matched
+    frame_state_t *state = &worker->states[worker->sizeStates++];
+    state->tid = tid;
+    state->pc = NULL;
+    state->frame = NULL;
+    state->lastFunc = -1;
+    return state;
+}
+
+static void appendSourceLine(line_buffer_t *buf, const input_t *input,
+                             void *pc) {
+
+    const char *file;
+    unsigned line;
+    if (getSourceLine(input->info, pc, input->start, &file, &line) == 0 &&
+        file[0] == '/') {
+
+        appendFormat(buf, "\"file\": \"%s\", \"line\": %u, ", file, line);
+    }
+}
+
+static void appendVar(line_buffer_t *buf, variable_info_t varInfo) {
+    appendFormat(buf, "{\"name\": \"%s\", \"local\": %s", varInfo.varName,
+                 varInfo.isLocal ? "true" : "false");
+
+    if (varInfo.type.name != NULL) {
+        appendFormat(buf, ", \"type\": {\"name\": \"%s\", \"size\": %u}",
+                     varInfo.type.name, varInfo.type.size);
+    }
+
+    appendFormat(buf, "}");
+}
+
+static void appendChars(line_buffer_t *buf, const char *chars, size_t length) {
+    if (buf->size + length > buf->capacity) {
+        size_t capacity = buf->capacity == 0 ? MIN_CAPACITY : buf->capacity;
+        while (capacity < buf->size + length) {
+            capacity *= 2;
+        }
+
+        char *data = realloc(buf->data, capacity);
+        if (data == NULL) {
+            fprintf(stderr, "Error: Could not allocate output buffer\n");
+            exit(1);
+        }
+
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+
+    memcpy(buf->data + buf->size, chars, length);
+    buf->size += length;
+}
+
+static void appendFormat(line_buffer_t *buf, const char *format, ...) {
+    char chars[1024];
+
+    va_list args, argsCopy;
+    va_start(args, format);
+    va_copy(argsCopy, args);
+    int length = vsnprintf(chars, sizeof(chars), format, args);
+    va_end(args);
+
+    if (length < 0) {
+        va_end(argsCopy);
+        return;
+    } else if ((size_t)length < sizeof(chars)) {
+        va_end(argsCopy);
+        appendChars(buf, chars, length);
+        return;
+    }
+
+    // Long paths are formatted again into a buffer of their full length
+    char *longChars = malloc(length + 1);
+    if (longChars != NULL) {
+        vsnprintf(longChars, length + 1, format, argsCopy);
+        appendChars(buf, longChars, length);
+        free(longChars);
+    }
+    va_end(argsCopy);
+}
+
+static void printUsage() {
+    fprintf(stderr,
+            "Usage: symbolize [-threads <n>] <trace files...>\n"
+            "Writes a copy of each trace file traced with -offline 1, with "
+            OUTPUT_SUFFIX " appended to its name,\n"
+            "adding the source lines and variables left out when tracing\n"
+            "\n"
+            "Options:\n"
+            "  -threads <n>        Symbolize n trace files at a time, by "
+            "default one per core\n");
+}
@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "trace_lines.h"
+
+#define MIN_CAPACITY 16
+#define TIMELINE_PID 1
+
+// Length of a direct near call, whose return address follows it, for traces
+// not giving the return address of their calls
+#define CALL_LENGTH 5
+
+typedef struct {
+    long tid;
+    uint64_t *returns;
+    int sizeReturns, capacityReturns;
+    int returning;
+    uint64_t instrs;
+    double time;
+} track_t;
+
+typedef struct {
+    FILE *out;
+    int firstEvent;
+
+    // The time base of every track, counting instructions if 0
+    double ticksPerMicrosecond;
+    int untimed;
+
+    track_t *tracks;
+    int sizeTracks, capacityTracks;
+} timeline_t;
+
+/*
+ * Reads the timestamp counter frequency of a trace file from its header, noting
+ * if its entries have no timestamps, returning 0 on success
+ */
+static int readTimeBase(const char *path, long tid, void *arg);
+
+/*
+ * Exports a trace file as the track of the given thread or, for the
+ * interleaved trace, the track of each entry's thread, returning 0 on success
+ */
+static int exportFile(const char *path, long tid, void *arg);
+
+/*
+ * Exports a line of a trace file
+ */
+static void exportLine(timeline_t *timeline, long tid, const char *line,
+                       size_t length);
+
+/*
+ * Begins a slice for a call, named by its target
+ */
+static void beginCall(timeline_t *timeline, track_t *track, uint64_t pc,
+                      const char *opnd, const char *end);
+
+/*
+ * Ends the slices of the calls returned from, found by the return address
+ * reached, if it is that of a recorded call
+ */
+static void endCalls(timeline_t *timeline, track_t *track, uint64_t pc);
+
+/*
+ * Gets the track of a thread, adding one if there is none
+ */
+static track_t *getTrack(timeline_t *timeline, long tid);
+
+/*
+ * Writes an event of the timeline
+ */
+static void writeEvent(timeline_t *timeline, const char *format, ...);
+
+/*
+ * Prints the usage of the exporter
+ */
+static void printUsage();
+
+int main(int argc, const char *argv[]) {
+    const char *outPath = "timeline.json";
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Missing value for option %s\n", argv[i]);
+            printUsage();
+            return 1;
+        }
+
+        if (strcmp(argv[i], "-o") == 0) {
+            outPath = argv[i + 1];
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (i == argc) {
+        printUsage();
+        return 1;
+    }
+
+    timeline_t timeline;
+    memset(&timeline, 0, sizeof(timeline));
+    timeline.firstEvent = 1;
+    timeline.out = fopen(outPath, "w");
+    if (timeline.out == NULL) {
+        fprintf(stderr, "Error: Could not open %s\n", outPath);
+        return 1;
+    }
+
+    fprintf(timeline.out, "{\"traceEvents\": [");
+
+    // One time base is used for every track, so entries are only timed by
+    // their timestamps if every trace file has them
+    int failed = 0;
+    for (int j = i; j < argc; j++) {
+        failed |= forEachTraceFile(argv[j], -1, readTimeBase, &timeline);
+    }
+    if (timeline.untimed) {
+        timeline.ticksPerMicrosecond = 0;
+    }
+
+    for (int file = 0; i < argc; i++, file++) {
+        failed |= forEachTraceFile(argv[i], -1 - file, exportFile, &timeline);
+    }
+
+    // Calls still running when tracing stopped end with the last entry
+    for (int j = 0; j < timeline.sizeTracks; j++) {
+        track_t *track = &timeline.tracks[j];
+        for (; track->sizeReturns > 0; track->sizeReturns--) {
+            writeEvent(&timeline,
+                       "{\"ph\": \"E\", \"pid\": %d, \"tid\": %ld, "
+                       "\"ts\": %.3f}",
+                       TIMELINE_PID, track->tid, track->time);
+        }
+
+        writeEvent(&timeline,
+                   "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, "
+                   "\"tid\": %ld, \"args\": {\"name\": \"%s %ld\"}}",
+                   TIMELINE_PID, track->tid,
+                   track->tid < 0 ? "trace" : "thread",
+                   track->tid < 0 ? -track->tid : track->tid);
+
+        free(track->returns);
+    }
+
+    fprintf(timeline.out, "\n]}\n");
+    if (fclose(timeline.out) != 0) {
+        fprintf(stderr, "Error: Could not write %s\n", outPath);
+        failed = 1;
+    }
+
+    free(timeline.tracks);
+
+    return failed;
+}
+
+static int readTimeBase(const char *path, long tid, void *arg) {
+    timeline_t *timeline = arg;
+
+    // System calls alone give a frequency, but no timestamps for entries
+    char *header = readHeaderLine(path);
+    uint64_t frequency, interval;
+    if (header == NULL ||
+        parseUnsignedField(header, header + strlen(header),
+                           "\"tscFrequency\": ", &frequency) != 0 ||
+        parseUnsignedField(header, header + strlen(header),
+                           "\"timestamps\": ", &interval) != 0 ||
+        interval == 0 || frequency == 0) {
+
+        timeline->untimed = 1;
+    } else {
+        timeline->ticksPerMicrosecond = frequency / 1e6;
+    }
+
+    free(header);
+    return 0;
+}
+
+static int exportFile(const char *path, long tid, void *arg) {
+    timeline_t *timeline = arg;
+
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        return 1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, in)) > 0) {
+        if (strncmp(line, "{\"header\": ", 11) == 0) {
+            continue;
+        }
+
+        exportLine(timeline, tid, line, length);
+    }
+
+    free(line);
+    fclose(in);
+    return 0;
+}
+
+static void exportLine(timeline_t *timeline, long tid, const char *line,
+                       size_t length) {
+
+    const char *end = line + length;
+
+    if (strncmp(line, "{\"tid\": ", 8) == 0) {
+        tid = strtol(line + 8, NULL, 10);
+    } else if (line[0] != '{') {
+        return;
+    }
+    track_t *track = getTrack(timeline, tid);
+
+    // System calls have their own timestamps, but are only placed by them when
+    // entries are too
+    const char *syscall = findIn(line, end, "\"syscall\": {");
+    uint64_t number, start, duration;
+    if (syscall != NULL &&
+        parseUnsignedField(syscall, end, "\"number\": ", &number) == 0 &&
+        parseUnsignedField(syscall, end, "\"timestamp\": ", &start) == 0 &&
+        parseUnsignedField(syscall, end, "\"duration\": ", &duration) == 0) {
+
+        if (timeline->ticksPerMicrosecond != 0) {
+            writeEvent(timeline,
+                       "{\"ph\": \"X\", \"cat\": \"syscall\", "
+                       "\"name\": \"syscall %lu\", \"pid\": %d, "
+                       "\"tid\": %ld, \"ts\": %.3f, \"dur\": %.3f}",
+                       number, TIMELINE_PID, track->tid,
+                       start / timeline->ticksPerMicrosecond,
+                       duration / timeline->ticksPerMicrosecond);
+        } else {
+            writeEvent(timeline,
+                       "{\"ph\": \"i\", \"s\": \"t\", "
+                       "\"cat\": \"syscall\", \"name\": \"syscall %lu\", "
+                       "\"pid\": %d, "
+                       "\"tid\": %ld, \"ts\": %.3f, "
+                       "\"args\": {\"ticks\": %lu}}",
+                       number, TIMELINE_PID, track->tid, track->time,
+                       duration);
+        }
+        return;
+    }
+
+    uint64_t buffers;
+    const char *lost = findIn(line, end, "\"lost\": {");
+    if (lost != NULL &&
+        parseUnsignedField(lost, end, "\"buffers\": ", &buffers) == 0) {
+
+        writeEvent(timeline,
+                   "{\"ph\": \"i\", \"s\": \"t\", \"name\": \"lost %lu buffers\", "
+                   "\"pid\": %d, \"tid\": %ld, \"ts\": %.3f}",
+                   buffers, TIMELINE_PID, track->tid, track->time);
+        return;
+    }
+
+    uint64_t pc;
+    const char *pcKey = findIn(line, end, "\"pc\": \"");
+    if (pcKey == NULL || parseHexField(pcKey, end, "\"pc\": \"", &pc)) {
+        return;
+    }
+
+    const char *operands = findIn(pcKey, end, "\"operands\": [");
+    if (operands == NULL) {
+        operands = end;
+    }
+
+    track->instrs++;
+    uint64_t tsc;
+    if (timeline->ticksPerMicrosecond == 0) {
+        track->time = track->instrs;
+    } else if (parseUnsignedField(pcKey, operands, "\"timestamp\": ",
+                                  &tsc) == 0) {
+        track->time = tsc / timeline->ticksPerMicrosecond;
+    }
+
+    // The instruction after a return gives the return address
+    if (track->returning) {
+        endCalls(timeline, track, pc);
+        track->returning = 0;
+    }
+
+    const char *target = findIn(operands, end, "\"type\": \"target\"");
+    if (target != NULL) {
+        beginCall(timeline, track, pc, target, end);
+    } else if (findIn(pcKey, operands, "\"name\": \"ret\"}") != NULL) {
+        track->returning = 1;
+    }
+}
+
+static void beginCall(timeline_t *timeline, track_t *track, uint64_t pc,
+                      const char *opnd, const char *end) {
+
+    if (track->sizeReturns == track->capacityReturns) {
+        int capacity = track->capacityReturns == 0 ? MIN_CAPACITY
+                                                   : 2 * track->capacityReturns;
+        uint64_t *returns = reallocarray(track->returns, capacity,
+                                         sizeof(uint64_t));
+        if (returns == NULL) {
+            fprintf(stderr, "Error: Could not allocate call stack\n");
+            exit(1);
+        }
+
+        track->returns = returns;
+        track->capacityReturns = capacity;
+    }
+
+    uint64_t returnPc;
+    if (parseHexField(opnd, end, "\"return\": \"", &returnPc) != 0) {
+        returnPc = pc + CALL_LENGTH;
+    }
+    track->returns[track->sizeReturns++] = returnPc;
+
+    uint64_t targetPc = 0;
+    parseHexField(opnd, end, "\"pc\": \"", &targetPc);
+
+    const char *name = findIn(opnd, end, "\"name\": \"");
+    const char *nameEnd = name == NULL ? NULL : strchr(name + 9, '"');
+    int nameLength = nameEnd == NULL ? 0 : nameEnd - (name + 9);
+
+    if (nameLength == 0) {
+        writeEvent(timeline,
+                   "{\"ph\": \"B\", \"name\": \"0x%lx\", \"pid\": %d, "
+                   "\"tid\": %ld, \"ts\": %.3f, \"args\": {\"pc\": \"0x%lx\"}}",
+                   targetPc, TIMELINE_PID, track->tid, track->time, targetPc);
+    } else {
+        writeEvent(timeline,
+                   "{\"ph\": \"B\", \"name\": \"%.*s\", \"pid\": %d, "
+                   "\"tid\": %ld, \"ts\": %.3f, \"args\": {\"pc\": \"0x%lx\"}}",
+                   nameLength, name + 9, TIMELINE_PID, track->tid, track->time,
+                   targetPc);
+    }
+}
+
+static void endCalls(timeline_t *timeline, track_t *track, uint64_t pc) {
+    // Returns from calls not recorded, such as indirect calls, end nothing
+    int i = track->sizeReturns - 1;
+    while (i >= 0 && track->returns[i] != pc) {
+        i--;
+    }
+
+    for (; i >= 0 && track->sizeReturns > i; track->sizeReturns--) {
+        writeEvent(timeline,
+                   "{\"ph\": \"E\", \"pid\": %d, \"tid\": %ld, \"ts\": %.3f}",
+                   TIMELINE_PID, track->tid, track->time);
+    }
+}
+
+static track_t *getTrack(timeline_t *timeline, long tid) {
+    for (int i = 0; i < timeline->sizeTracks; i++) {
+        if (timeline->tracks[i].tid == tid) {
+            return &timeline->tracks[i];
+        }
+    }
+
+    if (timeline->sizeTracks == timeline->capacityTracks) {
+        int capacity = timeline->capacityTracks == 0 ?
+                       MIN_CAPACITY : 2 * timeline->capacityTracks;
+        track_t *tracks = reallocarray(timeline->tracks, capacity,
+                                       sizeof(track_t));
+        if (tracks == NULL) {
+            fprintf(stderr, "Error: Could not allocate tracks\n");
+            exit(1);
+        }
+
+        timeline->tracks = tracks;
+        timeline->capacityTracks = capacity;
+    }
+
+    track_t *track = &timeline->tracks[timeline->sizeTracks++];
+    memset(track, 0, sizeof(track_t));
+    track->tid = tid;
+    return track;
+}
+
+static void writeEvent(timeline_t *timeline, const char *format, ...) {
+    fprintf(timeline->out, timeline->firstEvent ? "\n" : ",\n");
+    timeline->firstEvent = 0;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(timeline->out, format, args);
+    va_end(args);
+}
+
+static void printUsage() {
+    fprintf(stderr,
+            "Usage: timeline [-o <file>] <trace files or manifests...>\n"
+            "Writes the calls of each thread as a Chrome trace event timeline\n"
+            "\n"
+            "Options:\n"
+            "  -o <file>           Write the timeline to file, by default "
+            "timeline.json\n");
+}
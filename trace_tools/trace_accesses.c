@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+
+#include "trace_accesses.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace_reader.h"
+
+#define MIN_CAPACITY 16
+
+// Each thread parses up to 8 MiB of a trace at a time
+#define CHUNK_SIZE (8 << 20)
+
+/*
+ * A memory operand of an entry, or a record changing the numbering of
+ * entries, with the first of those of each record marked
+ */
+typedef struct {
+    record_type_t type;
+    int first;
+    uint64_t lostEntries;
+    trace_access_t access;
+} pending_access_t;
+
+typedef struct {
+    pending_access_t *items;
+    uint64_t size, capacity;
+} access_chunk_t;
+
+/*
+ * Gets the accesses of a record, returning how many there are
+ */
+static int getAccesses(const trace_record_t *record, pending_access_t *items);
+
+/*
+ * Numbers the accesses of a record and calls back for them, returning 0 on
+ * success
+ */
+static int numberAccesses(access_reader_t *reader, pending_access_t *items,
+                          int count);
+
+/*
+ * Reads the rest of a trace a window at a time, parsing the chunks of each
+ * window on their own threads before numbering their accesses in order,
+ * returning 0 on success
+ */
+static int readParallel(access_reader_t *reader, trace_reader_t *trace);
+
+/*
+ * Appends the accesses of a record to a chunk, returning 0 on success
+ *
+ * Note: This is a record_callback_t given the chunk
+ */
+static int bufferAccesses(const trace_record_t *record, void *chunk);
+
+/*
+ * Gets the number of entries recorded so far by a thread, adding it if it is
+ * not yet seen
+ */
+static thread_sequence_t *getThread(access_reader_t *reader, long tid);
+
+void initAccessReader(access_reader_t *reader, access_callback_t callback,
+                      void *arg) {
+
+    memset(reader, 0, sizeof(access_reader_t));
+    reader->callback = callback;
+    reader->arg = arg;
+    reader->numThreads = 1;
+}
+
+void destroyAccessReader(access_reader_t *reader) {
+    free(reader->threads);
+}
+
+int readAccesses(const char *path, long tid, void *arg) {
+    access_reader_t *reader = arg;
+    trace_reader_t trace;
+    if (openTraceReader(path, tid, &trace)) {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        return 1;
+    }
+
+    if (reader->numThreads > 1) {
+        int res = readParallel(reader, &trace);
+        closeTraceReader(&trace);
+        return res;
+    }
+
+    // Malformed records are skipped, as are those of unknown kinds
+    trace_record_t record;
+    pending_access_t items[TRACE_MAX_OPERANDS];
+    int res = 0, read;
+    while (res == 0 && (read = nextRecord(&trace, &record)) != 0) {
+        if (read > 0) {
+            res = numberAccesses(reader, items, getAccesses(&record, items));
+        }
+    }
+
+    closeTraceReader(&trace);
+    return res;
+}
+
+static int getAccesses(const trace_record_t *record, pending_access_t *items) {
+    if (record->type == recordHeader || record->type == recordSyscall) {
+        return 0;
+    }
+
+    pending_access_t *item = &items[0];
+    item->type = record->type;
+    item->first = 1;
+    item->lostEntries = record->lostEntries;
+    item->access.tid = record->tid;
+    item->access.pc = record->pc;
+    item->access.opcode = record->opcode;
+    if (record->type != recordEntry) {
+        return 1;
+    }
+
+    int count = 0;
+    for (int i = 0; i < record->numOperands; i++) {
+        const trace_operand_t *opnd = &record->operands[i];
+        if (opnd->type != operandMemory && opnd->type != operandIndirect) {
+            continue;
+        }
+
+        item = &items[count];
+        item->type = recordEntry;
+        item->first = count == 0;
+        item->access.tid = record->tid;
+        item->access.pc = record->pc;
+        item->access.opcode = record->opcode;
+        item->access.kind = opnd->isSrc ? kindLoad : kindStore;
+        item->access.address = opnd->address;
+        item->access.size = opnd->size;
+        item->access.value = opnd->value;
+        item->access.variable = opnd->variable;
+        item->access.variableLength = opnd->variableLength;
+        count++;
+    }
+
+    if (count == 0) {
+        item = &items[0];
+        item->access.kind = kindNone;
+        item->access.address = item->access.size = item->access.value = 0;
+        item->access.variable = NULL;
+        item->access.variableLength = 0;
+        count = 1;
+    }
+
+    return count;
+}
+
+static int numberAccesses(access_reader_t *reader, pending_access_t *items,
+                          int count) {
+
+    if (count == 0) {
+        return 0;
+    }
+    thread_sequence_t *thread = getThread(reader, items[0].access.tid);
+
+    // Sequences count entries as the tracer does, including those dropped
+    if (items[0].type == recordLost) {
+        thread->sequence += items[0].lostEntries;
+        reader->entries += items[0].lostEntries;
+        return 0;
+    }
+
+    uint64_t sequence = thread->sequence++;
+    uint64_t entry = reader->entries++;
+    if (items[0].type == recordChange) {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        items[i].access.sequence = sequence;
+        items[i].access.entry = entry;
+        if (reader->callback(&items[i].access, reader->arg)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int readParallel(access_reader_t *reader, trace_reader_t *trace) {
+    int numThreads = reader->numThreads;
+    access_chunk_t chunks[numThreads];
+    void *args[numThreads];
+    for (int i = 0; i < numThreads; i++) {
+        chunks[i].items = NULL;
+        chunks[i].capacity = 0;
+        args[i] = &chunks[i];
+    }
+
+    // Windows bound the accesses held at once, keeping every chunk busy
+    int res = 0;
+    trace_reader_t window;
+    while (res == 0 &&
+           nextTraceWindow(trace, (size_t)numThreads * CHUNK_SIZE, &window)) {
+
+        for (int i = 0; i < numThreads; i++) {
+            chunks[i].size = 0;
+        }
+        res = readTraceChunks(&window, numThreads, bufferAccesses, args);
+
+        for (int i = 0; i < numThreads && res == 0; i++) {
+            pending_access_t *items = chunks[i].items;
+            uint64_t size = chunks[i].size;
+            for (uint64_t j = 0, count; j < size && res == 0; j += count) {
+                count = 1;
+                while (j + count < size && !items[j + count].first) {
+                    count++;
+                }
+
+                res = numberAccesses(reader, &items[j], count);
+            }
+        }
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        free(chunks[i].items);
+    }
+
+    return res;
+}
+
+static int bufferAccesses(const trace_record_t *record, void *arg) {
+    access_chunk_t *chunk = arg;
+
+    if (chunk->capacity - chunk->size < TRACE_MAX_OPERANDS) {
+        uint64_t capacity = chunk->capacity == 0 ? MIN_CAPACITY
+                                                 : 2 * chunk->capacity;
+        pending_access_t *items = reallocarray(chunk->items, capacity,
+                                               sizeof(pending_access_t));
+        if (items == NULL) {
+            fprintf(stderr, "Error: Could not allocate accesses\n");
+            return 1;
+        }
+
+        chunk->items = items;
+        chunk->capacity = capacity;
+    }
+
+    chunk->size += getAccesses(record, chunk->items + chunk->size);
+    return 0;
+}
+
+static thread_sequence_t *getThread(access_reader_t *reader, long tid) {
+    for (int i = 0; i < reader->sizeThreads; i++) {
+        if (reader->threads[i].tid == tid) {
+            return &reader->threads[i];
+        }
+    }
+
+    if (reader->sizeThreads == reader->capacityThreads) {
+        int capacity = reader->capacityThreads == 0 ?
+                       MIN_CAPACITY : 2 * reader->capacityThreads;
+        thread_sequence_t *threads = reallocarray(reader->threads, capacity,
+                                                  sizeof(thread_sequence_t));
+        if (threads == NULL) {
+            fprintf(stderr, "Error: Could not allocate threads\n");
+            exit(1);
+        }
+
+        reader->threads = threads;
+        reader->capacityThreads = capacity;
+    }
+
+    thread_sequence_t *thread = &reader->threads[reader->sizeThreads++];
+    thread->tid = tid;
+    thread->sequence = 0;
+    return thread;
+}
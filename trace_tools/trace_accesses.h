@@ -0,0 +1,71 @@
+#ifndef TRACE_ACCESSES_H
+#define TRACE_ACCESSES_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+typedef enum {
+    kindNone,
+    kindLoad,
+    kindStore
+} access_kind_t;
+
+typedef struct {
+    long tid;
+
+    // Numbers of the entries before this one of its thread, and of any thread
+    uint64_t sequence, entry;
+
+    uint64_t pc, opcode;
+    access_kind_t kind;
+    uint64_t address, size, value;
+    const char *variable;
+    size_t variableLength;
+} trace_access_t;
+
+/*
+ * Callback for each memory operand of an entry, or once with kindNone for an
+ * entry with none, returning 0 on success
+ */
+typedef int (*access_callback_t)(const trace_access_t *access, void *arg);
+
+typedef struct {
+    long tid;
+    uint64_t sequence;
+} thread_sequence_t;
+
+typedef struct {
+    access_callback_t callback;
+    void *arg;
+    thread_sequence_t *threads;
+    int sizeThreads, capacityThreads;
+    uint64_t entries;
+
+    // Threads parsing each trace file, with 1 reading it sequentially
+    int numThreads;
+} access_reader_t;
+
+/*
+ * Initialises a reader of the accesses of traces, reading them on one thread
+ */
+void initAccessReader(access_reader_t *reader, access_callback_t callback,
+                      void *arg);
+
+/*
+ * Destroys a reader of the accesses of traces
+ */
+void destroyAccessReader(access_reader_t *reader);
+
+/*
+ * Calls back for the accesses of a trace file of the given thread or, for the
+ * interleaved trace, of each entry's thread, continuing the sequences of the
+ * threads of earlier files, returning 0 on success
+ *
+ * Note: With more than one thread, the file is parsed in chunks at once, but
+ *       the accesses are still called back for in order
+ *
+ * Note: This is a trace_file_callback_t given the reader
+ */
+int readAccesses(const char *path, long tid, void *reader);
+
+#endif
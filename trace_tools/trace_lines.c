@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+
+#include "trace_lines.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Reads a manifest, returning NULL if the file is not one
+ *
+ * Note: The contents must be freed by the caller
+ */
+static char *readManifest(const char *path);
+
+const char *findIn(const char *start, const char *end, const char *str) {
+    if (end <= start) {
+        return NULL;
+    }
+
+    return memmem(start, end - start, str, strlen(str));
+}
+
+int parseHexField(const char *start, const char *end, const char *key,
+                  uint64_t *val) {
+
+    const char *field = findIn(start, end, key);
+    if (field == NULL) {
+        return 1;
+    }
+
+    char *valEnd;
+    *val = strtoull(field + strlen(key), &valEnd, 16);
+    return *valEnd != '"';
+}
+
+int parseUnsignedField(const char *start, const char *end, const char *key,
+                       uint64_t *val) {
+
+    const char *field = findIn(start, end, key);
+    if (field == NULL) {
+        return 1;
+    }
+
+    char *valEnd;
+    *val = strtoull(field + strlen(key), &valEnd, 10);
+    return valEnd == field + strlen(key);
+}
+
+size_t objectLength(const char *line, size_t pos, size_t length) {
+    int depth = 0, inString = 0;
+
+    for (size_t i = pos; i < length; i++) {
+        if (inString) {
+            if (line[i] == '\\') {
+                i++;
+            } else if (line[i] == '"') {
+                inString = 0;
+            }
+        } else if (line[i] == '"') {
+            inString = 1;
+        } else if (line[i] == '{') {
+            depth++;
+        } else if (line[i] == '}' && --depth == 0) {
+            return i + 1 - pos;
+        }
+    }
+
+    return length - pos;
+}
+
+char *readHeaderLine(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // The header follows the opening bracket of a JSON array
+    char *line = NULL;
+    size_t capacity = 0;
+    for (int i = 0; i < 2 && getline(&line, &capacity, file) > 0; i++) {
+        if (strncmp(line, "{\"header\": ", 11) == 0) {
+            fclose(file);
+            return line;
+        }
+    }
+
+    fclose(file);
+    free(line);
+    return NULL;
+}
+
+uint64_t hashName(const char *name, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+int forEachTraceFile(const char *input, long defaultTid,
+                     trace_file_callback_t callback, void *arg) {
+
+    char *manifest = readManifest(input);
+    if (manifest == NULL) {
+        return callback(input, defaultTid, arg);
+    }
+
+    // The interleaved trace has no thread of its own
+    long tid = strtol(manifest + 11, NULL, 10);
+
+    // Chunk paths are relative to the directory traced in, as is the manifest
+    const char *dirEnd = strrchr(input, '/');
+    int dirLength = dirEnd == NULL ? 0 : dirEnd + 1 - input;
+
+    const char *key = "\"file\": \"";
+    int res = 0;
+    for (const char *file = strstr(manifest, key); file != NULL && res == 0;
+         file = strstr(file, key)) {
+
+        file += strlen(key);
+        const char *fileEnd = strchr(file, '"');
+        if (fileEnd == NULL) {
+            break;
+        }
+
+        int fileLength = fileEnd - file;
+        int prefixLength = file[0] == '/' ? 0 : dirLength;
+        char chunkPath[prefixLength + fileLength + 1];
+        memcpy(chunkPath, input, prefixLength);
+        memcpy(chunkPath + prefixLength, file, fileLength);
+        chunkPath[prefixLength + fileLength] = '\0';
+
+        res = callback(chunkPath, tid, arg);
+    }
+
+    free(manifest);
+    return res;
+}
+
+static char *readManifest(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // Only a manifest is read whole, as it starts with its thread
+    char *contents = NULL;
+    size_t size = 0;
+    ssize_t length = getline(&contents, &size, file);
+    if (length > 0 && strncmp(contents, "{\"thread\": ", 11) == 0) {
+        rewind(file);
+        length = getdelim(&contents, &size, '\0', file);
+    } else {
+        length = 0;
+    }
+    fclose(file);
+
+    if (length <= 0) {
+        free(contents);
+        return NULL;
+    }
+
+    return contents;
+}
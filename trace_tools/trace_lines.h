@@ -0,0 +1,58 @@
+#ifndef TRACE_LINES_H
+#define TRACE_LINES_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+ * Returns the position of a string within a range, or NULL if it is not found
+ */
+const char *findIn(const char *start, const char *end, const char *str);
+
+/*
+ * Parses the quoted hexadecimal value following the first occurrence of a key
+ * within a range, returning 0 on success
+ */
+int parseHexField(const char *start, const char *end, const char *key,
+                  uint64_t *val);
+
+/*
+ * Parses the unsigned decimal value following the first occurrence of a key
+ * within a range, returning 0 on success
+ */
+int parseUnsignedField(const char *start, const char *end, const char *key,
+                       uint64_t *val);
+
+/*
+ * Returns the length of the object starting at the given position of a line,
+ * or the rest of the line if it does not end
+ */
+size_t objectLength(const char *line, size_t pos, size_t length);
+
+/*
+ * Hashes a name of a given length
+ */
+uint64_t hashName(const char *name, size_t length);
+
+/*
+ * Reads the header line of a trace file, returning NULL if it has none
+ *
+ * Note: The line must be freed by the caller
+ */
+char *readHeaderLine(const char *path);
+
+/*
+ * Callback for a trace file, given the thread whose entries it holds, returning
+ * 0 on success
+ */
+typedef int (*trace_file_callback_t)(const char *path, long tid, void *arg);
+
+/*
+ * Calls back for each trace file of an input, either a trace file, given the
+ * default thread, or a manifest listing the trace files of its thread in order,
+ * returning 0 on success
+ */
+int forEachTraceFile(const char *input, long defaultTid,
+                     trace_file_callback_t callback, void *arg);
+
+#endif
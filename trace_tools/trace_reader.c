@@ -0,0 +1,755 @@
+#define _GNU_SOURCE
+
+#include "trace_reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define KEY_IS(key, length, name) \
+    ((length) == sizeof(name) - 1 && memcmp((key), (name), (length)) == 0)
+
+typedef struct {
+    trace_reader_t *chunk;
+    record_callback_t callback;
+    void *arg;
+    int res;
+} chunk_worker_t;
+
+/*
+ * Returns the position of the next occurrence of a character, or the end if
+ * there is none
+ */
+static const char *findChar(const char *p, const char *end, char c);
+
+/*
+ * Returns the position of the next quote, brace or bracket, or the end if
+ * there is none
+ */
+static const char *findStructural(const char *p, const char *end);
+
+/*
+ * Returns the value of a hexadecimal digit, or 16 if it is not one
+ */
+static inline unsigned hexDigit(char c);
+
+/*
+ * Parses the key of the next field of an object, setting the key to NULL at the
+ * end of the object, returning the position of its value, or after the object,
+ * or NULL if it is malformed
+ */
+static const char *nextKey(const char *p, const char *end, const char **key,
+                           size_t *keyLength);
+
+/*
+ * Skips a value, returning the position after it or NULL if it is malformed
+ */
+static const char *skipValue(const char *p, const char *end);
+
+/*
+ * Parses a string, or null as a NULL string, returning the position after it
+ * or NULL if it is malformed
+ */
+static const char *parseString(const char *p, const char *end,
+                               const char **str, size_t *length);
+
+/*
+ * Parses a quoted hexadecimal value, keeping its low 64 bits, or null,
+ * returning the position after it or NULL if it is malformed
+ */
+static const char *parseHex(const char *p, const char *end, uint64_t *val,
+                            int *hasValue);
+
+/*
+ * Parses a decimal value, possibly negative, returning the position after it
+ * or NULL if it is malformed
+ */
+static const char *parseDecimal(const char *p, const char *end, uint64_t *val);
+
+/*
+ * Parses true or false, returning the position after it or NULL if it is
+ * malformed
+ */
+static const char *parseBool(const char *p, const char *end, int *val);
+
+/*
+ * Parses the fields of a record object into a record, including those of an
+ * entry it holds, returning the position after it or NULL if it is malformed
+ */
+static const char *parseRecord(const char *p, const char *end,
+                               trace_record_t *record);
+
+/*
+ * Parses the opcode object of an entry, returning the position after it or
+ * NULL if it is malformed
+ */
+static const char *parseOpcode(const char *p, const char *end,
+                               trace_record_t *record);
+
+/*
+ * Parses the operands array of an entry, returning the position after it or
+ * NULL if it is malformed
+ */
+static const char *parseOperands(const char *p, const char *end,
+                                 trace_record_t *record);
+
+/*
+ * Parses an operand, or the change object of a change, returning the position
+ * after it or NULL if it is malformed
+ */
+static const char *parseOperand(const char *p, const char *end,
+                                trace_operand_t *opnd);
+
+/*
+ * Parses the name of a variable object, returning the position after it or
+ * NULL if it is malformed
+ */
+static const char *parseVariable(const char *p, const char *end,
+                                 trace_operand_t *opnd);
+
+/*
+ * Parses the counts of a loss marker, returning the position after it or NULL
+ * if it is malformed
+ */
+static const char *parseLost(const char *p, const char *end,
+                             trace_record_t *record);
+
+/*
+ * Parses a system call record, returning the position after it or NULL if it
+ * is malformed
+ */
+static const char *parseSyscall(const char *p, const char *end,
+                                trace_record_t *record);
+
+/*
+ * Reads the records of a chunk on a worker thread
+ */
+static void *readChunk(void *arg);
+
+int openTraceReader(const char *path, long tid, trace_reader_t *reader) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    reader->map = NULL;
+    reader->mapSize = st.st_size;
+    reader->tid = tid;
+
+    // Empty files cannot be mapped, but have no records to read anyway
+    if (reader->mapSize != 0) {
+        reader->map = mmap(NULL, reader->mapSize, PROT_READ, MAP_PRIVATE, fd,
+                           0);
+        if (reader->map == MAP_FAILED) {
+            close(fd);
+            return 1;
+        }
+
+        madvise(reader->map, reader->mapSize, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+    reader->pos = reader->map;
+    reader->end = reader->pos + reader->mapSize;
+    return 0;
+}
+
+void closeTraceReader(trace_reader_t *reader) {
+    if (reader->map != NULL) {
+        munmap(reader->map, reader->mapSize);
+    }
+}
+
+int nextRecord(trace_reader_t *reader, trace_record_t *record) {
+    const char *p = reader->pos, *end = reader->end;
+
+    // Records are separated by commas and newlines within an array
+    while (p < end && *p != '{') {
+        p++;
+    }
+
+    if (p == end) {
+        reader->pos = end;
+        return 0;
+    }
+
+    record->type = recordEntry;
+    record->tid = reader->tid;
+    record->text = p;
+    record->pc = record->opcode = record->timestamp = 0;
+    record->taken = -1;
+    record->file = NULL;
+    record->fileLength = 0;
+    record->line = record->frame = 0;
+    record->numOperands = 0;
+    record->lostBuffers = record->lostEntries = 0;
+    record->syscall = record->duration = 0;
+
+    const char *after = parseRecord(p, end, record);
+    if (after == NULL) {
+        // Skips the rest of the line of a malformed record
+        reader->pos = findChar(p, end, '\n');
+        return -1;
+    }
+
+    record->length = after - p;
+    reader->pos = after;
+    return 1;
+}
+
+int splitTraceReader(const trace_reader_t *reader, int numChunks,
+                     trace_reader_t *chunks) {
+
+    const char *start = reader->pos;
+    size_t size = reader->end - start;
+    int sizeChunks = 0;
+
+    // Chunks end after the newline following an even split
+    for (int i = 1; i <= numChunks && start < reader->end; i++) {
+        const char *chunkEnd = reader->end;
+        if (i < numChunks) {
+            chunkEnd = reader->pos + size / numChunks * i;
+            if (chunkEnd < start) {
+                chunkEnd = start;
+            }
+
+            chunkEnd = findChar(chunkEnd, reader->end, '\n');
+            chunkEnd += chunkEnd < reader->end;
+        }
+
+        trace_reader_t *chunk = &chunks[sizeChunks++];
+        chunk->map = NULL;
+        chunk->mapSize = 0;
+        chunk->pos = start;
+        chunk->end = chunkEnd;
+        chunk->tid = reader->tid;
+        start = chunkEnd;
+    }
+
+    return sizeChunks;
+}
+
+int nextTraceWindow(trace_reader_t *reader, size_t size,
+                    trace_reader_t *window) {
+
+    if (reader->pos >= reader->end) {
+        return 0;
+    }
+
+    // Windows end after the newline following the given size
+    const char *end = reader->end;
+    if ((size_t)(reader->end - reader->pos) > size) {
+        end = findChar(reader->pos + size, reader->end, '\n');
+        end += end < reader->end;
+    }
+
+    window->map = NULL;
+    window->mapSize = 0;
+    window->pos = reader->pos;
+    window->end = end;
+    window->tid = reader->tid;
+    reader->pos = end;
+    return 1;
+}
+
+int readTraceChunks(const trace_reader_t *reader, int numThreads,
+                    record_callback_t callback, void **args) {
+
+    trace_reader_t chunks[numThreads];
+    chunk_worker_t workers[numThreads];
+    pthread_t threads[numThreads];
+    int numChunks = splitTraceReader(reader, numThreads, chunks);
+
+    int res = 0, started = 0;
+    for (; started < numChunks; started++) {
+        chunk_worker_t *worker = &workers[started];
+        worker->chunk = &chunks[started];
+        worker->callback = callback;
+        worker->arg = args[started];
+        worker->res = 0;
+
+        if (pthread_create(&threads[started], NULL, readChunk, worker) != 0) {
+            fprintf(stderr, "Error: Could not start a reader thread\n");
+            res = 1;
+            break;
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        res = res || workers[i].res;
+    }
+
+    return res;
+}
+
+static const char *findChar(const char *p, const char *end, char c) {
+#ifdef __SSE2__
+    const __m128i target = _mm_set1_epi8(c);
+    for (; end - p >= 16; p += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, target));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    while (p < end && *p != c) {
+        p++;
+    }
+
+    return p;
+}
+
+static const char *findStructural(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}');
+
+    // Square brackets differ from braces only in bit 5
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    for (; end - p >= 16; p += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)p);
+        __m128i folded = _mm_or_si128(chars, caseBit);
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(chars, quote),
+                                     _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                                                  _mm_cmpeq_epi8(folded, close)));
+        int mask = _mm_movemask_epi8(found);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; p < end; p++) {
+        char c = *p | 0x20;
+        if (*p == '"' || c == '{' || c == '}') {
+            return p;
+        }
+    }
+
+    return p;
+}
+
+static inline unsigned hexDigit(char c) {
+    unsigned digit = (unsigned)(c - '0');
+    if (digit < 10) {
+        return digit;
+    }
+
+    digit = (unsigned)((c | 0x20) - 'a');
+    return digit < 6 ? digit + 10 : 16;
+}
+
+static const char *nextKey(const char *p, const char *end, const char **key,
+                           size_t *keyLength) {
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    while (p < end && (*p == ' ' || *p == ',')) {
+        p++;
+    }
+
+    if (p == end) {
+        return NULL;
+    } else if (*p == '}') {
+        *key = NULL;
+        return p + 1;
+    } else if (*p != '"') {
+        return NULL;
+    }
+
+    const char *keyEnd = findChar(p + 1, end, '"');
+    if (end - keyEnd < 2 || keyEnd[1] != ':') {
+        return NULL;
+    }
+
+    *key = p + 1;
+    *keyLength = keyEnd - *key;
+
+    // Keys are followed by a space, except the address of an indirect operand
+    p = keyEnd + 2;
+    while (p < end && *p == ' ') {
+        p++;
+    }
+
+    return p;
+}
+
+static const char *skipValue(const char *p, const char *end) {
+    if (p == end) {
+        return NULL;
+    } else if (*p == '"') {
+        p = findChar(p + 1, end, '"');
+        return p == end ? NULL : p + 1;
+    } else if (*p != '{' && *p != '[') {
+        while (p < end && *p != ',' && *p != '}' && *p != ']') {
+            p++;
+        }
+        return p == end ? NULL : p;
+    }
+
+    int depth = 0;
+    for (p = findStructural(p, end); p < end; p = findStructural(p, end)) {
+        if (*p == '"') {
+            p = findChar(p + 1, end, '"');
+            if (p == end) {
+                return NULL;
+            }
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else if (--depth == 0) {
+            return p + 1;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+static const char *parseString(const char *p, const char *end,
+                               const char **str, size_t *length) {
+
+    if (end - p >= 4 && memcmp(p, "null", 4) == 0) {
+        *str = NULL;
+        *length = 0;
+        return p + 4;
+    } else if (p == end || *p != '"') {
+        return NULL;
+    }
+
+    const char *strEnd = findChar(p + 1, end, '"');
+    if (strEnd == end) {
+        return NULL;
+    }
+
+    *str = p + 1;
+    *length = strEnd - *str;
+    return strEnd + 1;
+}
+
+static const char *parseHex(const char *p, const char *end, uint64_t *val,
+                            int *hasValue) {
+
+    int isNull = end - p >= 4 && memcmp(p, "null", 4) == 0;
+    if (hasValue != NULL) {
+        *hasValue = !isNull;
+    }
+
+    if (isNull) {
+        *val = 0;
+        return p + 4;
+    } else if (end - p < 4 || memcmp(p, "\"0x", 3) != 0) {
+        return NULL;
+    }
+
+    // Shifting out the high digits of wider values keeps their low 64 bits
+    uint64_t digits = 0;
+    unsigned digit;
+    for (p += 3; p < end && (digit = hexDigit(*p)) < 16; p++) {
+        digits = digits << 4 | digit;
+    }
+
+    if (p == end || *p != '"') {
+        return NULL;
+    }
+
+    *val = digits;
+    return p + 1;
+}
+
+static const char *parseDecimal(const char *p, const char *end, uint64_t *val) {
+    int negative = p < end && *p == '-';
+    p += negative;
+
+    const char *start = p;
+    uint64_t digits = 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+        digits = digits * 10 + (*p - '0');
+    }
+
+    if (p == start) {
+        return NULL;
+    }
+
+    *val = negative ? -digits : digits;
+    return p;
+}
+
+static const char *parseBool(const char *p, const char *end, int *val) {
+    if (end - p >= 4 && memcmp(p, "true", 4) == 0) {
+        *val = 1;
+        return p + 4;
+    } else if (end - p >= 5 && memcmp(p, "false", 5) == 0) {
+        *val = 0;
+        return p + 5;
+    }
+
+    return NULL;
+}
+
+static const char *parseRecord(const char *p, const char *end,
+                               trace_record_t *record) {
+
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+
+    const char *key;
+    size_t keyLength;
+    uint64_t val;
+    p++;
+
+    while ((p = nextKey(p, end, &key, &keyLength)) != NULL && key != NULL) {
+        if (KEY_IS(key, keyLength, "pc")) {
+            p = parseHex(p, end, &record->pc, NULL);
+        } else if (KEY_IS(key, keyLength, "opcode")) {
+            p = p < end && *p == '{' ? parseOpcode(p, end, record)
+                                     : parseDecimal(p, end, &record->opcode);
+        } else if (KEY_IS(key, keyLength, "operands")) {
+            p = parseOperands(p, end, record);
+        } else if (KEY_IS(key, keyLength, "timestamp")) {
+            p = parseDecimal(p, end, &record->timestamp);
+        } else if (KEY_IS(key, keyLength, "taken")) {
+            p = parseBool(p, end, &record->taken);
+        } else if (KEY_IS(key, keyLength, "file")) {
+            p = parseString(p, end, &record->file, &record->fileLength);
+        } else if (KEY_IS(key, keyLength, "line")) {
+            p = parseDecimal(p, end, &record->line);
+        } else if (KEY_IS(key, keyLength, "frame")) {
+            p = parseHex(p, end, &record->frame, NULL);
+        } else if (KEY_IS(key, keyLength, "tid")) {
+            p = parseDecimal(p, end, &val);
+            record->tid = (long)val;
+        } else if (KEY_IS(key, keyLength, "entry")) {
+            p = parseRecord(p, end, record);
+        } else if (KEY_IS(key, keyLength, "change")) {
+            record->type = recordChange;
+            record->numOperands = 1;
+            p = parseOperand(p, end, &record->operands[0]);
+        } else if (KEY_IS(key, keyLength, "lost")) {
+            record->type = recordLost;
+            p = parseLost(p, end, record);
+        } else if (KEY_IS(key, keyLength, "syscall")) {
+            record->type = recordSyscall;
+            p = parseSyscall(p, end, record);
+        } else {
+            if (KEY_IS(key, keyLength, "header")) {
+                record->type = recordHeader;
+            }
+            p = skipValue(p, end);
+        }
+    }
+
+    return p;
+}
+
+static const char *parseOpcode(const char *p, const char *end,
+                               trace_record_t *record) {
+
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+
+    const char *key;
+    size_t keyLength;
+    p++;
+
+    while ((p = nextKey(p, end, &key, &keyLength)) != NULL && key != NULL) {
+        if (KEY_IS(key, keyLength, "value")) {
+            p = parseDecimal(p, end, &record->opcode);
+        } else {
+            p = skipValue(p, end);
+        }
+    }
+
+    return p;
+}
+
+static const char *parseOperands(const char *p, const char *end,
+                                 trace_record_t *record) {
+
+    if (p == end || *p != '[') {
+        return NULL;
+    }
+
+    // Operands beyond those the tracer records are parsed but not kept
+    trace_operand_t extra;
+    for (p++; p != NULL && p < end; ) {
+        if (*p == ']') {
+            return p + 1;
+        } else if (*p == ',' || *p == ' ') {
+            p++;
+        } else if (record->numOperands < TRACE_MAX_OPERANDS) {
+            p = parseOperand(p, end, &record->operands[record->numOperands++]);
+        } else {
+            p = parseOperand(p, end, &extra);
+        }
+    }
+
+    return NULL;
+}
+
+static const char *parseOperand(const char *p, const char *end,
+                                trace_operand_t *opnd) {
+
+    memset(opnd, 0, sizeof(trace_operand_t));
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+
+    const char *key, *type;
+    size_t keyLength, typeLength;
+    p++;
+
+    while ((p = nextKey(p, end, &key, &keyLength)) != NULL && key != NULL) {
+        if (KEY_IS(key, keyLength, "isSrc")) {
+            p = parseBool(p, end, &opnd->isSrc);
+        } else if (KEY_IS(key, keyLength, "type")) {
+            p = parseString(p, end, &type, &typeLength);
+            opnd->type = type == NULL ? operandNull :
+                KEY_IS(type, typeLength, "register") ? operandRegister :
+                KEY_IS(type, typeLength, "immediate") ? operandImmediate :
+                KEY_IS(type, typeLength, "memory") ? operandMemory :
+                KEY_IS(type, typeLength, "indirect") ? operandIndirect :
+                KEY_IS(type, typeLength, "target") ? operandTarget :
+                operandNull;
+        } else if (KEY_IS(key, keyLength, "address")) {
+            // Changes to memory give an address without a type
+            if (opnd->type == operandNull) {
+                opnd->type = operandMemory;
+            }
+            p = parseHex(p, end, &opnd->address, NULL);
+        } else if (KEY_IS(key, keyLength, "size")) {
+            p = parseDecimal(p, end, &opnd->size);
+        } else if (KEY_IS(key, keyLength, "value") ||
+                   KEY_IS(key, keyLength, "new")) {
+            p = parseHex(p, end, &opnd->value, &opnd->hasValue);
+        } else if (KEY_IS(key, keyLength, "name") ||
+                   KEY_IS(key, keyLength, "base")) {
+            p = parseString(p, end, &opnd->name, &opnd->nameLength);
+        } else if (KEY_IS(key, keyLength, "register")) {
+            opnd->type = operandRegister;
+            p = parseString(p, end, &opnd->name, &opnd->nameLength);
+        } else if (KEY_IS(key, keyLength, "pc")) {
+            p = parseHex(p, end, &opnd->address, NULL);
+        } else if (KEY_IS(key, keyLength, "distance")) {
+            p = parseString(p, end, &type, &typeLength);
+            opnd->isFar = type != NULL && KEY_IS(type, typeLength, "far");
+        } else if (KEY_IS(key, keyLength, "variable")) {
+            p = parseVariable(p, end, opnd);
+        } else {
+            p = skipValue(p, end);
+        }
+    }
+
+    return p;
+}
+
+static const char *parseVariable(const char *p, const char *end,
+                                 trace_operand_t *opnd) {
+
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+
+    const char *key;
+    size_t keyLength;
+    p++;
+
+    while ((p = nextKey(p, end, &key, &keyLength)) != NULL && key != NULL) {
+        if (KEY_IS(key, keyLength, "name")) {
+            p = parseString(p, end, &opnd->variable, &opnd->variableLength);
+        } else {
+            p = skipValue(p, end);
+        }
+    }
+
+    return p;
+}
+
+static const char *parseLost(const char *p, const char *end,
+                             trace_record_t *record) {
+
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+
+    const char *key;
+    size_t keyLength;
+    p++;
+
+    while ((p = nextKey(p, end, &key, &keyLength)) != NULL && key != NULL) {
+        if (KEY_IS(key, keyLength, "buffers")) {
+            p = parseDecimal(p, end, &record->lostBuffers);
+        } else if (KEY_IS(key, keyLength, "entries")) {
+            p = parseDecimal(p, end, &record->lostEntries);
+        } else {
+            p = skipValue(p, end);
+        }
+    }
+
+    return p;
+}
+
+static const char *parseSyscall(const char *p, const char *end,
+                                trace_record_t *record) {
+
+    if (p == end || *p != '{') {
+        return NULL;
+    }
+
+    const char *key;
+    size_t keyLength;
+    p++;
+
+    while ((p = nextKey(p, end, &key, &keyLength)) != NULL && key != NULL) {
+        if (KEY_IS(key, keyLength, "number")) {
+            p = parseDecimal(p, end, &record->syscall);
+        } else if (KEY_IS(key, keyLength, "timestamp")) {
+            p = parseDecimal(p, end, &record->timestamp);
+        } else if (KEY_IS(key, keyLength, "duration")) {
+            p = parseDecimal(p, end, &record->duration);
+        } else {
+            p = skipValue(p, end);
+        }
+    }
+
+    return p;
+}
+
+static void *readChunk(void *arg) {
+    chunk_worker_t *worker = arg;
+    trace_record_t record;
+
+    int res;
+    while ((res = nextRecord(worker->chunk, &record)) != 0) {
+        if (res < 0) {
+            fprintf(stderr, "Error: Skipped a malformed record\n");
+        } else if (worker->callback(&record, worker->arg)) {
+            worker->res = 1;
+            break;
+        }
+    }
+
+    return NULL;
+}
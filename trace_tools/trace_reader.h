@@ -0,0 +1,136 @@
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// As many operands as the tracer records for an entry
+#define TRACE_MAX_OPERANDS 8
+
+typedef enum {
+    operandNull,
+    operandRegister,
+    operandImmediate,
+    operandMemory,
+    operandIndirect,
+    operandTarget
+} operand_type_t;
+
+typedef struct {
+    operand_type_t type;
+    int isSrc, isFar, hasValue;
+
+    // The address of a memory or indirect operand, or the pc of a target
+    uint64_t address;
+
+    // Values wider than 64 bits keep their low 64 bits
+    uint64_t size, value;
+
+    // The name of a register or target, or the base register of an indirect
+    // operand
+    const char *name;
+    size_t nameLength;
+
+    const char *variable;
+    size_t variableLength;
+} trace_operand_t;
+
+typedef enum {
+    recordEntry,
+    recordChange,
+    recordLost,
+    recordSyscall,
+    recordHeader
+} record_type_t;
+
+typedef struct {
+    record_type_t type;
+    long tid;
+
+    // The text of the record, from its opening brace to its closing one
+    const char *text;
+    size_t length;
+
+    // The timestamp of an entry or change, or the start of a system call,
+    // with 0 if it has none
+    uint64_t pc, opcode, timestamp;
+
+    // Whether a branch was taken, or -1 if the entry is not a branch
+    int taken;
+
+    const char *file;
+    size_t fileLength;
+    uint64_t line, frame;
+
+    // For a change, the only operand is the register or memory changed, with
+    // its new value
+    int numOperands;
+    trace_operand_t operands[TRACE_MAX_OPERANDS];
+
+    uint64_t lostBuffers, lostEntries;
+    uint64_t syscall, duration;
+} trace_record_t;
+
+typedef struct {
+    // The mapping of the file, or NULL for a chunk sharing another's mapping
+    void *map;
+    size_t mapSize;
+
+    const char *pos, *end;
+    long tid;
+} trace_reader_t;
+
+/*
+ * Callback for each record read from a chunk, returning 0 on success
+ */
+typedef int (*record_callback_t)(const trace_record_t *record, void *arg);
+
+/*
+ * Opens a trace file for reading, giving its records the thread unless they
+ * name their own, returning 0 on success
+ */
+int openTraceReader(const char *path, long tid, trace_reader_t *reader);
+
+/*
+ * Closes a trace file
+ */
+void closeTraceReader(trace_reader_t *reader);
+
+/*
+ * Reads the next record of a trace, returning 1 if there is one, 0 at the end
+ * of the trace and -1 if a record is malformed
+ *
+ * Note: The strings of the record point into the file, and are only valid
+ *       until it is closed
+ */
+int nextRecord(trace_reader_t *reader, trace_record_t *record);
+
+/*
+ * Splits the rest of a trace into at most the given number of chunks of whole
+ * records, returning the number of chunks
+ *
+ * Note: The chunks share the mapping of the reader, so must not be used after
+ *       it is closed
+ */
+int splitTraceReader(const trace_reader_t *reader, int numChunks,
+                     trace_reader_t *chunks);
+
+/*
+ * Takes the whole records of a trace within about the given number of bytes
+ * into a window, moving the trace past them, returning 0 at its end
+ *
+ * Note: The window shares the mapping of the reader, so must not be used
+ *       after it is closed
+ */
+int nextTraceWindow(trace_reader_t *reader, size_t size,
+                    trace_reader_t *window);
+
+/*
+ * Reads the rest of a trace in at most the given number of chunks, each on
+ * its own thread, calling back for the records of the i-th chunk in order with
+ * the i-th argument, returning 0 on success
+ */
+int readTraceChunks(const trace_reader_t *reader, int numThreads,
+                    record_callback_t callback, void **args);
+
+#endif